@@ -2,11 +2,39 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <libsdb/expression.hpp>
+#include <libsdb/trace_buffer.hpp>
 #include <libsdb/types.hpp>
 
+#include <optional>
+#include <utility>
+#include <vector>
+
 namespace sdb
 {
 class process;
+class thread;
+template <typename Stoppoint>
+class stoppoint_collection;
+
+// An instruction simple enough that stepping over it is just a few register
+// and memory writes we make ourselves, rather than a single step
+struct emulated_instruction
+{
+    enum class operation : std::uint8_t
+    {
+        Nop,      // Including endbr64
+        Push,     // push source
+        Move,     // mov destination, source
+        Subtract, // sub destination, immediate
+    };
+
+    operation op;
+    std::uint8_t length;
+    register_id destination;
+    register_id source;
+    std::uint64_t immediate;
+};
 
 class breakpoint_site
 {
@@ -16,13 +44,21 @@ public:
     breakpoint_site() = delete;
     breakpoint_site(const breakpoint_site&) = delete;
     breakpoint_site& operator=(const breakpoint_site&) = delete;
+    ~breakpoint_site();
 
     id_type id() const { return id_; }
 
     void enable();
     void disable();
 
+    // Sites nearby share one memory read and write, rather than two ptrace calls
+    // each. All must be of the same process, and in order of address.
+    static void enable_all(const std::vector<breakpoint_site*>& sites);
+    static void disable_all(const std::vector<breakpoint_site*>& sites);
+
     bool is_enabled() const { return is_enabled_; }
+    // Hardware sites use a debug register rather than writing int3 into memory
+    bool is_hardware() const { return is_hardware_; }
     virtual_address address() const { return address_; }
 
     bool at_address(virtual_address address) const {
@@ -33,16 +69,62 @@ public:
         return low <= address_ && high > address_;
     }
 
+    // A hit only stops the process if the condition evaluates to non-zero,
+    // otherwise we continue without the caller ever seeing the stop
+    const std::optional<expression>& condition() const { return condition_; }
+    void set_condition(std::optional<expression> condition) { condition_ = std::move(condition); }
+
+    // Hits where the condition held, including those ignored
+    std::uint64_t hit_count() const { return hit_count_; }
+    // The next this many hits where the condition holds don't stop either
+    std::uint64_t ignore_count() const { return ignore_count_; }
+    void set_ignore_count(std::uint64_t count) { ignore_count_ = count; }
+
+    // A tracepoint records into the process's trace buffer when it would
+    // stop, and carries on instead. It stops if there is no room for the record.
+    const std::optional<trace_spec>& trace() const { return trace_; }
+    void set_trace(std::optional<trace_spec> spec);
+
 private:
     friend process;
+    friend stoppoint_collection<breakpoint_site>;
 
-    breakpoint_site(process& proc, virtual_address address);
+    breakpoint_site(process& proc, virtual_address address, bool is_hardware);
+    // The same site in a forked child, whose memory already matches ours
+    breakpoint_site(process& proc, const breakpoint_site& parent_site);
+
+    // Counts a hit by this thread, returning whether it should stop the process
+    bool record_hit(const thread& stopped);
 
     id_type id_;
     process* process_;
     virtual_address address_;
     bool is_enabled_;
     std::byte saved_data_;
+    bool is_hardware_;
+    int hardware_register_index_ = -1;
+    bool is_internal_ = false; // Set while the process uses us for next or finish
+
+    std::optional<expression> condition_;
+    std::uint64_t hit_count_ = 0;
+    std::uint64_t ignore_count_ = 0;
+    std::optional<trace_spec> trace_;
+
+    // A copy of the instruction we replace, followed by a jump back, which
+    // threads run to step over us while the int3 stays in place
+    struct displaced_instruction
+    {
+        virtual_address address;
+        std::size_t code_size;
+        std::size_t length; // Of the original
+        bool is_call;
+        bool is_syscall;
+    };
+    std::optional<displaced_instruction> displaced_;
+    bool is_displaceable_ = true; // Until we fail to make the copy
 
+    // Worked out the first time a thread steps over us
+    std::optional<emulated_instruction> emulated_;
+    bool is_decoded_ = false;
 };
 }
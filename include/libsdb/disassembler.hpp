@@ -1,5 +1,7 @@
 #pragma once
 
+#include <libsdb/elf.hpp>
+#include <libsdb/instruction_cache.hpp>
 #include <libsdb/process.hpp>
 
 #include <optional>
@@ -9,18 +11,21 @@ namespace sdb
 
 class disassembler
 {
-    struct instruction
-    {
-        virtual_address address;
-        std::string text;
-    };
-
 public:
     disassembler(process& proc) : process_(&proc) {}
+    // Without a process, only code in the file's executable segments can be
+    // disassembled, at the addresses it was linked at unless told otherwise
+    disassembler(const elf& file) : elf_(&file) {}
 
-    std::vector<instruction> disassemble(std::size_t instruction_count, std::optional<virtual_address> address = std::nullopt);
+    // Decoded instructions are cached by the process, so only code not seen
+    // since it was last written is read and decoded, and text is only
+    // formatted for the instructions printed. Without an address, from the
+    // program counter, or the entry point without a process.
+    std::vector<const decoded_instruction*> disassemble(std::size_t instruction_count, std::optional<virtual_address> address = std::nullopt);
 
 private:
-    process* process_;
+    process* process_ = nullptr;
+    const elf* elf_ = nullptr;
+    instruction_cache cache_; // Only used without a process, which has its own
 };
 }
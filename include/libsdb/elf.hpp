@@ -0,0 +1,129 @@
+#pragma once
+
+#include <libsdb/types.hpp>
+
+#include <elf.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace sdb
+{
+class line_table;
+
+// An ELF file mapped read only, so code and symbols can be read from it without a process
+class elf
+{
+public:
+    // With cache_directory, the symbol index and any sections which had to be
+    // decompressed are kept in files there named for the build ID, and mapped
+    // from there rather than built again next time
+    explicit elf(const std::filesystem::path& path, std::optional<std::filesystem::path> cache_directory = std::nullopt);
+    ~elf();
+
+    elf(const elf&) = delete;
+    elf& operator=(const elf&) = delete;
+
+    std::filesystem::path path() const { return path_; }
+    const Elf64_Ehdr& get_header() const { return header_; }
+    // In hex, empty if the file has no NT_GNU_BUILD_ID note
+    const std::string& build_id() const { return build_id_; }
+
+    // $XDG_CACHE_HOME/sdb, or ~/.cache/sdb
+    static std::filesystem::path default_cache_directory();
+    // Whether the symbol index was mapped from the cache rather than built
+    bool is_index_cached() const { return is_index_cached_; }
+
+    // Added to the addresses the file was linked at to get those it was loaded at
+    virtual_address load_bias() const { return load_bias_; }
+    void notify_loaded(virtual_address load_bias) { load_bias_ = load_bias; }
+
+    // Up to size bytes from address, as loaded, in a read only executable
+    // segment, stopping short at its end. Empty if address isn't in one.
+    span<const std::byte> code_at(virtual_address address, std::size_t size) const;
+    // Whether any of [address, address + size), as loaded, is in one
+    bool contains_code(virtual_address address, std::size_t size) const;
+
+    std::size_t section_count() const { return section_count_; }
+    std::string_view get_section_name(std::size_t index) const;
+    // Nullptr if there is no section of that name
+    const Elf64_Shdr* get_section(std::string_view name) const;
+    // Empty if there is no section of that name, or it has no bytes in the file.
+    // SHF_COMPRESSED sections are decompressed the first time they are asked for.
+    span<const std::byte> get_section_contents(std::string_view name) const;
+
+    // Function and object symbols from .symtab and .dynsym, at the addresses
+    // they were linked at. Names point into the mapping, rather than being copied.
+    std::size_t symbol_count() const { return symbols_by_address_.size(); }
+    std::string_view get_symbol_name(const Elf64_Sym& symbol) const;
+    // Demangled on each call, as most symbols are never shown
+    std::string get_demangled_name(const Elf64_Sym& symbol) const;
+    // By mangled name, or failing that the demangled name with or without its
+    // parameters, which demangles every symbol the first time it is needed
+    std::vector<const Elf64_Sym*> get_symbols_by_name(std::string_view name) const;
+    // Nullptr if no symbol covers address, as linked
+    const Elf64_Sym* get_symbol_containing_address(virtual_address address) const;
+
+    // From .debug_line, found the first time it is needed. Empty without debug information.
+    const line_table& get_line_table() const;
+
+private:
+    // The string at index in a string table section
+    std::string_view get_string(const Elf64_Shdr& string_table, std::size_t index) const;
+    void find_build_id();
+    void find_symbol_tables();
+    // By its index across the symbol tables, .symtab then .dynsym
+    const Elf64_Sym& get_symbol(std::uint32_t ref) const;
+    void build_symbol_index();
+    bool load_symbol_index(const std::filesystem::path& cache_path);
+    void save_symbol_index(const std::filesystem::path& cache_path) const;
+    span<const std::byte> decompress_section(const Elf64_Shdr& section) const;
+    void build_demangled_index() const;
+
+    std::filesystem::path path_;
+    int fd_ = -1;
+    std::size_t file_size_ = 0;
+    std::byte* data_ = nullptr;
+    Elf64_Ehdr header_;
+    virtual_address load_bias_;
+    // Loaded as they are in the file, unless the dynamic loader relocates text
+    std::vector<Elf64_Phdr> code_segments_;
+
+    const Elf64_Shdr* section_headers_ = nullptr;
+    std::size_t section_count_ = 0;
+    std::string build_id_;
+    std::optional<std::filesystem::path> cache_directory_; // Only with a build ID to name files by
+
+    struct symbol_table
+    {
+        const Elf64_Sym* symbols;
+        std::size_t count;
+        const Elf64_Shdr* strings;
+        const Elf64_Shdr* section;
+        std::uint32_t first;     // The ref of its first symbol
+    };
+    std::vector<symbol_table> symbol_tables_;
+
+    // Flat arrays of refs, so they can be mapped straight from the cache. They
+    // point into either index_storage_ or index_mapping_.
+    span<const std::uint32_t> symbols_by_address_; // Sorted, for a binary search
+    span<const std::uint32_t> name_hash_;          // Ref + 1 by hash of the name, 0 if empty
+    std::vector<std::uint32_t> index_storage_;
+    void* index_mapping_ = nullptr;
+    std::size_t index_mapping_size_ = 0;
+    bool is_index_cached_ = false;
+    mutable bool is_demangled_ = false;
+    mutable std::unordered_multimap<std::string, const Elf64_Sym*> symbols_by_demangled_name_;
+
+    mutable std::unique_ptr<line_table> line_table_;
+    // By section index, each its own mapping, of a cache file if there is one
+    mutable std::unordered_map<std::size_t, span<const std::byte>> decompressed_sections_;
+};
+}
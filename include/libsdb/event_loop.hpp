@@ -0,0 +1,109 @@
+#pragma once
+
+#include <signal.h>
+
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace sdb
+{
+class process;
+
+// A coroutine which runs as soon as it is called, until it first awaits.
+// Destroying the task destroys the coroutine, so keep it until done().
+class task
+{
+public:
+    struct promise_type
+    {
+        task get_return_object() { return task{std::coroutine_handle<promise_type>::from_promise(*this)}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { exception_ = std::current_exception(); }
+
+        std::exception_ptr exception_;
+    };
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+    task(task&& other) : handle_{std::exchange(other.handle_, nullptr)} {}
+    task& operator=(task&& other)
+    {
+        std::swap(handle_, other.handle_);
+        return *this;
+    }
+    ~task()
+    {
+        if (handle_)
+        {
+            handle_.destroy();
+        }
+    }
+
+    bool done() const { return !handle_ || handle_.done(); }
+
+    // Rethrows anything the coroutine threw
+    void get() const
+    {
+        if (handle_ && handle_.promise().exception_)
+        {
+            std::rethrow_exception(handle_.promise().exception_);
+        }
+    }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> handle) : handle_{handle} {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+// Waits on any number of processes and file descriptors from one thread.
+// Stops arrive as SIGCHLD, read through a signalfd, so SIGCHLD is blocked in
+// the constructing thread for the lifetime of the loop. Exits are also seen
+// through a pidfd for each process, which needs no signal at all.
+class event_loop
+{
+public:
+    event_loop();
+    event_loop(const event_loop&) = delete;
+    event_loop& operator=(const event_loop&) = delete;
+    ~event_loop();
+
+    // Coroutines awaiting proc.stopped() are resumed from run_once().
+    // Remove a process before destroying it.
+    void add_process(process& proc);
+    void remove_process(process& proc);
+
+    void add_fd(int fd, std::function<void()> on_readable);
+    void remove_fd(int fd);
+
+    // Waits for at most timeout, dispatching whatever arrives; negative waits indefinitely
+    void run_once(std::chrono::milliseconds timeout = std::chrono::milliseconds{-1});
+
+private:
+    struct watched_process
+    {
+        pid_t pid;
+        int pid_fd;
+    };
+
+    void close_fds(); // Also restores the signal mask
+    void watch_pid(process& proc, watched_process& watched);
+    void wake_stopped_processes();
+
+    int epoll_fd_ = -1;
+    int signal_fd_ = -1;
+    sigset_t previous_mask_;
+    std::map<process*, watched_process> processes_;
+    // That of the first process added, which every other then shares
+    std::shared_ptr<std::vector<std::pair<pid_t, int>>> unclaimed_wait_statuses_;
+    std::map<int, std::function<void()>> fds_;
+};
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <libsdb/registers.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sdb
+{
+class process;
+
+// A C-like expression over registers and memory, such as
+// rdi == 0x1234 && *(u64*)(rsp + 8) > 10, compiled once into stack machine
+// bytecode so evaluating it on every breakpoint hit is cheap.
+// Values are unsigned 64 bit, and loads of signed types are sign extended.
+class expression
+{
+public:
+    // Throws sdb::error describing the first problem found in source
+    static expression compile(std::string_view source);
+
+    std::uint64_t evaluate(const registers& regs, const process& proc) const;
+
+    const std::string& source() const { return source_; }
+
+private:
+    friend class expression_parser;
+
+    enum class opcode : std::uint8_t
+    {
+        Constant, // Pushes the operand
+        Register, // Pushes the register at index operand of g_register_infos
+        Load,     // Pops an address, pushing the operand bytes there, sign extended if bit 8 is set
+        Negate,
+        LogicalNot,
+        Complement,
+        Multiply,
+        Divide,
+        Remainder,
+        Add,
+        Subtract,
+        ShiftLeft,
+        ShiftRight,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+        Equal,
+        NotEqual,
+        BitAnd,
+        BitXor,
+        BitOr,
+        ToBool,
+        AndJump, // Jumps to the operand if the top is zero, otherwise pops it
+        OrJump   // Jumps to the operand, leaving 1, if the top is non-zero, otherwise pops it
+    };
+
+    struct instruction
+    {
+        opcode op;
+        std::uint64_t operand;
+    };
+
+    static constexpr std::size_t cMaximumDepth{32};
+
+    expression() = default;
+
+    std::vector<instruction> code_;
+    std::string source_;
+};
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <libsdb/types.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+namespace sdb
+{
+class process;
+template <typename Stoppoint>
+class stoppoint_collection;
+
+// What a fast tracepoint records on each hit, laid out as in the inferior's ring
+struct fast_trace_record
+{
+    std::uint64_t sequence; // Counts from 1, across every fast tracepoint of the process
+    std::uint64_t address;  // Of the fast tracepoint hit
+    std::uint64_t rax, rbx, rcx, rdx, rsi, rdi, rbp, rsp;
+    std::uint64_t r8, r9, r10, r11, r12, r13, r14, r15;
+    std::uint64_t rflags;
+    std::uint64_t reserved;
+};
+static_assert(sizeof(fast_trace_record) == 160);
+
+// Replaces the instructions at its address with a jump to a trampoline in the
+// inferior, which records the registers into a ring there, runs the replaced
+// instructions and jumps back, so the inferior never stops. The replaced
+// instructions can't be branches, and nothing may jump into their middle.
+class fast_tracepoint
+{
+public:
+    using id_type = std::int32_t;
+
+    fast_tracepoint() = delete;
+    fast_tracepoint(const fast_tracepoint&) = delete;
+    fast_tracepoint& operator=(const fast_tracepoint&) = delete;
+
+    id_type id() const { return id_; }
+
+    void enable();
+    void disable();
+
+    bool is_enabled() const { return is_enabled_; }
+    virtual_address address() const { return address_; }
+    virtual_address trampoline() const { return trampoline_; }
+
+    bool at_address(virtual_address address) const {
+        return address_ == address;
+    }
+
+    bool in_range(virtual_address low, virtual_address high) const {
+        return low <= address_ && high > address_;
+    }
+
+private:
+    friend process;
+    friend stoppoint_collection<fast_tracepoint>;
+
+    fast_tracepoint(process& proc, virtual_address address);
+    // The same fast tracepoint in a forked child, which has a copy of our trampolines
+    fast_tracepoint(process& proc, const fast_tracepoint& parent_point);
+
+    id_type id_;
+    process* process_;
+    virtual_address address_;
+    bool is_enabled_;
+    std::vector<std::byte> saved_code_; // The instructions the jump replaces
+    virtual_address trampoline_;
+};
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <libsdb/register_info.hpp>
+#include <libsdb/types.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace sdb
+{
+// Where control goes after an instruction
+enum class control_flow
+{
+    Sequential,      // On to the next instruction
+    Jump,
+    ConditionalJump,
+    Call,
+    Return,
+    Syscall,
+    Interrupt
+};
+
+struct memory_operand
+{
+    std::optional<register_id> base;  // rip for rip-relative operands
+    std::optional<register_id> index;
+    std::uint8_t scale;
+    std::int64_t displacement;
+    std::size_t size;                 // In bytes
+    bool is_read;
+    bool is_written;
+};
+
+struct decoded_instruction
+{
+    virtual_address address;
+    std::size_t length;
+    std::array<std::byte, 15> bytes; // The first length of them
+    control_flow flow;
+    // Where a direct jump or call goes, nothing if computed at run time
+    std::optional<virtual_address> target;
+    // Including implicit ones, such as the stack slot of push, but not those of lea
+    std::vector<memory_operand> memory_operands;
+
+    // AT&T syntax, formatted on first use
+    const std::string& text() const;
+
+private:
+    mutable std::optional<std::string> text_;
+};
+
+// Instructions by address, so stopping at the same code again needn't decode it again
+class instruction_cache
+{
+public:
+    // Nullptr if address isn't cached
+    const decoded_instruction* find(virtual_address address) const;
+    // Decodes the instruction at the start of code, which is at address.
+    // Nullptr if the bytes aren't a valid instruction. A volatile one is
+    // kept only until drop_volatile, as the inferior may change it.
+    const decoded_instruction* insert(virtual_address address, span<const std::byte> code, bool is_volatile = false);
+
+    struct code_read
+    {
+        span<const std::byte> code;
+        bool is_volatile; // Read from the inferior, rather than a file it can't change
+    };
+    // Given an address and how many bytes are wanted, returns the code there.
+    // It may return fewer, and what it returns need only last until it is next called.
+    using code_reader = std::function<code_read(virtual_address, std::size_t)>;
+    // Up to count instructions from address, stopping short at any bytes which
+    // aren't one. Only instructions not already cached are read.
+    std::vector<const decoded_instruction*> decode(virtual_address address, std::size_t count, const code_reader& read);
+
+    // Drops every instruction with a byte in [address, address + size)
+    void invalidate(virtual_address address, std::size_t size);
+    // Drops every volatile instruction, as the inferior is about to run
+    void drop_volatile() { volatile_instructions_.clear(); }
+    void clear()
+    {
+        instructions_.clear();
+        volatile_instructions_.clear();
+    }
+
+private:
+    std::map<std::uint64_t, decoded_instruction> instructions_;
+    std::map<std::uint64_t, decoded_instruction> volatile_instructions_;
+};
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <sys/user.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace sdb
+{
+// A trace of every instruction a thread executed, as process::record_instructions
+// writes it. All fields are little endian, and varints are unsigned LEB128.
+//
+// File header, 16 bytes:
+//   char magic[8] = "SDBITRAC", u32 version = 1, u32 flags, bit 0 set if
+//   registers are recorded
+// Then a record for each instruction, in the order they ran:
+//   varint: the pc less the previous one (0 before the first), zigzag encoded,
+//     shifted left one, with bit 0 set if registers follow
+//   If registers follow, a varint mask of the user_regs_struct fields which
+//   changed since the last record, bit n for the nth 8 byte field, never rip.
+//   Then for each, lowest first, a zigzag varint of the new value less the old.
+// Registers are as they were before the instruction ran.
+class instruction_trace_writer
+{
+public:
+    static constexpr std::uint32_t cVersion{1};
+    static constexpr std::size_t cHeaderSize{16};
+
+    instruction_trace_writer() = delete;
+    instruction_trace_writer(const instruction_trace_writer&) = delete;
+    instruction_trace_writer& operator=(const instruction_trace_writer&) = delete;
+    ~instruction_trace_writer();
+
+    // The file is truncated
+    instruction_trace_writer(const std::filesystem::path& path, bool record_registers);
+
+    bool records_registers() const { return record_registers_; }
+    std::uint64_t size() const { return size_; } // Instructions recorded
+
+    // Records the instruction at gprs.rip
+    void record(const user_regs_struct& gprs);
+    // Writes out what is buffered, which otherwise happens as the buffer fills
+    void flush();
+
+private:
+    void put_varint(std::uint64_t value);
+
+    int fd_ = -1;
+    bool record_registers_;
+    std::uint64_t size_ = 0;
+    user_regs_struct previous_{};
+    std::vector<std::uint8_t> buffer_;
+};
+
+struct instruction_trace_entry
+{
+    std::uint64_t pc;
+    user_regs_struct gprs; // All zero if registers are not recorded
+};
+
+class instruction_trace_reader
+{
+public:
+    instruction_trace_reader() = delete;
+    // Reads the whole file, throwing if it isn't an instruction trace
+    explicit instruction_trace_reader(const std::filesystem::path& path);
+
+    bool records_registers() const { return record_registers_; }
+
+    // The next instruction, or nullopt at the end of the trace
+    std::optional<instruction_trace_entry> next();
+
+private:
+    std::uint64_t get_varint();
+
+    std::vector<std::uint8_t> data_;
+    std::size_t position_ = 0;
+    bool record_registers_;
+    instruction_trace_entry current_{};
+};
+}
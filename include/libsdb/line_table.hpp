@@ -0,0 +1,97 @@
+#pragma once
+
+#include <libsdb/types.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace sdb
+{
+struct source_location
+{
+    std::string_view file; // As the compiler named it, joined to its directory
+    std::uint32_t line;
+};
+
+// The .debug_line section, DWARF 2 to 5. Each unit's line program is only
+// decoded the first time a lookup needs it, and is kept in an arena from then on.
+class line_table
+{
+public:
+    // The sections must outlive the table. The string sections are only
+    // needed for DWARF 5, and may be empty.
+    line_table(span<const std::byte> debug_line, span<const std::byte> debug_line_str, span<const std::byte> debug_str);
+
+    line_table(const line_table&) = delete;
+    line_table& operator=(const line_table&) = delete;
+
+    // Where the code at address, as linked, came from. Nothing if no unit covers it.
+    std::optional<source_location> get_location(virtual_address address) const;
+    // The lowest address, as linked, of the first line at or after line with
+    // code, in each file whose path ends with path. Only units with such a
+    // file have their programs decoded.
+    std::vector<virtual_address> get_addresses(std::string_view path, std::uint32_t line) const;
+
+    std::size_t unit_count() const { return units_.size(); }
+    std::size_t decoded_unit_count() const { return decoded_count_; }
+
+private:
+    struct row
+    {
+        std::uint64_t address;
+        std::uint32_t file;
+        std::uint32_t line : 30;
+        std::uint32_t is_stmt : 1;
+        std::uint32_t end_sequence : 1;
+    };
+
+    struct line_address
+    {
+        std::uint32_t file;
+        std::uint32_t line;
+        std::uint64_t address;
+    };
+
+    struct unit
+    {
+        explicit unit(std::pmr::memory_resource* arena) : files(arena), rows(arena), by_line(arena) {}
+
+        span<const std::byte> data;   // From its length to the end of its program
+        bool is_read = false;         // Its header, so files is filled in
+        bool is_decoded = false;
+
+        std::uint16_t version = 0;
+        std::size_t offset_size = 4;
+        std::uint8_t address_size = 8;
+        std::uint8_t minimum_instruction_length = 1;
+        bool default_is_stmt = true;
+        std::int8_t line_base = 0;
+        std::uint8_t line_range = 1;
+        std::uint8_t opcode_base = 1;
+        span<const std::byte> standard_opcode_lengths;
+        span<const std::byte> program;
+
+        std::pmr::vector<std::pmr::string> files;     // By the index the program uses
+        std::pmr::vector<row> rows;                   // By address, sequence ends first
+        std::pmr::vector<line_address> by_line;       // Statements by file, line and address
+        std::uint64_t low = 0;                        // Covers [low, high), with gaps
+        std::uint64_t high = 0;
+    };
+
+    void read_header(unit& u) const;
+    void decode(unit& u) const;
+    std::optional<source_location> find_in(const unit& u, std::uint64_t address) const;
+
+    span<const std::byte> debug_line_str_;
+    span<const std::byte> debug_str_;
+    mutable std::pmr::monotonic_buffer_resource arena_;
+    mutable std::vector<unit> units_;
+    mutable std::size_t decoded_count_ = 0;
+    mutable std::size_t next_to_decode_ = 0; // Units before it are all decoded
+};
+}
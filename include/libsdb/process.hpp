@@ -1,16 +1,30 @@
 #pragma once
 
+#include <libsdb/bit.hpp>
 #include <libsdb/registers.hpp>
+#include <libsdb/thread.hpp>
 #include <libsdb/types.hpp>
 #include <libsdb/breakpoint_site.hpp>
+#include <libsdb/elf.hpp>
+#include <libsdb/fast_tracepoint.hpp>
+#include <libsdb/instruction_cache.hpp>
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/watchpoint.hpp>
 #include <libsdb/stoppoint_collection.hpp>
+#include <libsdb/trace_buffer.hpp>
 
 #include <sys/types.h>
 #include <signal.h>
 
+#include <array>
+#include <coroutine>
 #include <filesystem>
+#include <functional>
+#include <limits>
+#include <map>
 #include <memory>
 #include <optional>
+#include <utility>
 #include <vector>
 
 #ifndef linux
@@ -28,58 +42,135 @@ inline const char* sigabbrev_np(sig signal) { return ""; }
 
 namespace sdb
 {
-enum class process_state
+enum class memory_write_method
 {
-    Stopped,
-    Running,
-    Exited,
-    Terminated
+    Automatic, // Try each of the below in order, continuing where the last stopped
+    VmWritev,  // process_vm_writev, respects page protections so only writable mappings
+    ProcMem,   // pwrite to /proc/<pid>/mem, ignores page protections so can patch text
+    Ptrace     // PTRACE_POKEDATA, one syscall for every eight bytes
 };
 
-struct stop_reason
+enum class follow_fork_mode
 {
-    stop_reason(int wait_status);
+    Parent, // Detach the child, removing our breakpoints from it
+    Child,  // Detach the parent, removing our breakpoints from it
+    Both    // Keep tracing both, reporting the fork as a stop
+};
 
-    process_state reason;
-    std::uint8_t info;
+// How resuming gets a thread past the int3 of a breakpoint site it is at.
+// Each falls back to the next for instructions it can't handle.
+enum class step_over_mode
+{
+    Emulate,  // Update the registers and memory as the instruction would, without running it
+    Displace, // Single step a copy of the instruction placed elsewhere
+    Remove    // Single step with the site removed, so other threads may run through it
 };
 
+class event_loop;
+
 class process
 {
 public:
+    class stop_awaiter
+    {
+    public:
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> waiter);
+        stop_reason await_resume() { return *reason_; }
+
+    private:
+        friend process;
+
+        explicit stop_awaiter(process& proc) : process_{&proc} {}
+
+        process* process_;
+        std::optional<stop_reason> reason_;
+    };
+
     process() = delete;
     process(const process&) = delete;
     process& operator=(const process&) = delete;
 
     ~process();
 
-    static std::unique_ptr<process> launch(std::filesystem::path path, bool attach = true, std::optional<int> stdout_replacement = std::nullopt);
-    static std::unique_ptr<process> attach(pid_t pid);
-
-    void write_user_area(std::size_t offset, std::uint64_t data);
-    void write_fprs(const user_fpregs_struct& fprs);
-    void write_gprs(const user_regs_struct& fprs);
+    // Seizing uses PTRACE_SEIZE rather than PTRACE_TRACEME or PTRACE_ATTACH,
+    // which sets our trace options atomically and never sends the tracee SIGSTOP
+    static std::unique_ptr<process> launch(std::filesystem::path path, bool attach = true, std::optional<int> stdout_replacement = std::nullopt, bool seize = false);
+    static std::unique_ptr<process> attach(pid_t pid, bool seize = false);
 
+    // All threads run together, and are all stopped when any one of them stops
     void resume();
+    void interrupt();
     stop_reason wait_on_signal();
+    // Returns nothing rather than blocking if no thread has stopped yet
+    std::optional<stop_reason> try_wait_on_signal();
+    // co_await proc.stopped() suspends until we stop, if we have been added to an event_loop
+    stop_awaiter stopped() { return stop_awaiter{*this}; }
+    // Only steps the current thread
     sdb::stop_reason step_instruction();
 
+    // Given the registers after each step, returns true to stop there. Registers
+    // are fetched lazily, so a predicate reading only integers costs one fetch.
+    using step_predicate = std::function<bool(const registers&)>;
+
+    // Single steps the current thread count times, or until the predicate holds,
+    // or it stops for any other reason. Other threads stay stopped. Stepping onto
+    // a breakpoint site counts as hitting it.
+    stop_reason step_instructions(std::uint64_t count, const step_predicate& until = {});
+
+    // Runs over a call at the current thread's pc until it returns, or single
+    // steps any other instruction. Recursive calls returning don't stop it early.
+    stop_reason step_over();
+    // Runs until the current thread returns from the function it is in
+    stop_reason step_out();
+
     pid_t pid() const { return pid_; }
     process_state state() const { return state_; }
-    registers& get_registers() { return *registers_; }
-    const registers& get_registers() const { return *registers_; }
+
+    // The current thread is the last one to stop, unless another is selected
+    thread& current_thread() { return *current_thread_; }
+    const thread& current_thread() const { return *current_thread_; }
+    void set_current_thread(pid_t tid);
+    const std::map<pid_t, std::unique_ptr<thread>>& threads() const { return threads_; }
+
+    // Following the child switches this object over to the child process
+    follow_fork_mode get_follow_fork_mode() const { return follow_fork_mode_; }
+    void set_follow_fork_mode(follow_fork_mode mode) { follow_fork_mode_ = mode; }
+    // Emulate unless comparing the slower ways
+    step_over_mode get_step_over_mode() const { return step_over_mode_; }
+    void set_step_over_mode(step_over_mode mode) { step_over_mode_ = mode; }
+    // Stopped children traced since the last call, when following both
+    std::vector<std::unique_ptr<process>> take_forked_processes() { return std::exchange(forked_processes_, {}); }
+
+    registers& get_registers() { return current_thread().get_registers(); }
+    const registers& get_registers() const { return current_thread().get_registers(); }
 
     void set_program_counter(virtual_address address)
     {
         get_registers().write_by_id(register_id::rip, address.addr());
     }
 
-    breakpoint_site& create_breakpoint_site(virtual_address address);
+    breakpoint_site& create_breakpoint_site(virtual_address address, bool hardware = false);
+    // Size is 1, 2, 4 or 8 bytes, and the address must be aligned to it
+    watchpoint& create_watchpoint(virtual_address address, stoppoint_mode mode, std::size_t size);
 
 
     std::vector<std::byte> read_memory(virtual_address address, std::size_t amount) const;
+    // Fills buffer rather than allocating
+    void read_memory(virtual_address address, span<std::byte> buffer) const;
     std::vector<std::byte> read_memory_without_traps(virtual_address address, std::size_t amount) const;
-    void write_memory(virtual_address address, span<const std::byte> data);
+    // Fills buffer rather than allocating
+    void read_memory_without_traps(virtual_address address, span<std::byte> buffer) const;
+    void write_memory(virtual_address address, span<const std::byte> data, memory_write_method method = memory_write_method::Automatic);
+
+    // Up to count instructions from address, decoded as memory is without our
+    // traps, stopping short at any bytes which aren't one. Each is cached, and
+    // the pointer valid, until we next write to memory under it. Code we have
+    // never written is read from the executable's file rather than the inferior.
+    // Anything else, such as library or JIT code, is only cached until we resume.
+    std::vector<const decoded_instruction*> decode_instructions(virtual_address address, std::size_t count);
+    // Throws if there is no valid instruction at address
+    const decoded_instruction& decode_instruction(virtual_address address);
 
     template <typename T>
     T read_memory_as(virtual_address address) const
@@ -97,21 +188,196 @@ public:
         return breakpoint_sites_;
     }
 
+    // The same as step_instructions, also writing each instruction it runs to the trace
+    stop_reason record_instructions(instruction_trace_writer& writer,
+                                    std::uint64_t max_steps = std::numeric_limits<std::uint64_t>::max(),
+                                    const step_predicate& until = {});
+
+    // Fast tracepoints record into a ring of this many slots in the inferior,
+    // after a header holding the number of slots ever reserved
+    static constexpr std::uint32_t cFastTraceSlots{4096};
+    static constexpr std::size_t cFastTraceHeaderSize{64};
+
+    fast_tracepoint& create_fast_tracepoint(virtual_address address);
+    stoppoint_collection<fast_tracepoint>& fast_tracepoints() { return fast_tracepoints_; }
+    const stoppoint_collection<fast_tracepoint>& fast_tracepoints() const { return fast_tracepoints_; }
+    // Appends what fast tracepoints have recorded since the last call, reading the
+    // ring while the inferior runs. Returns how many records were overwritten unread.
+    std::size_t drain_fast_trace(std::vector<fast_trace_record>& records);
+
+    // Where tracepoints record, shared with any children we trace after a fork
+    const std::shared_ptr<trace_buffer>& get_trace_buffer() const { return trace_buffer_; }
+    void set_trace_buffer(std::shared_ptr<trace_buffer> buffer) { trace_buffer_ = std::move(buffer); }
+
+    stoppoint_collection<watchpoint>& watchpoints()
+    {
+        return watchpoints_;
+    }
+    const stoppoint_collection<watchpoint>& watchpoints() const
+    {
+        return watchpoints_;
+    }
+
+    // The executable, mapped from its file, or nullptr if it couldn't be
+    const elf* get_elf() const { return elf_.get(); }
+
     virtual_address get_program_counter() const
     {
         return virtual_address{get_registers().read_by_id_as<std::uint64_t>(register_id::rip)}; 
     }
 
 private:
-    process(pid_t pid, bool terminate_on_end, bool is_attached) : pid_(pid), terminate_on_end_(terminate_on_end), is_attached_{is_attached}, registers_{new registers(*this)} { }
+    friend thread;
+    friend event_loop;
+    friend breakpoint_site;
+    friend watchpoint;
+    friend fast_tracepoint;
+
+    process(pid_t pid, bool terminate_on_end, bool is_attached, bool is_seized) : pid_(pid), terminate_on_end_(terminate_on_end), is_attached_{is_attached}, is_seized_{is_seized}
+    {
+        current_thread_ = &add_thread(pid);
+    }
+
+    thread& add_thread(pid_t tid);
+    void remove_thread(pid_t tid);
+    void attach_untraced_threads();
+    void stop_all_threads();
+    void handle_clone(thread& parent, bool resume_threads);
+    bool is_requested_stop(const stop_reason& reason) const;
+    // Returns false if the site's record could not fit in the trace buffer
+    bool record_trace(const thread& stopped, const breakpoint_site& site);
+    // Records in the reason any software breakpoint site which was hit
+    void rewind_breakpoint_trap(thread& stopped, stop_reason& reason);
+    // Reads and clears DR6, recording any watchpoint or hardware breakpoint site which fired
+    void decode_hardware_trap(thread& stopped, stop_reason& reason);
+    // After one step of a run of them, whether the run should end there
+    bool ends_step_run(stop_reason& reason);
+    // Single steps the thread over the int3 of site by running a copy of the
+    // instruction elsewhere, so other threads can't run through the site
+    // meanwhile. Instructions we can't copy step with the site removed instead.
+    void step_over_breakpoint(thread& stepping, breakpoint_site& site);
+    // Steps over the site without running the thread, for the few instructions
+    // common at function entry we can emulate. Returns false for any other.
+    bool emulate_step_over(thread& stepping, breakpoint_site& site);
+    // Once the step has stopped, puts the thread where the original instruction would have
+    void finish_step_over(thread& stepped);
+    void displace_instruction(breakpoint_site& site);
+    // Resumes until the current thread reaches address with its stack pointer
+    // at least stack_pointer, or anything else stops us first
+    stop_reason run_to_return(virtual_address address, std::uint64_t stack_pointer);
+    bool reached_return_target(const thread& stopped) const;
+    // Resumes a coroutine awaiting stopped() if we have stopped, returning whether we did
+    bool wake_stop_waiter();
+
+    void handle_fork(thread& parent, int event, bool resume_threads);
+    void handle_pending_forks();
+    void handle_vfork_done();
+    void handle_exec();
+    void release_vfork_parent();
+    void swap_identity(process& other);
+
+    // Writes either int3 or the original byte for every enabled breakpoint
+    // site, without changing whether the sites are enabled
+    void write_breakpoint_bytes(bool install);
+    // The same for just these sites, in order of address. Installing also saves
+    // the original byte of any site not yet enabled.
+    void write_breakpoint_bytes(const std::vector<breakpoint_site*>& sites, bool install);
 
-    void read_all_registers();
+    // Hardware stoppoints must be programmed into every thread's debug registers.
+    // Each returns the index of the register allocated, from 0 to 3.
+    int allocate_debug_register(virtual_address address, stoppoint_mode mode, std::size_t size);
+    void set_debug_register_enabled(int index, bool enabled);
+    void free_debug_register(int index);
+    void write_debug_registers(thread& target);
+
+    std::optional<stop_reason> wait_for_stop(bool block);
+    std::optional<std::pair<pid_t, int>> wait_for_any_thread(bool block);
+    int wait_for_thread(pid_t tid);
+    std::optional<int> take_unclaimed_wait_status(pid_t tid);
+
+    // Makes the current thread run a system call, leaving it as it was, and returns the result
+    std::uint64_t inferior_syscall(long number, std::array<std::uint64_t, 6> args);
+    // Executable memory in the inferior, within reach of a rel32 jump from near
+    virtual_address allocate_trampoline(virtual_address near, std::size_t size);
+    // Mapped into the inferior on first use
+    virtual_address fast_trace_ring();
+
+    // Writes what read_memory_without_traps hides, such as int3s, so the code
+    // there is still as in the executable's file. write_memory also notes the
+    // code has changed, so it is read from the inferior from then on.
+    void write_hidden_memory(virtual_address address, span<const std::byte> data, memory_write_method method = memory_write_method::Automatic);
+    // Maps the file of the executable we are now running, once it is loaded
+    void load_elf();
+    void add_patched_code(virtual_address address, std::size_t size);
+    bool is_patched_code(virtual_address address, std::size_t size) const;
+
+    // Each returns the number of bytes written before the first failure, leaving
+    // errno as that failure set it, or 0 if the write just stopped short
+    std::size_t write_memory_with_vm_writev(virtual_address address, span<const std::byte> data);
+    std::size_t write_memory_with_proc_mem(virtual_address address, span<const std::byte> data);
+    std::size_t write_memory_with_ptrace(virtual_address address, span<const std::byte> data);
+    int memory_fd();
 
     pid_t pid_ = 0;
+    int memory_fd_ = -1; // /proc/<pid>/mem, opened on first use
     bool terminate_on_end_ = true;
     bool is_attached_ = true;
+    bool is_seized_ = false;
     process_state state_ = process_state::Stopped;
-    std::unique_ptr<registers> registers_;
+    std::map<pid_t, std::unique_ptr<thread>> threads_;
+    thread* current_thread_ = nullptr;
+    // Only used within stop_all_threads
+    std::vector<thread*> stopping_threads_;
+    std::vector<pid_t> ended_threads_;
+    // What every thread's debug registers should hold: DR0-DR3, and DR7
+    std::array<std::uint64_t, 4> debug_addresses_{};
+    std::uint64_t debug_control_ = 0;
+    std::uint8_t used_debug_registers_ = 0; // Bit n set if drn is allocated
+    // Declared after the debug registers, as stoppoints free theirs when destroyed
     stoppoint_collection<breakpoint_site> breakpoint_sites_;
+    stoppoint_collection<watchpoint> watchpoints_;
+    std::shared_ptr<trace_buffer> trace_buffer_;
+    instruction_cache instruction_cache_;
+    std::shared_ptr<const elf> elf_; // Shared with children we trace after a fork
+    // Waiting on any child can collect the threads of processes forked from us,
+    // or new threads whose clone event we haven't seen yet, so they are kept
+    // for whoever waits on them. Shared with children we trace after a fork,
+    // and with every other process in the same event loop.
+    std::shared_ptr<std::vector<std::pair<pid_t, int>>> unclaimed_wait_statuses_
+        = std::make_shared<std::vector<std::pair<pid_t, int>>>();
+    // Code written through write_memory, which the file no longer holds, as
+    // disjoint ranges from their start to their end
+    std::map<std::uint64_t, std::uint64_t> patched_code_;
+
+    struct code_arena
+    {
+        virtual_address base;
+        std::size_t size;
+        std::size_t used;
+    };
+    // Where run_to_return is waiting for a thread to get to
+    struct return_target
+    {
+        pid_t tid;
+        virtual_address address;
+        std::uint64_t stack_pointer;
+    };
+    std::optional<return_target> return_target_;
+
+    std::vector<code_arena> code_arenas_;
+    virtual_address fast_trace_ring_; // Zero until mapped
+    std::uint64_t fast_trace_read_ = 0; // Slots reserved before this have been drained
+    stoppoint_collection<fast_tracepoint> fast_tracepoints_;
+
+    follow_fork_mode follow_fork_mode_ = follow_fork_mode::Parent;
+    step_over_mode step_over_mode_ = step_over_mode::Emulate;
+    std::vector<std::unique_ptr<process>> forked_processes_;
+    // Set when we removed our breakpoints while a vfork child shares our memory
+    bool awaiting_vfork_done_ = false;
+    // Following a vfork child, its parent shares its memory until it execs or exits
+    std::unique_ptr<process> vfork_parent_;
+
+    std::coroutine_handle<> stop_waiter_;
+    stop_awaiter* stop_awaiter_ = nullptr;
 };
 }
@@ -9,7 +9,7 @@
 
 namespace sdb
 {
-class process;
+class thread;
 class registers
 {
 public:
@@ -37,11 +37,31 @@ public:
         write(register_info_by_id(id), val); 
     }
 
+    // Every general purpose register at once, as one fetch gets them all
+    const user_regs_struct& read_gprs() const;
+    // Whether info is cached since the last stop, so reading it costs no ptrace call
+    bool is_fetched(const register_info& info) const;
+
+    // Writes are cached until the process resumes, or until this is called
+    void flush();
+
 private:
-    friend process;
-    registers(process& proc) : proc_(&proc) {}
+    friend thread;
+    registers(thread& owner) : thread_(&owner) {}
+
+    // Each class of register is only fetched from the inferior the first
+    // time it is accessed after a stop, as most stops only need rip
+    void invalidate();
+    void fetch(const register_info& info) const;
+
+    mutable user data_;
+    mutable bool gprs_fetched_ = false;
+    mutable bool fprs_fetched_ = false;
+    mutable std::uint8_t fetched_debug_registers_ = 0; // Bit n set if drn is cached
 
-    user data_;
-    process* proc_;
+    bool gprs_dirty_ = false;
+    bool fprs_dirty_ = false;
+    std::uint8_t dirty_debug_registers_ = 0; // Bit n set if drn is dirty
+    thread* thread_;
 };
 }
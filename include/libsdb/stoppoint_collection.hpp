@@ -4,16 +4,32 @@
 #include <libsdb/types.hpp>
 
 #include <algorithm>
+#include <cstddef>
 #include <memory>
+#include <new>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 namespace sdb
 {
+// Stoppoints are stored in pooled chunks, and indexed both by id and by a
+// vector of pointers sorted by address, so lookups and region queries are
+// logarithmic even with tens of thousands of stoppoints.
 template <typename Stoppoint>
 class stoppoint_collection
 {
 public:
-    Stoppoint& push(std::unique_ptr<Stoppoint> stoppoint);
+    stoppoint_collection() = default;
+    stoppoint_collection(const stoppoint_collection&) = delete;
+    stoppoint_collection& operator=(const stoppoint_collection&) = delete;
+    stoppoint_collection(stoppoint_collection&& other);
+    stoppoint_collection& operator=(stoppoint_collection&& other);
+    ~stoppoint_collection() { clear(); }
+
+    // Stoppoint must befriend the collection if its constructors are private
+    template <typename... Args>
+    Stoppoint& emplace(Args&&... args);
 
     bool contains_id(typename Stoppoint::id_type id) const;
     bool contains_address(virtual_address address) const;
@@ -25,103 +41,178 @@ public:
     const Stoppoint& get_by_address(virtual_address address) const;
 
     std::vector<Stoppoint*> get_in_region(virtual_address low, virtual_address high) const;
+    // The same without building a vector, for paths which mustn't allocate
+    template <typename F>
+    void for_each_in_region(virtual_address low, virtual_address high, F f) const;
 
     void remove_by_id(typename Stoppoint::id_type id);
     void remove_by_address(virtual_address address);
 
+    // Every stoppoint in [low, high), as one batch if Stoppoint supports it
+    void enable_all(virtual_address low, virtual_address high);
+    void disable_all(virtual_address low, virtual_address high);
+
+    // In order of address
     template <typename F>
     void for_each(F f);
     template <typename F>
     void for_each(F f) const;
 
-    std::size_t size() const { return stoppoints_.size(); }
-    bool empty() const { return stoppoints_.empty(); }
+    std::size_t size() const { return by_address_.size(); }
+    bool empty() const { return by_address_.empty(); }
 private:
-    using points_t = std::vector<std::unique_ptr<Stoppoint>>;
+    class pool
+    {
+    public:
+        void* allocate();
+        void deallocate(void* stoppoint) { free_.push_back(static_cast<slot*>(stoppoint)); }
+
+    private:
+        static constexpr std::size_t cChunkSize{256};
+
+        struct alignas(Stoppoint) slot
+        {
+            std::byte storage[sizeof(Stoppoint)];
+        };
+
+        std::vector<std::unique_ptr<slot[]>> chunks_;
+        std::vector<slot*> free_;
+    };
+
+    using points_t = std::vector<Stoppoint*>;
 
-    typename points_t::iterator find_by_id(typename Stoppoint::id_type id);
-    typename points_t::const_iterator find_by_id(typename Stoppoint::id_type id) const; 
-    typename points_t::iterator find_by_address(virtual_address address);
     typename points_t::const_iterator find_by_address(virtual_address address) const;
+    void remove(Stoppoint& stoppoint);
+    void clear();
 
-    points_t stoppoints_;
+    pool pool_;
+    points_t by_address_;
+    std::unordered_map<typename Stoppoint::id_type, Stoppoint*> by_id_;
 };
 
 template <typename Stoppoint>
-Stoppoint& stoppoint_collection<Stoppoint>::push(std::unique_ptr<Stoppoint> stoppoint)
+void* stoppoint_collection<Stoppoint>::pool::allocate()
 {
-    stoppoints_.push_back(std::move(stoppoint));
-    return *stoppoints_.back();
+    if (free_.empty())
+    {
+        chunks_.push_back(std::unique_ptr<slot[]>(new slot[cChunkSize]));
+        // Reserved here so that deallocating never throws
+        free_.reserve(chunks_.size() * cChunkSize);
+        for (auto i = cChunkSize; i > 0; --i)
+        {
+            free_.push_back(&chunks_.back()[i - 1]);
+        }
+    }
+
+    auto stoppoint = free_.back();
+    free_.pop_back();
+    return stoppoint;
 }
 
 template <typename Stoppoint>
-auto stoppoint_collection<Stoppoint>::find_by_id(typename Stoppoint::id_type id) -> typename points_t::iterator
+stoppoint_collection<Stoppoint>::stoppoint_collection(stoppoint_collection&& other)
+    : pool_{std::exchange(other.pool_, {})}, by_address_{std::exchange(other.by_address_, {})}, by_id_{std::exchange(other.by_id_, {})}
 {
-    return std::find_if(begin(stoppoints_), end(stoppoints_), [=](auto& point) { return point->id() == id; });
 }
 
 template <typename Stoppoint>
-auto stoppoint_collection<Stoppoint>::find_by_id(typename Stoppoint::id_type id) const -> typename points_t::const_iterator
+stoppoint_collection<Stoppoint>& stoppoint_collection<Stoppoint>::operator=(stoppoint_collection&& other)
 {
-    return const_cast<stoppoint_collection*>(this)->find_by_id(id);
+    if (this != &other)
+    {
+        clear();
+        pool_ = std::exchange(other.pool_, {});
+        by_address_ = std::exchange(other.by_address_, {});
+        by_id_ = std::exchange(other.by_id_, {});
+    }
+
+    return *this;
 }
 
 template <typename Stoppoint>
-auto stoppoint_collection<Stoppoint>::find_by_address(virtual_address address)
-        -> typename points_t::iterator
+template <typename... Args>
+Stoppoint& stoppoint_collection<Stoppoint>::emplace(Args&&... args)
 {
-    return std::find_if(begin(stoppoints_), end(stoppoints_), [=](auto& point) { return point->at_address(address); });
+    // Reserve first so nothing after construction can throw
+    by_address_.reserve(by_address_.size() + 1);
+    by_id_.reserve(by_id_.size() + 1);
+
+    auto memory = pool_.allocate();
+    Stoppoint* stoppoint;
+    try
+    {
+        stoppoint = new (memory) Stoppoint(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        pool_.deallocate(memory);
+        throw;
+    }
+
+    auto position = std::upper_bound(begin(by_address_), end(by_address_), stoppoint->address(),
+        [](virtual_address address, auto point) { return address < point->address(); });
+    by_address_.insert(position, stoppoint);
+    by_id_.emplace(stoppoint->id(), stoppoint);
+    return *stoppoint;
 }
 
 template <typename Stoppoint>
 auto stoppoint_collection<Stoppoint>::find_by_address(virtual_address address) const
         -> typename points_t::const_iterator
 {
-    return const_cast<stoppoint_collection*>(this)->find_by_address(address);
+    auto it = std::lower_bound(begin(by_address_), end(by_address_), address,
+        [](auto point, virtual_address address) { return point->address() < address; });
+    if (it != end(by_address_) && (*it)->at_address(address))
+    {
+        return it;
+    }
+
+    return end(by_address_);
 }
 
 template <typename Stoppoint>
 bool stoppoint_collection<Stoppoint>::contains_id(typename Stoppoint::id_type id) const
 {
-    return find_by_id(id) != end(stoppoints_);
+    return by_id_.contains(id);
 }
 
 template <typename Stoppoint>
 bool stoppoint_collection<Stoppoint>::contains_address(virtual_address address) const
 {
-    return find_by_address(address) != end(stoppoints_);
+    return find_by_address(address) != end(by_address_);
 }
 
 template <typename Stoppoint>
 bool stoppoint_collection<Stoppoint>::enabled_stoppoint_at_address(
 virtual_address address) const
 {
-    return contains_address(address) && get_by_address(address).is_enabled();
+    auto it = find_by_address(address);
+    return it != end(by_address_) && (*it)->is_enabled();
 }
 
 template <typename Stoppoint>
 Stoppoint& stoppoint_collection<Stoppoint>::get_by_id(typename Stoppoint::id_type id)
 {
-    auto it = find_by_id(id);
-    if (it == end(stoppoints_))
+    auto it = by_id_.find(id);
+    if (it == end(by_id_))
     {
         error::send("Invalid stoppoint id");
     }
 
-    return **it; // Iterator to unique pointer to Stoppoint
+    return *it->second;
 }
 
 template <typename Stoppoint>
 const Stoppoint& stoppoint_collection<Stoppoint>::get_by_id(typename Stoppoint::id_type id) const
 {
-    return const_cast<stoppoint_collection*>(this)->get_by_id(id);  
+    return const_cast<stoppoint_collection*>(this)->get_by_id(id);
 }
 
 template <typename Stoppoint>
 Stoppoint& stoppoint_collection<Stoppoint>::get_by_address(virtual_address address)
 {
     auto it = find_by_address(address);
-    if (it == end(stoppoints_))
+    if (it == end(by_address_))
     {
         error::send(std::format("Stoppoint not found at address {}", address.addr()));
     }
@@ -132,44 +223,114 @@ Stoppoint& stoppoint_collection<Stoppoint>::get_by_address(virtual_address addre
 template <typename Stoppoint>
 const Stoppoint& stoppoint_collection<Stoppoint>::get_by_address(virtual_address address) const
 {
-    return const_cast<stoppoint_collection*>(this)->get_by_address(address);  
+    return const_cast<stoppoint_collection*>(this)->get_by_address(address);
 }
 
 template <typename Stoppoint>
 std::vector<Stoppoint*> stoppoint_collection<Stoppoint>::get_in_region(virtual_address low, virtual_address high) const
 {
+    auto first = std::lower_bound(begin(by_address_), end(by_address_), low,
+        [](auto point, virtual_address address) { return point->address() < address; });
+
     std::vector<Stoppoint*> result{};
-    for (auto& site : stoppoints_)
+    for (auto it = first; it != end(by_address_) && (*it)->in_range(low, high); ++it)
     {
-        if (site->in_range(low, high))
-        {
-            result.push_back(&*site);
-        }
+        result.push_back(*it);
     }
 
     return result;
 }
 
+template <typename Stoppoint>
+template <typename F>
+void stoppoint_collection<Stoppoint>::for_each_in_region(virtual_address low, virtual_address high, F f) const
+{
+    auto first = std::lower_bound(begin(by_address_), end(by_address_), low,
+        [](auto point, virtual_address address) { return point->address() < address; });
+    for (auto it = first; it != end(by_address_) && (*it)->in_range(low, high); ++it)
+    {
+        f(**it);
+    }
+}
+
+template <typename Stoppoint>
+void stoppoint_collection<Stoppoint>::remove(Stoppoint& stoppoint)
+{
+    stoppoint.disable();
+
+    auto [first, last] = std::equal_range(begin(by_address_), end(by_address_), &stoppoint,
+        [](auto lhs, auto rhs) { return lhs->address() < rhs->address(); });
+    by_address_.erase(std::find(first, last, &stoppoint));
+    by_id_.erase(stoppoint.id());
+
+    stoppoint.~Stoppoint();
+    pool_.deallocate(&stoppoint);
+}
+
 template <typename Stoppoint>
 void stoppoint_collection<Stoppoint>::remove_by_id(typename Stoppoint::id_type id)
 {
-    auto it = find_by_id(id);
-    (**it).disable();
-    stoppoints_.erase(it);
+    remove(get_by_id(id));
 }
+
 template <typename Stoppoint>
 void stoppoint_collection<Stoppoint>::remove_by_address(virtual_address address)
 {
-    auto it = find_by_address(address);
-    (**it).disable();
-    stoppoints_.erase(it);
+    remove(get_by_address(address));
+}
+
+template <typename Stoppoint>
+void stoppoint_collection<Stoppoint>::enable_all(virtual_address low, virtual_address high)
+{
+    auto points = get_in_region(low, high);
+    if constexpr (requires { Stoppoint::enable_all(points); })
+    {
+        Stoppoint::enable_all(points);
+    }
+    else
+    {
+        for (auto point : points)
+        {
+            point->enable();
+        }
+    }
+}
+
+template <typename Stoppoint>
+void stoppoint_collection<Stoppoint>::disable_all(virtual_address low, virtual_address high)
+{
+    auto points = get_in_region(low, high);
+    if constexpr (requires { Stoppoint::disable_all(points); })
+    {
+        Stoppoint::disable_all(points);
+    }
+    else
+    {
+        for (auto point : points)
+        {
+            point->disable();
+        }
+    }
+}
+
+template <typename Stoppoint>
+void stoppoint_collection<Stoppoint>::clear()
+{
+    // Unlike removal this doesn't disable anything, as when the process has gone
+    for (auto point : by_address_)
+    {
+        point->~Stoppoint();
+        pool_.deallocate(point);
+    }
+    by_address_.clear();
+    by_id_.clear();
 }
 
 template <typename Stoppoint>
 template <typename F>
 void stoppoint_collection<Stoppoint>::for_each(F func)
 {
-    for (auto& point: stoppoints_)
+    for (auto point : by_address_)
     {
         func(*point);
     }
@@ -179,9 +340,9 @@ template <typename Stoppoint>
 template <typename F>
 void stoppoint_collection<Stoppoint>::for_each(F func) const
 {
-    for (const auto& point: stoppoints_)
+    for (auto point : by_address_)
     {
-        func(*point);
+        func(static_cast<const Stoppoint&>(*point));
     }
 }
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <libsdb/registers.hpp>
+
+#include <sys/types.h>
+#include <sys/user.h>
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+namespace sdb
+{
+enum class process_state
+{
+    Stopped,
+    Running,
+    Exited,
+    Terminated
+};
+
+struct stop_reason
+{
+    stop_reason(int wait_status);
+
+    process_state reason;
+    std::uint8_t info;
+    std::optional<int> event; // PTRACE_EVENT_* if this is a ptrace event stop
+    std::optional<std::int32_t> watchpoint_id; // Set if a watchpoint fired
+    std::optional<std::int32_t> breakpoint_id; // Set if a breakpoint site was hit
+};
+
+class process;
+class breakpoint_site;
+
+class thread
+{
+public:
+    thread() = delete;
+    thread(const thread&) = delete;
+    thread& operator=(const thread&) = delete;
+
+    pid_t tid() const { return tid_; }
+    process_state state() const { return state_; }
+    const std::optional<stop_reason>& last_stop_reason() const { return reason_; }
+
+    registers& get_registers() { return *registers_; }
+    const registers& get_registers() const { return *registers_; }
+
+    std::uint64_t read_user_area(std::size_t offset) const;
+    void read_fprs(user_fpregs_struct& fprs) const;
+    void read_gprs(user_regs_struct& gprs) const;
+
+    void write_user_area(std::size_t offset, std::uint64_t data);
+    void write_fprs(const user_fpregs_struct& fprs);
+    void write_gprs(const user_regs_struct& gprs);
+
+private:
+    friend process;
+
+    thread(process& proc, pid_t tid) : process_{&proc}, tid_{tid}, registers_{new registers(*this)} {}
+
+    // A non-zero signal is delivered to the thread as it resumes
+    void resume(bool single_step = false, int signal = 0);
+    // PTRACE_INTERRUPT if seized, otherwise SIGSTOP just this thread
+    bool request_stop();
+
+    process* process_;
+    pid_t tid_;
+    process_state state_ = process_state::Running;
+    std::optional<stop_reason> reason_;
+    bool is_stepping_ = false;
+    // Set while single stepping over this int3 site
+    breakpoint_site* stepping_over_ = nullptr;
+
+    // We asked this thread to stop, but it may have stopped for another
+    // reason first, in which case our stop arrives after it next resumes
+    bool stop_requested_ = false;
+
+    // A fork we saw while stopping every thread, handled when we next resume
+    std::optional<int> pending_fork_event_;
+
+    std::unique_ptr<registers> registers_;
+};
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <libsdb/expression.hpp>
+#include <libsdb/register_info.hpp>
+#include <libsdb/types.hpp>
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+namespace sdb
+{
+// A range of memory a tracepoint records, at an address evaluated on each hit
+struct trace_memory
+{
+    expression address;
+    std::uint32_t size;
+};
+
+// What a tracepoint records each time it is hit, before carrying on
+struct trace_spec
+{
+    std::vector<register_id> registers; // Integers of up to 8 bytes with a DWARF number
+    std::vector<trace_memory> memory;   // All read by one process_vm_readv
+
+    static constexpr std::size_t cMaximumMemoryRanges{16};
+
+    // Throws if a register can't be recorded or there are too many ranges
+    void validate() const;
+    std::size_t record_size() const;
+};
+
+// Tracepoint records, overwriting the oldest once full. The layout in memory
+// is also the file format, so an mmap'd buffer is always a valid trace file,
+// and dump() writes an in-memory one out as is. All fields are little endian.
+//
+// File header, 64 bytes:
+//   char magic[8] = "SDBTRACE", u32 version = 1, u32 header size = 64,
+//   u64 capacity of the record area, u64 offset of the oldest record,
+//   u64 offset of the next record, u64 records held, u64 next sequence number,
+//   u64 records overwritten
+// Then the record area. Records are 8 byte aligned, and never wrap. A record
+// size of 0, or fewer than 24 bytes before the end, means the next record is at 0.
+//
+// Record header, 24 bytes:
+//   u32 size of the whole record, i32 breakpoint site id, u64 sequence number,
+//   i32 thread id, u16 register count, u16 memory range count
+// Each register, 16 bytes: u32 DWARF register number, u32 zero, u64 value
+// Each memory range: u64 address, u32 size, u32 bytes read, then the bytes
+//   padded to 8. A range which couldn't be read stops those after it too.
+class trace_buffer
+{
+public:
+    static constexpr std::uint32_t cVersion{1};
+    static constexpr std::size_t cHeaderSize{64};
+    static constexpr std::size_t cRecordHeaderSize{24};
+
+    trace_buffer() = delete;
+    trace_buffer(const trace_buffer&) = delete;
+    trace_buffer& operator=(const trace_buffer&) = delete;
+    ~trace_buffer();
+
+    // Capacity is rounded up to a multiple of 8 bytes
+    explicit trace_buffer(std::size_t capacity);
+    // Records go straight into the file, which is truncated to fit
+    trace_buffer(const std::filesystem::path& path, std::size_t capacity);
+
+    std::size_t capacity() const;
+    std::size_t size() const;        // Records held
+    std::size_t overwritten() const; // Records lost to newer ones
+
+    // Calls f with each record, as a span of its bytes, oldest first
+    template <typename F>
+    void for_each(F f) const;
+
+    void dump(const std::filesystem::path& path) const;
+
+private:
+    friend class process;
+
+    struct header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t header_size;
+        std::uint64_t capacity;
+        std::uint64_t oldest;
+        std::uint64_t next;
+        std::uint64_t count;
+        std::uint64_t sequence;
+        std::uint64_t overwritten;
+    };
+    static_assert(sizeof(header) == cHeaderSize);
+
+    // Space for a record of size bytes, with its size and sequence number
+    // filled in, or nullptr if it could never fit. Never allocates.
+    std::byte* allocate(std::uint32_t size);
+
+    void initialise(std::size_t capacity);
+    // The offset of the record at or wrapped around from offset
+    std::uint64_t wrap(std::uint64_t offset) const;
+    void evict_oldest();
+
+    header& get_header() const { return *reinterpret_cast<header*>(data_); }
+    std::byte* records() const { return data_ + cHeaderSize; }
+
+    std::byte* data_ = nullptr;
+    std::size_t mapped_size_ = 0; // Non-zero if data_ is mapped from a file
+    std::vector<std::byte> memory_;
+};
+
+template <typename F>
+void trace_buffer::for_each(F f) const
+{
+    auto& head = get_header();
+    auto offset = head.oldest;
+    for (std::uint64_t i = 0; i < head.count; ++i)
+    {
+        offset = wrap(offset);
+        std::uint32_t size;
+        std::memcpy(&size, records() + offset, sizeof(size));
+        f(span<const std::byte>{records() + offset, size});
+        offset += size;
+    }
+}
+}
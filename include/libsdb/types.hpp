@@ -9,6 +9,14 @@ namespace sdb
 using byte64 = std::array<std::byte, 8>;
 using byte128 = std::array<std::byte, 16>;
 
+// What a hardware stoppoint traps on
+enum class stoppoint_mode
+{
+    Write,
+    ReadWrite,
+    Execute
+};
+
 class virtual_address
 {
 public:
@@ -79,7 +87,7 @@ public:
     T* begin() const { return data_; }
     T* end() const { return data_ + size_; }
     std::size_t size() const { return size_; }
-    T& operator[](std::size_t n) { return *(data_ + n); }
+    T& operator[](std::size_t n) const { return *(data_ + n); }
     
 private:
     T* data_{nullptr};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <libsdb/types.hpp>
+
+namespace sdb
+{
+class process;
+template <typename Stoppoint>
+class stoppoint_collection;
+
+// Traps after any access matching its mode, using one of the debug registers
+class watchpoint
+{
+public:
+    using id_type = std::int32_t;
+
+    watchpoint() = delete;
+    watchpoint(const watchpoint&) = delete;
+    watchpoint& operator=(const watchpoint&) = delete;
+    ~watchpoint();
+
+    id_type id() const { return id_; }
+
+    void enable();
+    void disable();
+
+    bool is_enabled() const { return is_enabled_; }
+    virtual_address address() const { return address_; }
+    stoppoint_mode mode() const { return mode_; }
+    std::size_t size() const { return size_; }
+
+    // The watched value when it was last read, and the value before that
+    std::uint64_t data() const { return data_; }
+    std::uint64_t previous_data() const { return previous_data_; }
+    void update_data();
+
+    bool at_address(virtual_address address) const {
+        return address_ == address;
+    }
+
+    bool in_range(virtual_address low, virtual_address high) const {
+        return low <= address_ && high > address_;
+    }
+
+private:
+    friend process;
+    friend stoppoint_collection<watchpoint>;
+
+    watchpoint(process& proc, virtual_address address, stoppoint_mode mode, std::size_t size);
+    // The same watchpoint in a forked child
+    watchpoint(process& proc, const watchpoint& parent_watchpoint);
+
+    id_type id_;
+    process* process_;
+    virtual_address address_;
+    stoppoint_mode mode_;
+    std::size_t size_;
+    bool is_enabled_;
+    std::uint64_t data_ = 0;
+    std::uint64_t previous_data_ = 0;
+    int hardware_register_index_ = -1;
+};
+}
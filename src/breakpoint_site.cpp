@@ -2,9 +2,6 @@
 #include <libsdb/process.hpp>
 #include <libsdb/error.hpp>
 
-#include <sys/ptrace.h>
-
-
 namespace
 {
 auto get_next_id() {
@@ -13,34 +10,89 @@ auto get_next_id() {
 }
 }
 
-sdb::breakpoint_site::breakpoint_site(process& proc, virtual_address address) : process_{&proc}, address_{address}, is_enabled_{false}, saved_data_{} {
-        id_ = get_next_id();
+sdb::breakpoint_site::breakpoint_site(process& proc, virtual_address address, bool is_hardware)
+    : process_{&proc}, address_{address}, is_enabled_{false}, saved_data_{}, is_hardware_{is_hardware}
+{
+    id_ = get_next_id();
+    if (is_hardware_)
+    {
+        // The address only needs writing once, so toggling is just DR7
+        hardware_register_index_ = process_->allocate_debug_register(address_, stoppoint_mode::Execute, 1);
+    }
 }
 
-void sdb::breakpoint_site::enable()
+sdb::breakpoint_site::breakpoint_site(process& proc, const breakpoint_site& parent_site)
+    : id_{parent_site.id_}, process_{&proc}, address_{parent_site.address_}, is_enabled_{parent_site.is_enabled_},
+      saved_data_{parent_site.saved_data_}, is_hardware_{parent_site.is_hardware_}, hardware_register_index_{parent_site.hardware_register_index_},
+      condition_{parent_site.condition_}, hit_count_{parent_site.hit_count_}, ignore_count_{parent_site.ignore_count_},
+      trace_{parent_site.trace_}, displaced_{parent_site.displaced_}, is_displaceable_{parent_site.is_displaceable_},
+      emulated_{parent_site.emulated_}, is_decoded_{parent_site.is_decoded_}
 {
-    if (is_enabled_)
+}
+
+sdb::breakpoint_site::~breakpoint_site()
+{
+    if (hardware_register_index_ >= 0)
     {
-        return;
+        process_->free_debug_register(hardware_register_index_);
     }
+}
 
-    errno = 0; // Hmmm....
-    std::uint64_t data = ptrace(PTRACE_PEEKDATA, process_->pid(), address_, nullptr);
-    if (errno != 0)
+void sdb::breakpoint_site::set_trace(std::optional<trace_spec> spec)
+{
+    if (spec)
     {
-        error::send_errno("Enabling breakpoint site failed");
+        spec->validate();
     }
 
-    saved_data_ = static_cast<std::byte>(data & 0xff);
+    trace_ = std::move(spec);
+}
 
-    std::uint64_t int3 = 0xcc;
-    std::uint64_t data_with_int3 = ((data & ~0xff) | int3);
+bool sdb::breakpoint_site::record_hit(const thread& stopped)
+{
+    if (condition_)
+    {
+        try
+        {
+            if (condition_->evaluate(stopped.get_registers(), *process_) == 0)
+            {
+                return false;
+            }
+        }
+        catch (const error&)
+        {
+            // Such as reading unmapped memory, which the user should see
+            ++hit_count_;
+            return true;
+        }
+    }
 
-    if (ptrace(PTRACE_POKEDATA, process_->pid(), address_, data_with_int3) < 0)
+    ++hit_count_;
+    if (ignore_count_ > 0)
     {
-        error::send_errno("Enabling breakpoint site failed");
+        --ignore_count_;
+        return false;
     }
 
+    return true;
+}
+
+void sdb::breakpoint_site::enable()
+{
+    if (is_enabled_)
+    {
+        return;
+    }
+
+    if (is_hardware_)
+    {
+        process_->set_debug_register_enabled(hardware_register_index_, true);
+        is_enabled_ = true;
+        return;
+    }
+
+    // Through the process, so what it knows of the code there stays current
+    process_->write_breakpoint_bytes({this}, true);
     is_enabled_ = true;
 }
 
@@ -51,20 +103,68 @@ void sdb::breakpoint_site::disable()
         return;
     }
 
-    errno = 0;
-    std::uint64_t data = ptrace(PTRACE_PEEKDATA, process_->pid(), address_, nullptr);
-    if (errno != 0)
+    if (is_hardware_)
     {
-        error::send_errno("Disabling breakpoint site failed");
+        process_->set_debug_register_enabled(hardware_register_index_, false);
+        is_enabled_ = false;
+        return;
     }
 
-    auto restored_data = ((data & ~0xff) | static_cast<std::uint8_t>(saved_data_));
+    process_->write_breakpoint_bytes({this}, false);
+    is_enabled_ = false;
+}
+
 
-    if (ptrace(PTRACE_POKEDATA, process_->pid(), address_, restored_data) < 0)
+void sdb::breakpoint_site::enable_all(const std::vector<breakpoint_site*>& sites)
+{
+    std::vector<breakpoint_site*> software_sites;
+    for (auto site : sites)
     {
-        error::send_errno("Disabling breakpoint site failed");
+        if (site->is_hardware_)
+        {
+            site->enable();
+        }
+        else if (!site->is_enabled_)
+        {
+            software_sites.push_back(site);
+        }
     }
 
-    is_enabled_ = false;
+    if (software_sites.empty())
+    {
+        return;
+    }
+
+    software_sites.front()->process_->write_breakpoint_bytes(software_sites, true);
+    for (auto site : software_sites)
+    {
+        site->is_enabled_ = true;
+    }
 }
 
+void sdb::breakpoint_site::disable_all(const std::vector<breakpoint_site*>& sites)
+{
+    std::vector<breakpoint_site*> software_sites;
+    for (auto site : sites)
+    {
+        if (site->is_hardware_)
+        {
+            site->disable();
+        }
+        else if (site->is_enabled_)
+        {
+            software_sites.push_back(site);
+        }
+    }
+
+    if (software_sites.empty())
+    {
+        return;
+    }
+
+    software_sites.front()->process_->write_breakpoint_bytes(software_sites, false);
+    for (auto site : software_sites)
+    {
+        site->is_enabled_ = false;
+    }
+}
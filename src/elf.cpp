@@ -0,0 +1,801 @@
+#include <libsdb/elf.hpp>
+#include <libsdb/error.hpp>
+#include <libsdb/line_table.hpp>
+
+#include <zlib.h>
+#include <zstd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+// Older elf.h only knows zlib
+#ifndef ELFCOMPRESS_ZSTD
+#define ELFCOMPRESS_ZSTD 2
+#endif
+
+namespace
+{
+// FNV-1a, which unlike std::hash is the same from run to run, as the cache needs
+std::uint64_t hash_name(std::string_view name)
+{
+    std::uint64_t hash = 0xcbf29ce484222325;
+    for (auto c : name)
+    {
+        hash = (hash ^ static_cast<std::uint8_t>(c)) * 0x100000001b3;
+    }
+    return hash;
+}
+
+// Decompressed sections, across every file, are kept to this by removing the least recently used
+constexpr std::uintmax_t cSectionCacheLimit{std::uintmax_t{1} << 30};
+
+// Nothing if there is no file there of size, which means it was left half
+// written, and so is decompressed again
+std::optional<sdb::span<const std::byte>> map_cached_section(const std::filesystem::path& path, std::size_t size)
+{
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return std::nullopt;
+    }
+
+    struct stat stats;
+    auto mapped = fstat(fd, &stats) == 0 && static_cast<std::size_t>(stats.st_size) == size
+        ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return std::nullopt;
+    }
+
+    // Marks it as recently used
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    return sdb::span<const std::byte>{static_cast<const std::byte*>(mapped), size};
+}
+
+void trim_section_cache(const std::filesystem::path& directory)
+{
+    // The cache only saves time, so anything going wrong here is ignored
+    try
+    {
+        std::vector<std::filesystem::directory_entry> entries;
+        std::uintmax_t total = 0;
+        for (auto& entry : std::filesystem::directory_iterator(directory))
+        {
+            if (entry.is_regular_file())
+            {
+                entries.push_back(entry);
+                total += entry.file_size();
+            }
+        }
+
+        std::sort(entries.begin(), entries.end(), [](auto& lhs, auto& rhs) {
+            return lhs.last_write_time() < rhs.last_write_time();
+        });
+        for (auto& entry : entries)
+        {
+            if (total <= cSectionCacheLimit)
+            {
+                break;
+            }
+            total -= entry.file_size();
+            std::filesystem::remove(entry.path());
+        }
+    }
+    catch (const std::filesystem::filesystem_error&)
+    {
+    }
+}
+
+// Without the parameter list, so "f(int) const" gives "f", as names are usually written
+std::string_view strip_parameters(std::string_view name)
+{
+    auto close = name.rfind(')');
+    if (close == std::string_view::npos)
+    {
+        return name;
+    }
+
+    int depth = 0;
+    for (auto i = close + 1; i-- > 0;)
+    {
+        if (name[i] == ')')
+        {
+            ++depth;
+        }
+        else if (name[i] == '(' && --depth == 0)
+        {
+            return name.substr(0, i);
+        }
+    }
+
+    return name;
+}
+}
+
+sdb::elf::elf(const std::filesystem::path& path, std::optional<std::filesystem::path> cache_directory) : path_{path}
+{
+    if ((fd_ = open(path.c_str(), O_RDONLY)) < 0)
+    {
+        error::send_errno(std::format("Could not open ELF file {}", path.string()));
+    }
+
+    struct stat stats;
+    if (fstat(fd_, &stats) < 0)
+    {
+        close(fd_);
+        error::send_errno(std::format("Could not get ELF file {} stats", path.string()));
+    }
+    file_size_ = stats.st_size;
+
+    // Only the pages we read are brought in
+    auto mapped = mmap(nullptr, file_size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (mapped == MAP_FAILED)
+    {
+        close(fd_);
+        error::send_errno(std::format("Could not mmap ELF file {}", path.string()));
+    }
+    data_ = static_cast<std::byte*>(mapped);
+
+    auto fail = [&](const std::string& what) {
+        munmap(data_, file_size_);
+        close(fd_);
+        error::send(std::format("{} is not a valid ELF file: {}", path.string(), what));
+    };
+
+    if (file_size_ < sizeof(header_))
+    {
+        fail("too small");
+    }
+    std::memcpy(&header_, data_, sizeof(header_));
+    if (std::memcmp(header_.e_ident, ELFMAG, SELFMAG) != 0 || header_.e_ident[EI_CLASS] != ELFCLASS64)
+    {
+        fail("not a 64 bit ELF file");
+    }
+    if (header_.e_phoff + std::uint64_t{header_.e_phnum} * sizeof(Elf64_Phdr) > file_size_)
+    {
+        fail("program headers run past the end");
+    }
+
+    std::vector<Elf64_Phdr> program_headers(header_.e_phnum);
+    std::memcpy(program_headers.data(), data_ + header_.e_phoff, program_headers.size() * sizeof(Elf64_Phdr));
+
+    // Text relocations patch the loaded code, which then differs from the file
+    auto has_text_relocations = false;
+    for (auto& header : program_headers)
+    {
+        if (header.p_type != PT_DYNAMIC || header.p_offset + header.p_filesz > file_size_)
+        {
+            continue;
+        }
+
+        auto entries = reinterpret_cast<const Elf64_Dyn*>(data_ + header.p_offset);
+        for (std::size_t i = 0; i < header.p_filesz / sizeof(Elf64_Dyn) && entries[i].d_tag != DT_NULL; ++i)
+        {
+            if (entries[i].d_tag == DT_TEXTREL || (entries[i].d_tag == DT_FLAGS && (entries[i].d_un.d_val & DF_TEXTREL)))
+            {
+                has_text_relocations = true;
+            }
+        }
+    }
+
+    for (auto& header : program_headers)
+    {
+        if (header.p_type == PT_LOAD && (header.p_flags & PF_X) && !(header.p_flags & PF_W)
+            && header.p_offset + header.p_filesz <= file_size_ && !has_text_relocations)
+        {
+            code_segments_.push_back(header);
+        }
+    }
+
+    if (header_.e_shoff == 0)
+    {
+        // Sections are optional once linked, but lookups still need an index, if an empty one
+        build_symbol_index();
+        return;
+    }
+
+    // With too many to count in the header, the first section has the number
+    if (header_.e_shoff + sizeof(Elf64_Shdr) > file_size_)
+    {
+        fail("section headers run past the end");
+    }
+    section_headers_ = reinterpret_cast<const Elf64_Shdr*>(data_ + header_.e_shoff);
+    section_count_ = header_.e_shnum == 0 ? section_headers_[0].sh_size : header_.e_shnum;
+    if (header_.e_shoff + section_count_ * sizeof(Elf64_Shdr) > file_size_)
+    {
+        fail("section headers run past the end");
+    }
+    for (std::size_t i = 0; i < section_count_; ++i)
+    {
+        auto& section = section_headers_[i];
+        if (section.sh_type != SHT_NOBITS && section.sh_offset + section.sh_size > file_size_)
+        {
+            fail(std::format("section {} runs past the end", i));
+        }
+    }
+
+    find_build_id();
+    find_symbol_tables();
+    if (!build_id_.empty())
+    {
+        cache_directory_ = cache_directory;
+    }
+
+    // Keyed by build ID, and checked against where the tables are, as a stripped
+    // copy of the file has the same build ID without the full table
+    auto cache_path = cache_directory_ ? std::optional{*cache_directory_ / build_id_} : std::nullopt;
+    if (cache_path && load_symbol_index(*cache_path))
+    {
+        return;
+    }
+
+    build_symbol_index();
+    if (cache_path)
+    {
+        save_symbol_index(*cache_path);
+    }
+}
+
+sdb::elf::~elf()
+{
+    for (auto& [index, contents] : decompressed_sections_)
+    {
+        munmap(const_cast<std::byte*>(contents.begin()), contents.size());
+    }
+    if (index_mapping_)
+    {
+        munmap(index_mapping_, index_mapping_size_);
+    }
+    munmap(data_, file_size_);
+    close(fd_);
+}
+
+std::filesystem::path sdb::elf::default_cache_directory()
+{
+    if (auto cache_home = std::getenv("XDG_CACHE_HOME"); cache_home && *cache_home)
+    {
+        return std::filesystem::path{cache_home} / "sdb";
+    }
+
+    auto home = std::getenv("HOME");
+    return std::filesystem::path{home ? home : "/tmp"} / ".cache" / "sdb";
+}
+
+sdb::span<const std::byte> sdb::elf::code_at(virtual_address address, std::size_t size) const
+{
+    auto linked = address.addr() - load_bias_.addr();
+    for (auto& segment : code_segments_)
+    {
+        if (linked >= segment.p_vaddr && linked < segment.p_vaddr + segment.p_filesz)
+        {
+            auto offset = linked - segment.p_vaddr;
+            auto available = std::min<std::size_t>(size, segment.p_filesz - offset);
+            return {data_ + segment.p_offset + offset, available};
+        }
+    }
+
+    return {};
+}
+
+bool sdb::elf::contains_code(virtual_address address, std::size_t size) const
+{
+    auto low = address.addr() - load_bias_.addr();
+    auto high = low + size;
+    for (auto& segment : code_segments_)
+    {
+        if (low < segment.p_vaddr + segment.p_memsz && high > segment.p_vaddr)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+std::string_view sdb::elf::get_section_name(std::size_t index) const
+{
+    if (header_.e_shstrndx >= section_count_)
+    {
+        return {};
+    }
+
+    auto& names = section_headers_[header_.e_shstrndx];
+    return get_string(names, section_headers_[index].sh_name);
+}
+
+const Elf64_Shdr* sdb::elf::get_section(std::string_view name) const
+{
+    for (std::size_t i = 0; i < section_count_; ++i)
+    {
+        if (get_section_name(i) == name)
+        {
+            return &section_headers_[i];
+        }
+    }
+
+    return nullptr;
+}
+
+sdb::span<const std::byte> sdb::elf::get_section_contents(std::string_view name) const
+{
+    auto section = get_section(name);
+    if (!section || section->sh_type == SHT_NOBITS)
+    {
+        return {};
+    }
+    if (section->sh_flags & SHF_COMPRESSED)
+    {
+        return decompress_section(*section);
+    }
+
+    return {data_ + section->sh_offset, section->sh_size};
+}
+
+sdb::span<const std::byte> sdb::elf::decompress_section(const Elf64_Shdr& section) const
+{
+    auto index = static_cast<std::size_t>(&section - section_headers_);
+    if (auto it = decompressed_sections_.find(index); it != decompressed_sections_.end())
+    {
+        return it->second;
+    }
+
+    auto name = get_section_name(index);
+    Elf64_Chdr header;
+    if (section.sh_size < sizeof(header))
+    {
+        error::send(std::format("Compressed section {} has no compression header", name));
+    }
+    std::memcpy(&header, data_ + section.sh_offset, sizeof(header));
+    if (header.ch_type != ELFCOMPRESS_ZLIB && header.ch_type != ELFCOMPRESS_ZSTD)
+    {
+        error::send(std::format("Section {} has unknown compression type {}", name, header.ch_type));
+    }
+    if (header.ch_size == 0)
+    {
+        return {};
+    }
+
+    auto cache_path = cache_directory_
+        ? std::optional{*cache_directory_ / "sections" / std::format("{}{}", build_id_, name)}
+        : std::nullopt;
+    if (cache_path)
+    {
+        if (auto contents = map_cached_section(*cache_path, header.ch_size))
+        {
+            return decompressed_sections_[index] = *contents;
+        }
+    }
+
+    // Into a file when it can be cached, so the pages can be dropped and read
+    // back rather than taking memory like those of an anonymous mapping
+    std::optional<std::filesystem::path> temporary_path;
+    void* mapped = MAP_FAILED;
+    if (cache_path)
+    {
+        std::error_code error_code;
+        std::filesystem::create_directories(cache_path->parent_path(), error_code);
+        temporary_path = *cache_path;
+        *temporary_path += std::format(".{}", getpid());
+        auto fd = open(temporary_path->c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0 && ftruncate(fd, header.ch_size) == 0)
+        {
+            mapped = mmap(nullptr, header.ch_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        if (mapped == MAP_FAILED)
+        {
+            std::filesystem::remove(*temporary_path, error_code);
+            temporary_path.reset();
+        }
+    }
+    if (mapped == MAP_FAILED)
+    {
+        mapped = mmap(nullptr, header.ch_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+        {
+            error::send_errno(std::format("Could not map memory to decompress {}", name));
+        }
+    }
+
+    auto compressed = data_ + section.sh_offset + sizeof(header);
+    auto compressed_size = section.sh_size - sizeof(header);
+    bool decompressed;
+    if (header.ch_type == ELFCOMPRESS_ZLIB)
+    {
+        uLongf size = header.ch_size;
+        decompressed = uncompress(static_cast<Bytef*>(mapped), &size, reinterpret_cast<const Bytef*>(compressed), compressed_size) == Z_OK
+            && size == header.ch_size;
+    }
+    else
+    {
+        auto size = ZSTD_decompress(mapped, header.ch_size, compressed, compressed_size);
+        decompressed = !ZSTD_isError(size) && size == header.ch_size;
+    }
+
+    std::error_code error_code;
+    if (!decompressed)
+    {
+        munmap(mapped, header.ch_size);
+        if (temporary_path)
+        {
+            std::filesystem::remove(*temporary_path, error_code);
+        }
+        error::send(std::format("Could not decompress section {}", name));
+    }
+
+    if (temporary_path)
+    {
+        std::filesystem::rename(*temporary_path, *cache_path, error_code);
+        if (error_code)
+        {
+            std::filesystem::remove(*temporary_path, error_code);
+        }
+        trim_section_cache(cache_path->parent_path());
+    }
+    return decompressed_sections_[index] = {static_cast<const std::byte*>(mapped), header.ch_size};
+}
+
+std::string_view sdb::elf::get_string(const Elf64_Shdr& string_table, std::size_t index) const
+{
+    if (index >= string_table.sh_size)
+    {
+        return {};
+    }
+
+    // A string table ends with a null, so strnlen stops within it
+    auto start = reinterpret_cast<const char*>(data_ + string_table.sh_offset + index);
+    return {start, strnlen(start, string_table.sh_size - index)};
+}
+
+void sdb::elf::find_build_id()
+{
+    for (std::size_t i = 0; i < section_count_; ++i)
+    {
+        auto& section = section_headers_[i];
+        if (section.sh_type != SHT_NOTE)
+        {
+            continue;
+        }
+
+        // Each note is a header, then its name and description, each padded to four bytes
+        std::size_t offset = 0;
+        while (offset + sizeof(Elf64_Nhdr) <= section.sh_size)
+        {
+            Elf64_Nhdr note;
+            std::memcpy(&note, data_ + section.sh_offset + offset, sizeof(note));
+            auto name_offset = offset + sizeof(note);
+            auto description_offset = name_offset + ((note.n_namesz + 3) & ~3u);
+            auto next = description_offset + ((note.n_descsz + 3) & ~3u);
+            if (next > section.sh_size)
+            {
+                break;
+            }
+
+            auto name = reinterpret_cast<const char*>(data_ + section.sh_offset + name_offset);
+            if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 && std::memcmp(name, "GNU", 4) == 0)
+            {
+                auto description = data_ + section.sh_offset + description_offset;
+                for (std::size_t j = 0; j < note.n_descsz; ++j)
+                {
+                    build_id_ += std::format("{:02x}", static_cast<std::uint8_t>(description[j]));
+                }
+                return;
+            }
+            offset = next;
+        }
+    }
+}
+
+void sdb::elf::find_symbol_tables()
+{
+    // The full table if we have it, and the dynamic one, which survives strip, anyway
+    std::uint32_t first = 0;
+    for (auto name : {".symtab", ".dynsym"})
+    {
+        auto table = get_section(name);
+        if (!table || table->sh_entsize != sizeof(Elf64_Sym) || table->sh_link >= section_count_)
+        {
+            continue;
+        }
+
+        auto count = static_cast<std::uint32_t>(table->sh_size / sizeof(Elf64_Sym));
+        symbol_tables_.push_back({reinterpret_cast<const Elf64_Sym*>(data_ + table->sh_offset), count,
+                                  &section_headers_[table->sh_link], table, first});
+        first += count;
+    }
+}
+
+const Elf64_Sym& sdb::elf::get_symbol(std::uint32_t ref) const
+{
+    auto table = symbol_tables_.begin();
+    while (ref >= table->first + table->count)
+    {
+        ++table;
+    }
+    return table->symbols[ref - table->first];
+}
+
+void sdb::elf::build_symbol_index()
+{
+    std::vector<std::uint32_t> by_address;
+    for (auto& table : symbol_tables_)
+    {
+        for (std::uint32_t i = 0; i < table.count; ++i)
+        {
+            auto& symbol = table.symbols[i];
+            auto type = ELF64_ST_TYPE(symbol.st_info);
+            if ((type != STT_FUNC && type != STT_OBJECT) || symbol.st_value == 0 || symbol.st_shndx == SHN_UNDEF
+                || get_string(*table.strings, symbol.st_name).empty())
+            {
+                continue;
+            }
+
+            by_address.push_back(table.first + i);
+        }
+    }
+
+    std::stable_sort(by_address.begin(), by_address.end(), [this](auto lhs, auto rhs) {
+        return get_symbol(lhs).st_value < get_symbol(rhs).st_value;
+    });
+
+    // Open addressing with linear probing, at most half full, each slot one more than the symbol's ref
+    auto capacity = std::bit_ceil(std::max<std::size_t>(by_address.size() * 2, 16));
+    index_storage_.resize(by_address.size() + capacity);
+    std::copy(by_address.begin(), by_address.end(), index_storage_.begin());
+    auto slots = index_storage_.data() + by_address.size();
+    for (auto ref : by_address)
+    {
+        auto slot = hash_name(get_symbol_name(get_symbol(ref))) & (capacity - 1);
+        while (slots[slot] != 0)
+        {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        slots[slot] = ref + 1;
+    }
+
+    symbols_by_address_ = {index_storage_.data(), by_address.size()};
+    name_hash_ = {slots, capacity};
+}
+
+namespace
+{
+constexpr char cIndexMagic[8] = {'S', 'D', 'B', 'S', 'Y', 'M', 'I', 'X'};
+// Increase whenever the layout or meaning of the file changes
+constexpr std::uint32_t cIndexVersion{1};
+
+// Followed by the symbols by address, then the name hash, each an array of uint32
+struct index_header
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t table_count;
+    std::uint64_t file_size;
+    std::uint64_t table_offsets[2];
+    std::uint64_t table_sizes[2];
+    std::uint64_t symbol_count;
+    std::uint64_t hash_capacity;
+};
+}
+
+bool sdb::elf::load_symbol_index(const std::filesystem::path& cache_path)
+{
+    auto fd = open(cache_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat stats;
+    auto mapped = fstat(fd, &stats) == 0 && static_cast<std::size_t>(stats.st_size) >= sizeof(index_header)
+        ? mmap(nullptr, stats.st_size, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+
+    // Anything which doesn't match was written for another version of sdb or of the file
+    auto& header = *static_cast<const index_header*>(mapped);
+    auto matches = std::memcmp(header.magic, cIndexMagic, sizeof(cIndexMagic)) == 0
+        && header.version == cIndexVersion
+        && header.file_size == file_size_
+        && header.table_count == symbol_tables_.size()
+        && std::has_single_bit(header.hash_capacity)
+        && sizeof(header) + (header.symbol_count + header.hash_capacity) * sizeof(std::uint32_t) == static_cast<std::size_t>(stats.st_size);
+    for (std::size_t i = 0; matches && i < symbol_tables_.size(); ++i)
+    {
+        matches = header.table_offsets[i] == symbol_tables_[i].section->sh_offset
+            && header.table_sizes[i] == symbol_tables_[i].section->sh_size;
+    }
+
+    // A corrupt file mustn't send us past the symbol tables, nor probe a hash with no empty slot
+    auto arrays = reinterpret_cast<const std::uint32_t*>(static_cast<const std::byte*>(mapped) + sizeof(header));
+    if (matches)
+    {
+        std::size_t total = symbol_tables_.empty() ? 0 : symbol_tables_.back().first + symbol_tables_.back().count;
+        auto slots = arrays + header.symbol_count;
+        auto slots_end = slots + header.hash_capacity;
+        matches = std::all_of(arrays, slots, [&](auto ref) { return ref < total; })
+            && std::all_of(slots, slots_end, [&](auto slot) { return slot <= total; })
+            && std::find(slots, slots_end, 0) != slots_end;
+    }
+    if (!matches)
+    {
+        munmap(mapped, stats.st_size);
+        return false;
+    }
+
+    index_mapping_ = mapped;
+    index_mapping_size_ = stats.st_size;
+    symbols_by_address_ = {arrays, header.symbol_count};
+    name_hash_ = {arrays + header.symbol_count, header.hash_capacity};
+    is_index_cached_ = true;
+    return true;
+}
+
+void sdb::elf::save_symbol_index(const std::filesystem::path& cache_path) const
+{
+    index_header header{};
+    std::memcpy(header.magic, cIndexMagic, sizeof(cIndexMagic));
+    header.version = cIndexVersion;
+    header.table_count = symbol_tables_.size();
+    header.file_size = file_size_;
+    for (std::size_t i = 0; i < symbol_tables_.size(); ++i)
+    {
+        header.table_offsets[i] = symbol_tables_[i].section->sh_offset;
+        header.table_sizes[i] = symbol_tables_[i].section->sh_size;
+    }
+    header.symbol_count = symbols_by_address_.size();
+    header.hash_capacity = name_hash_.size();
+
+    // The cache only saves time, so failing to write it isn't an error. Renaming
+    // a finished file into place means no one ever maps half of one.
+    std::error_code error;
+    std::filesystem::create_directories(cache_path.parent_path(), error);
+    auto temporary_path = cache_path;
+    temporary_path += std::format(".{}", getpid());
+    {
+        std::ofstream file(temporary_path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(index_storage_.data()), index_storage_.size() * sizeof(std::uint32_t));
+        if (!file)
+        {
+            std::filesystem::remove(temporary_path, error);
+            return;
+        }
+    }
+    std::filesystem::rename(temporary_path, cache_path, error);
+    if (error)
+    {
+        std::filesystem::remove(temporary_path, error);
+    }
+}
+
+void sdb::elf::build_demangled_index() const
+{
+    is_demangled_ = true;
+    for (auto ref : symbols_by_address_)
+    {
+        auto symbol = &get_symbol(ref);
+        if (!get_symbol_name(*symbol).starts_with("_Z"))
+        {
+            continue;
+        }
+
+        auto demangled = get_demangled_name(*symbol);
+        auto short_name = std::string{strip_parameters(demangled)};
+        if (short_name != demangled)
+        {
+            symbols_by_demangled_name_.emplace(std::move(short_name), symbol);
+        }
+        symbols_by_demangled_name_.emplace(std::move(demangled), symbol);
+    }
+}
+
+std::string_view sdb::elf::get_symbol_name(const Elf64_Sym& symbol) const
+{
+    for (auto& table : symbol_tables_)
+    {
+        if (&symbol >= table.symbols && &symbol < table.symbols + table.count)
+        {
+            return get_string(*table.strings, symbol.st_name);
+        }
+    }
+
+    return {};
+}
+
+std::string sdb::elf::get_demangled_name(const Elf64_Sym& symbol) const
+{
+    auto name = std::string{get_symbol_name(symbol)};
+    int status;
+    std::unique_ptr<char, decltype(&std::free)> demangled{
+        abi::__cxa_demangle(name.c_str(), nullptr, nullptr, &status), &std::free};
+    return status == 0 ? std::string{demangled.get()} : name;
+}
+
+std::vector<const Elf64_Sym*> sdb::elf::get_symbols_by_name(std::string_view name) const
+{
+    std::vector<const Elf64_Sym*> result;
+    auto mask = name_hash_.size() - 1;
+    for (auto slot = hash_name(name) & mask; name_hash_[slot] != 0; slot = (slot + 1) & mask)
+    {
+        auto& symbol = get_symbol(name_hash_[slot] - 1);
+        if (get_symbol_name(symbol) == name)
+        {
+            result.push_back(&symbol);
+        }
+    }
+    if (!result.empty())
+    {
+        return result;
+    }
+
+    // Only names the user writes as in the source need every symbol demangled
+    if (!is_demangled_)
+    {
+        build_demangled_index();
+    }
+    auto [demangled_first, demangled_last] = symbols_by_demangled_name_.equal_range(std::string{name});
+    for (auto it = demangled_first; it != demangled_last; ++it)
+    {
+        result.push_back(it->second);
+    }
+
+    return result;
+}
+
+const Elf64_Sym* sdb::elf::get_symbol_containing_address(virtual_address address) const
+{
+    // The last symbol starting at or before address, and any aliases starting with it
+    auto it = std::upper_bound(symbols_by_address_.begin(), symbols_by_address_.end(), address.addr(), [this](auto address, auto ref) {
+        return address < get_symbol(ref).st_value;
+    });
+    if (it == symbols_by_address_.begin())
+    {
+        return nullptr;
+    }
+
+    auto start = get_symbol(*std::prev(it)).st_value;
+    while (it != symbols_by_address_.begin() && get_symbol(*std::prev(it)).st_value == start)
+    {
+        --it;
+        // A symbol without a size only covers its own address
+        auto& symbol = get_symbol(*it);
+        if (address.addr() < start + std::max<std::uint64_t>(symbol.st_size, 1))
+        {
+            return &symbol;
+        }
+    }
+
+    return nullptr;
+}
+
+const sdb::line_table& sdb::elf::get_line_table() const
+{
+    if (!line_table_)
+    {
+        line_table_ = std::make_unique<line_table>(get_section_contents(".debug_line"),
+            get_section_contents(".debug_line_str"), get_section_contents(".debug_str"));
+    }
+
+    return *line_table_;
+}
@@ -0,0 +1,161 @@
+#include <libsdb/emulate.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/bit.hpp>
+#include <libsdb/error.hpp>
+
+#include <Zydis/Zydis.h>
+
+#include <bit>
+
+namespace
+{
+// In the order Zydis numbers them, which is also their encoding
+constexpr sdb::register_id g_gpr64s[] = {
+    sdb::register_id::rax, sdb::register_id::rcx, sdb::register_id::rdx, sdb::register_id::rbx,
+    sdb::register_id::rsp, sdb::register_id::rbp, sdb::register_id::rsi, sdb::register_id::rdi,
+    sdb::register_id::r8, sdb::register_id::r9, sdb::register_id::r10, sdb::register_id::r11,
+    sdb::register_id::r12, sdb::register_id::r13, sdb::register_id::r14, sdb::register_id::r15,
+};
+
+std::optional<sdb::register_id> gpr64(const ZydisDecodedOperand& operand)
+{
+    if (operand.type != ZYDIS_OPERAND_TYPE_REGISTER
+        || operand.reg.value < ZYDIS_REGISTER_RAX || operand.reg.value > ZYDIS_REGISTER_R15)
+    {
+        return std::nullopt;
+    }
+
+    return g_gpr64s[operand.reg.value - ZYDIS_REGISTER_RAX];
+}
+
+// The flags after lhs - rhs, keeping those sub leaves alone
+std::uint64_t subtract_flags(std::uint64_t flags, std::uint64_t lhs, std::uint64_t rhs)
+{
+    constexpr std::uint64_t cCarry{1 << 0};
+    constexpr std::uint64_t cParity{1 << 2};
+    constexpr std::uint64_t cAdjust{1 << 4};
+    constexpr std::uint64_t cZero{1 << 6};
+    constexpr std::uint64_t cSign{1 << 7};
+    constexpr std::uint64_t cOverflow{1 << 11};
+
+    auto result = lhs - rhs;
+    flags &= ~(cCarry | cParity | cAdjust | cZero | cSign | cOverflow);
+    flags |= lhs < rhs ? cCarry : 0;
+    // Set when the low byte has an even number of ones
+    flags |= std::popcount(result & 0xff) % 2 == 0 ? cParity : 0;
+    flags |= (lhs ^ rhs ^ result) & 0x10 ? cAdjust : 0;
+    flags |= result == 0 ? cZero : 0;
+    flags |= result >> 63 ? cSign : 0;
+    flags |= ((lhs ^ rhs) & (lhs ^ result)) >> 63 ? cOverflow : 0;
+    return flags;
+}
+}
+
+std::optional<sdb::emulated_instruction> sdb::decode_emulated(span<const std::byte> code)
+{
+    ZydisDecoder decoder;
+    ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64);
+
+    ZydisDecodedInstruction instruction;
+    ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(&decoder, code.begin(), code.size(), &instruction, operands)))
+    {
+        return std::nullopt;
+    }
+
+    emulated_instruction result{};
+    result.length = instruction.length;
+    switch (instruction.mnemonic)
+    {
+        case ZYDIS_MNEMONIC_ENDBR64:
+        case ZYDIS_MNEMONIC_NOP:
+            result.op = emulated_instruction::operation::Nop;
+            return result;
+        case ZYDIS_MNEMONIC_PUSH:
+            if (auto source = gpr64(operands[0]))
+            {
+                result.op = emulated_instruction::operation::Push;
+                result.source = *source;
+                return result;
+            }
+            break;
+        case ZYDIS_MNEMONIC_MOV:
+        {
+            auto destination = gpr64(operands[0]);
+            auto source = gpr64(operands[1]);
+            if (destination && source)
+            {
+                result.op = emulated_instruction::operation::Move;
+                result.destination = *destination;
+                result.source = *source;
+                return result;
+            }
+            break;
+        }
+        case ZYDIS_MNEMONIC_SUB:
+            if (auto destination = gpr64(operands[0]); destination && operands[1].type == ZYDIS_OPERAND_TYPE_IMMEDIATE)
+            {
+                result.op = emulated_instruction::operation::Subtract;
+                result.destination = *destination;
+                result.immediate = static_cast<std::uint64_t>(operands[1].imm.value.s);
+                return result;
+            }
+            break;
+        default:
+            break;
+    }
+
+    return std::nullopt;
+}
+
+bool sdb::emulate(const emulated_instruction& instruction, virtual_address address, registers& regs, process& proc)
+{
+    using operation = emulated_instruction::operation;
+
+    switch (instruction.op)
+    {
+        case operation::Nop:
+            break;
+        case operation::Push:
+        {
+            auto value = regs.read_by_id_as<std::uint64_t>(instruction.source);
+            auto stack_pointer = virtual_address{regs.read_by_id_as<std::uint64_t>(register_id::rsp) - 8};
+
+            // The debug registers would never see a write we make for the inferior
+            for (auto point : proc.watchpoints().get_in_region(stack_pointer - 7, stack_pointer + 8))
+            {
+                if (point->is_enabled() && point->mode() != stoppoint_mode::Execute
+                    && point->address() + point->size() > stack_pointer)
+                {
+                    return false;
+                }
+            }
+
+            try
+            {
+                proc.write_memory(stack_pointer, {as_bytes(value), sizeof(value)});
+            }
+            catch (const error&)
+            {
+                // Such as the stack needing to grow, which only the inferior's own fault does
+                return false;
+            }
+            regs.write_by_id(register_id::rsp, stack_pointer.addr());
+            break;
+        }
+        case operation::Move:
+            regs.write_by_id(instruction.destination, regs.read_by_id_as<std::uint64_t>(instruction.source));
+            break;
+        case operation::Subtract:
+        {
+            auto lhs = regs.read_by_id_as<std::uint64_t>(instruction.destination);
+            auto flags = regs.read_by_id_as<std::uint64_t>(register_id::eflags);
+            regs.write_by_id(register_id::eflags, subtract_flags(flags, lhs, instruction.immediate));
+            regs.write_by_id(instruction.destination, lhs - instruction.immediate);
+            break;
+        }
+    }
+
+    regs.write_by_id(register_id::rip, (address + instruction.length).addr());
+    return true;
+}
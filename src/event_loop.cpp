@@ -0,0 +1,247 @@
+#include <libsdb/event_loop.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/error.hpp>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <array>
+
+sdb::event_loop::event_loop()
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+
+    // A signal we neither handle nor block is discarded, so block it to queue it for the signalfd
+    if (pthread_sigmask(SIG_BLOCK, &mask, &previous_mask_) != 0)
+    {
+        error::send("Could not block SIGCHLD");
+    }
+
+    // The destructor won't run if we throw, so tidy up here
+    auto fail = [this](const char* message) {
+        auto saved_errno = errno;
+        close_fds();
+        errno = saved_errno;
+        error::send_errno(message);
+    };
+
+    signal_fd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (signal_fd_ < 0 || epoll_fd_ < 0)
+    {
+        fail("Could not create event loop");
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = signal_fd_;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, &event) < 0)
+    {
+        fail("Could not watch for SIGCHLD");
+    }
+}
+
+sdb::event_loop::~event_loop()
+{
+    for (auto& [proc, watched] : processes_)
+    {
+        if (watched.pid_fd >= 0)
+        {
+            close(watched.pid_fd);
+        }
+    }
+
+    close_fds();
+}
+
+void sdb::event_loop::close_fds()
+{
+    if (epoll_fd_ >= 0)
+    {
+        close(std::exchange(epoll_fd_, -1));
+    }
+    if (signal_fd_ >= 0)
+    {
+        close(std::exchange(signal_fd_, -1));
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous_mask_, nullptr);
+}
+
+void sdb::event_loop::add_process(process& proc)
+{
+    auto [it, inserted] = processes_.emplace(&proc, watched_process{0, -1});
+    if (!inserted)
+    {
+        return;
+    }
+    watch_pid(proc, it->second);
+
+    // Waiting on one process can collect another's stop, so they keep them in one place
+    if (!unclaimed_wait_statuses_)
+    {
+        unclaimed_wait_statuses_ = proc.unclaimed_wait_statuses_;
+    }
+    else if (proc.unclaimed_wait_statuses_ != unclaimed_wait_statuses_)
+    {
+        auto& unclaimed = *proc.unclaimed_wait_statuses_;
+        unclaimed_wait_statuses_->insert(unclaimed_wait_statuses_->end(), unclaimed.begin(), unclaimed.end());
+        unclaimed.clear();
+        proc.unclaimed_wait_statuses_ = unclaimed_wait_statuses_;
+    }
+}
+
+void sdb::event_loop::remove_process(process& proc)
+{
+    auto it = processes_.find(&proc);
+    if (it == processes_.end())
+    {
+        return;
+    }
+
+    if (it->second.pid_fd >= 0)
+    {
+        close(it->second.pid_fd); // Also removes it from epoll
+    }
+    processes_.erase(it);
+}
+
+void sdb::event_loop::watch_pid(process& proc, watched_process& watched)
+{
+    if (watched.pid_fd >= 0)
+    {
+        close(watched.pid_fd);
+    }
+
+    // Following a forked child changes the pid under the same process object
+    watched.pid = proc.pid();
+    watched.pid_fd = syscall(SYS_pidfd_open, watched.pid, 0);
+    if (watched.pid_fd < 0)
+    {
+        return; // It has already been reaped, so there is nothing more to hear
+    }
+
+    // Readable from when the process exits until it is reaped, so only tell us once
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = watched.pid_fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, watched.pid_fd, &event) < 0)
+    {
+        error::send_errno("Could not watch process");
+    }
+}
+
+void sdb::event_loop::add_fd(int fd, std::function<void()> on_readable)
+{
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) < 0)
+    {
+        error::send_errno("Could not watch file descriptor");
+    }
+
+    fds_[fd] = std::move(on_readable);
+}
+
+void sdb::event_loop::remove_fd(int fd)
+{
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    fds_.erase(fd);
+}
+
+void sdb::event_loop::run_once(std::chrono::milliseconds timeout)
+{
+    static constexpr auto cMaxEvents{16};
+    std::array<epoll_event, cMaxEvents> events;
+
+    auto count = epoll_wait(epoll_fd_, events.data(), events.size(), timeout.count());
+    if (count < 0)
+    {
+        if (errno == EINTR)
+        {
+            return;
+        }
+        error::send_errno("Could not wait for events");
+    }
+
+    auto check_processes = false;
+    std::vector<int> readable;
+    for (auto i = 0; i < count; ++i)
+    {
+        auto fd = events[i].data.fd;
+        if (fd == signal_fd_)
+        {
+            // One SIGCHLD can stand for many stops, so just drain them all
+            signalfd_siginfo info;
+            while (read(signal_fd_, &info, sizeof(info)) == sizeof(info))
+            {
+            }
+            check_processes = true;
+        }
+        else if (fds_.contains(fd))
+        {
+            readable.push_back(fd);
+        }
+        else
+        {
+            check_processes = true; // A pidfd
+        }
+    }
+
+    if (check_processes)
+    {
+        wake_stopped_processes();
+    }
+
+    for (auto fd : readable)
+    {
+        // An earlier callback may have removed this one
+        if (auto it = fds_.find(fd); it != fds_.end())
+        {
+            auto on_readable = it->second;
+            on_readable();
+        }
+    }
+}
+
+void sdb::event_loop::wake_stopped_processes()
+{
+    // Waiting on one process can collect another's stop, which is then kept for
+    // it without raising another SIGCHLD, so repeat until nobody makes progress
+    auto progressed = true;
+    while (progressed)
+    {
+        progressed = false;
+
+        std::vector<process*> waiting;
+        for (auto& [proc, watched] : processes_)
+        {
+            if (proc->stop_waiter_)
+            {
+                waiting.push_back(proc);
+            }
+        }
+
+        for (auto proc : waiting)
+        {
+            // A woken coroutine may have removed processes from the loop
+            auto it = processes_.find(proc);
+            if (it == processes_.end())
+            {
+                continue;
+            }
+
+            if (it->second.pid != proc->pid())
+            {
+                watch_pid(*proc, it->second);
+            }
+
+            progressed |= proc->wake_stop_waiter();
+        }
+    }
+}
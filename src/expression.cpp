@@ -0,0 +1,439 @@
+#include <libsdb/expression.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/error.hpp>
+
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace sdb
+{
+// Recursive descent over the source, emitting bytecode as it goes
+class expression_parser
+{
+public:
+    explicit expression_parser(std::string_view source) : source_{source}
+    {
+        result_.source_ = source;
+    }
+
+    expression parse();
+
+private:
+    using opcode = expression::opcode;
+
+    struct binary_operator
+    {
+        std::string_view token;
+        int precedence;
+        opcode op;
+    };
+
+    void parse_binary(int minimum_precedence);
+    void parse_unary();
+    void parse_primary();
+    // Parses (u64*) or similar, returning the size, with bit 8 set if signed
+    std::optional<std::uint64_t> parse_pointer_cast();
+
+    std::optional<binary_operator> peek_binary_operator();
+    bool accept(char c);
+    std::string_view identifier();
+    void skip_space();
+
+    std::size_t emit(opcode op, std::uint64_t operand = 0);
+    [[noreturn]] void fail(std::string_view message);
+
+    std::string_view source_;
+    std::size_t position_ = 0;
+    std::size_t depth_ = 0; // Values on the stack when what we have emitted runs
+    expression result_;
+};
+}
+
+namespace
+{
+constexpr std::uint64_t cSignedLoad{0x100};
+
+struct type_name
+{
+    std::string_view name;
+    std::uint64_t load_operand;
+};
+
+constexpr type_name g_type_names[] = {
+    {"u8", 1}, {"u16", 2}, {"u32", 4}, {"u64", 8},
+    {"i8", 1 | cSignedLoad}, {"i16", 2 | cSignedLoad}, {"i32", 4 | cSignedLoad}, {"i64", 8 | cSignedLoad},
+};
+}
+
+sdb::expression sdb::expression::compile(std::string_view source)
+{
+    return expression_parser{source}.parse();
+}
+
+sdb::expression sdb::expression_parser::parse()
+{
+    parse_binary(0);
+    skip_space();
+    if (position_ != source_.size())
+    {
+        fail("Unexpected character");
+    }
+
+    return std::move(result_);
+}
+
+void sdb::expression_parser::parse_binary(int minimum_precedence)
+{
+    parse_unary();
+
+    while (auto binary = peek_binary_operator())
+    {
+        if (binary->precedence < minimum_precedence)
+        {
+            return;
+        }
+        position_ += binary->token.size();
+
+        if (binary->op == opcode::AndJump || binary->op == opcode::OrJump)
+        {
+            // Short circuit, so the right hand side may read memory the left checks
+            emit(opcode::ToBool);
+            auto jump = emit(binary->op);
+            parse_binary(binary->precedence + 1);
+            emit(opcode::ToBool);
+            result_.code_[jump].operand = result_.code_.size();
+        }
+        else
+        {
+            parse_binary(binary->precedence + 1);
+            emit(binary->op);
+        }
+    }
+}
+
+void sdb::expression_parser::parse_unary()
+{
+    skip_space();
+    if (accept('-'))
+    {
+        parse_unary();
+        emit(opcode::Negate);
+    }
+    else if (accept('!'))
+    {
+        parse_unary();
+        emit(opcode::LogicalNot);
+    }
+    else if (accept('~'))
+    {
+        parse_unary();
+        emit(opcode::Complement);
+    }
+    else if (accept('*'))
+    {
+        auto load_operand = parse_pointer_cast().value_or(8);
+        parse_unary();
+        emit(opcode::Load, load_operand);
+    }
+    else
+    {
+        parse_primary();
+    }
+}
+
+std::optional<std::uint64_t> sdb::expression_parser::parse_pointer_cast()
+{
+    auto start = position_;
+    skip_space();
+    if (accept('('))
+    {
+        auto name = identifier();
+        for (auto& type : g_type_names)
+        {
+            if (type.name == name && accept('*') && accept(')'))
+            {
+                return type.load_operand;
+            }
+        }
+    }
+
+    // Just a parenthesised address
+    position_ = start;
+    return std::nullopt;
+}
+
+void sdb::expression_parser::parse_primary()
+{
+    skip_space();
+    if (accept('('))
+    {
+        parse_binary(0);
+        if (!accept(')'))
+        {
+            fail("Expected )");
+        }
+        return;
+    }
+
+    if (position_ < source_.size() && std::isdigit(static_cast<unsigned char>(source_[position_])))
+    {
+        auto base = 10;
+        if (source_.substr(position_, 2) == "0x" || source_.substr(position_, 2) == "0X")
+        {
+            base = 16;
+            position_ += 2;
+        }
+
+        std::uint64_t value;
+        auto first = source_.data() + position_;
+        auto last = source_.data() + source_.size();
+        auto [end, ec] = std::from_chars(first, last, value, base);
+        if (ec != std::errc{})
+        {
+            fail("Invalid number");
+        }
+
+        position_ += end - first;
+        emit(opcode::Constant, value);
+        return;
+    }
+
+    auto name = identifier();
+    if (name.empty())
+    {
+        fail("Expected a number, register or (");
+    }
+
+    for (std::size_t i = 0; i < std::size(g_register_infos); ++i)
+    {
+        auto& info = g_register_infos[i];
+        if (info.name == name)
+        {
+            if (info.format != register_format::UnsignedInt || info.size > 8)
+            {
+                fail(std::format("Register {} is not an integer", name));
+            }
+
+            emit(opcode::Register, i);
+            return;
+        }
+    }
+
+    fail(std::format("Unknown register {}", name));
+}
+
+auto sdb::expression_parser::peek_binary_operator() -> std::optional<binary_operator>
+{
+    // Longer tokens first, so << is not taken for <
+    static constexpr binary_operator operators[] = {
+        {"||", 1, opcode::OrJump},
+        {"&&", 2, opcode::AndJump},
+        {"==", 6, opcode::Equal},
+        {"!=", 6, opcode::NotEqual},
+        {"<=", 7, opcode::LessEqual},
+        {">=", 7, opcode::GreaterEqual},
+        {"<<", 8, opcode::ShiftLeft},
+        {">>", 8, opcode::ShiftRight},
+        {"|", 3, opcode::BitOr},
+        {"^", 4, opcode::BitXor},
+        {"&", 5, opcode::BitAnd},
+        {"<", 7, opcode::Less},
+        {">", 7, opcode::Greater},
+        {"+", 9, opcode::Add},
+        {"-", 9, opcode::Subtract},
+        {"*", 10, opcode::Multiply},
+        {"/", 10, opcode::Divide},
+        {"%", 10, opcode::Remainder},
+    };
+
+    skip_space();
+    for (auto& binary : operators)
+    {
+        if (source_.substr(position_, binary.token.size()) == binary.token)
+        {
+            return binary;
+        }
+    }
+
+    return std::nullopt;
+}
+
+bool sdb::expression_parser::accept(char c)
+{
+    skip_space();
+    if (position_ < source_.size() && source_[position_] == c)
+    {
+        ++position_;
+        return true;
+    }
+
+    return false;
+}
+
+std::string_view sdb::expression_parser::identifier()
+{
+    skip_space();
+    auto start = position_;
+    while (position_ < source_.size() && (std::isalnum(static_cast<unsigned char>(source_[position_])) || source_[position_] == '_'))
+    {
+        ++position_;
+    }
+
+    return source_.substr(start, position_ - start);
+}
+
+void sdb::expression_parser::skip_space()
+{
+    while (position_ < source_.size() && std::isspace(static_cast<unsigned char>(source_[position_])))
+    {
+        ++position_;
+    }
+}
+
+std::size_t sdb::expression_parser::emit(opcode op, std::uint64_t operand)
+{
+    switch (op)
+    {
+        case opcode::Constant:
+        case opcode::Register:
+            if (++depth_ > expression::cMaximumDepth)
+            {
+                fail("Expression is too deeply nested");
+            }
+            break;
+        case opcode::Load:
+        case opcode::Negate:
+        case opcode::LogicalNot:
+        case opcode::Complement:
+        case opcode::ToBool:
+            break;
+        default:
+            // Binary operators, and the jumps which pop when they don't jump
+            --depth_;
+            break;
+    }
+
+    result_.code_.push_back({op, operand});
+    return result_.code_.size() - 1;
+}
+
+void sdb::expression_parser::fail(std::string_view message)
+{
+    error::send(std::format("{} at column {} of \"{}\"", message, position_ + 1, source_));
+    std::unreachable();
+}
+
+std::uint64_t sdb::expression::evaluate(const registers& regs, const process& proc) const
+{
+    std::array<std::uint64_t, cMaximumDepth> stack;
+    std::size_t top = 0; // Number of values on the stack
+
+    for (std::size_t pc = 0; pc < code_.size(); ++pc)
+    {
+        auto [op, operand] = code_[pc];
+        switch (op)
+        {
+            case opcode::Constant:
+                stack[top++] = operand;
+                break;
+            case opcode::Register:
+                stack[top++] = std::visit([](auto value) -> std::uint64_t {
+                    if constexpr (std::is_integral_v<decltype(value)>)
+                    {
+                        return static_cast<std::uint64_t>(value);
+                    }
+                    else
+                    {
+                        return 0; // Ruled out when compiling
+                    }
+                }, regs.read(g_register_infos[operand]));
+                break;
+            case opcode::Load:
+            {
+                auto size = operand & 0xff;
+                // As the program would see it, not with our int3s in
+                std::uint64_t value = 0;
+                proc.read_memory_without_traps(virtual_address{stack[top - 1]}, span<std::byte>{reinterpret_cast<std::byte*>(&value), size});
+                if ((operand & cSignedLoad) && size < 8)
+                {
+                    auto unused_bits = 64 - size * 8;
+                    value = static_cast<std::uint64_t>(static_cast<std::int64_t>(value << unused_bits) >> unused_bits);
+                }
+                stack[top - 1] = value;
+                break;
+            }
+            case opcode::Negate:
+                stack[top - 1] = -stack[top - 1];
+                break;
+            case opcode::LogicalNot:
+                stack[top - 1] = stack[top - 1] == 0;
+                break;
+            case opcode::Complement:
+                stack[top - 1] = ~stack[top - 1];
+                break;
+            case opcode::ToBool:
+                stack[top - 1] = stack[top - 1] != 0;
+                break;
+            case opcode::AndJump:
+                if (stack[top - 1] == 0)
+                {
+                    pc = operand - 1;
+                }
+                else
+                {
+                    --top;
+                }
+                break;
+            case opcode::OrJump:
+                if (stack[top - 1] != 0)
+                {
+                    pc = operand - 1;
+                }
+                else
+                {
+                    --top;
+                }
+                break;
+            default:
+            {
+                auto rhs = stack[--top];
+                auto& lhs = stack[top - 1];
+                switch (op)
+                {
+                    case opcode::Multiply: lhs *= rhs; break;
+                    case opcode::Divide:
+                    case opcode::Remainder:
+                        if (rhs == 0)
+                        {
+                            error::send(std::format("Division by zero in \"{}\"", source_));
+                        }
+                        lhs = op == opcode::Divide ? lhs / rhs : lhs % rhs;
+                        break;
+                    case opcode::Add: lhs += rhs; break;
+                    case opcode::Subtract: lhs -= rhs; break;
+                    case opcode::ShiftLeft: lhs = rhs < 64 ? lhs << rhs : 0; break;
+                    case opcode::ShiftRight: lhs = rhs < 64 ? lhs >> rhs : 0; break;
+                    case opcode::Less: lhs = lhs < rhs; break;
+                    case opcode::LessEqual: lhs = lhs <= rhs; break;
+                    case opcode::Greater: lhs = lhs > rhs; break;
+                    case opcode::GreaterEqual: lhs = lhs >= rhs; break;
+                    case opcode::Equal: lhs = lhs == rhs; break;
+                    case opcode::NotEqual: lhs = lhs != rhs; break;
+                    case opcode::BitAnd: lhs &= rhs; break;
+                    case opcode::BitXor: lhs ^= rhs; break;
+                    case opcode::BitOr: lhs |= rhs; break;
+                    default: std::unreachable();
+                }
+                break;
+            }
+        }
+    }
+
+    return stack[0];
+}
@@ -0,0 +1,206 @@
+#include <libsdb/fast_tracepoint.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/relocate.hpp>
+#include <libsdb/error.hpp>
+
+#include <cstring>
+#include <initializer_list>
+
+namespace
+{
+auto get_next_id() {
+    static sdb::fast_tracepoint::id_type id = 0;
+    return ++id;
+}
+
+constexpr std::size_t cJumpSize{5};
+
+void emit(std::vector<std::byte>& code, std::initializer_list<std::uint8_t> bytes)
+{
+    for (auto byte : bytes)
+    {
+        code.push_back(static_cast<std::byte>(byte));
+    }
+}
+
+template <typename T>
+void emit_value(std::vector<std::byte>& code, T value)
+{
+    auto bytes = reinterpret_cast<const std::byte*>(&value);
+    code.insert(code.end(), bytes, bytes + sizeof(value));
+}
+
+// mov [rcx + displacement], reg, for reg numbered as in ModRM, from 0 for rax to 15 for r15
+void emit_store(std::vector<std::byte>& code, std::uint8_t reg, std::int32_t displacement)
+{
+    auto is_short = displacement <= 127;
+    emit(code, {
+        static_cast<std::uint8_t>(0x48 | (reg >= 8 ? 0x04 : 0)),
+        0x89,
+        static_cast<std::uint8_t>((is_short ? 0x40 : 0x80) | ((reg & 7) << 3) | 0x01)});
+    if (is_short)
+    {
+        emit_value(code, static_cast<std::int8_t>(displacement));
+    }
+    else
+    {
+        emit_value(code, displacement);
+    }
+}
+
+void emit_jump(std::vector<std::byte>& code, sdb::virtual_address from, sdb::virtual_address to)
+{
+    emit(code, {0xe9});
+    emit_value(code, static_cast<std::int32_t>(to.addr() - (from.addr() + cJumpSize)));
+}
+
+// Saves every register into the next slot of the ring, leaving them all as they were.
+// Threads reserve a slot with lock xadd, and write its sequence number last,
+// so sdb can tell a slot which is still being written from a finished one.
+std::vector<std::byte> record_registers(sdb::virtual_address ring, std::uint32_t slot_mask, sdb::virtual_address address)
+{
+    std::vector<std::byte> code;
+    emit(code, {0x48, 0x8d, 0x64, 0x24, 0x80}); // lea rsp, [rsp - 128], past the red zone
+    emit(code, {0x9c});                         // pushfq
+    emit(code, {0x50, 0x51, 0x52});             // push rax; push rcx; push rdx
+    emit(code, {0x48, 0xb8});                   // mov rax, ring
+    emit_value(code, ring.addr());
+    emit(code, {0xb9, 0x01, 0x00, 0x00, 0x00}); // mov ecx, 1
+    emit(code, {0xf0, 0x48, 0x0f, 0xc1, 0x08}); // lock xadd [rax], rcx
+    emit(code, {0x48, 0x89, 0xca});             // mov rdx, rcx
+    emit(code, {0x48, 0x81, 0xe1});             // and rcx, slot_mask
+    emit_value(code, slot_mask);
+    emit(code, {0x48, 0x69, 0xc9});             // imul rcx, rcx, sizeof(fast_trace_record)
+    emit_value(code, static_cast<std::uint32_t>(sizeof(sdb::fast_trace_record)));
+    emit(code, {0x48, 0x8d, 0x4c, 0x08});       // lea rcx, [rax + rcx + header size]
+    emit_value(code, static_cast<std::int8_t>(sdb::process::cFastTraceHeaderSize));
+
+    // Those we haven't used can be stored as they are
+    emit_store(code, 3, offsetof(sdb::fast_trace_record, rbx));
+    emit_store(code, 6, offsetof(sdb::fast_trace_record, rsi));
+    emit_store(code, 7, offsetof(sdb::fast_trace_record, rdi));
+    emit_store(code, 5, offsetof(sdb::fast_trace_record, rbp));
+    for (std::uint8_t reg = 8; reg < 16; ++reg)
+    {
+        emit_store(code, reg, offsetof(sdb::fast_trace_record, r8) + (reg - 8) * 8);
+    }
+
+    // The rest come from the stack, by way of rax
+    emit(code, {0x48, 0x8b, 0x44, 0x24, 0x10}); // mov rax, [rsp + 16]
+    emit_store(code, 0, offsetof(sdb::fast_trace_record, rax));
+    emit(code, {0x48, 0x8b, 0x44, 0x24, 0x08}); // mov rax, [rsp + 8]
+    emit_store(code, 0, offsetof(sdb::fast_trace_record, rcx));
+    emit(code, {0x48, 0x8b, 0x04, 0x24});       // mov rax, [rsp]
+    emit_store(code, 0, offsetof(sdb::fast_trace_record, rdx));
+    emit(code, {0x48, 0x8b, 0x44, 0x24, 0x18}); // mov rax, [rsp + 24]
+    emit_store(code, 0, offsetof(sdb::fast_trace_record, rflags));
+    emit(code, {0x48, 0x8d, 0x84, 0x24});       // lea rax, [rsp + 160], as it was before we came
+    emit_value(code, std::int32_t{160});
+    emit_store(code, 0, offsetof(sdb::fast_trace_record, rsp));
+    emit(code, {0x48, 0xb8});                   // mov rax, address
+    emit_value(code, address.addr());
+    emit_store(code, 0, offsetof(sdb::fast_trace_record, address));
+    emit(code, {0x48, 0x8d, 0x42, 0x01});       // lea rax, [rdx + 1]
+    emit_store(code, 0, offsetof(sdb::fast_trace_record, sequence));
+
+    emit(code, {0x5a, 0x59, 0x58});             // pop rdx; pop rcx; pop rax
+    emit(code, {0x9d});                         // popfq
+    emit(code, {0x48, 0x8d, 0xa4, 0x24});       // lea rsp, [rsp + 128]
+    emit_value(code, std::int32_t{128});
+    return code;
+}
+}
+
+sdb::fast_tracepoint::fast_tracepoint(process& proc, virtual_address address)
+    : process_{&proc}, address_{address}, is_enabled_{false}
+{
+    static constexpr std::size_t cMaxInstructionSize{15};
+    static constexpr std::size_t cTrampolineSize{512};
+
+    // Whole instructions, at least as long as the jump which replaces them. Check
+    // they can move before taking any of the inferior's memory for them.
+    auto code = process_->read_memory_without_traps(address, cJumpSize - 1 + cMaxInstructionSize);
+    std::size_t offset = 0;
+    while (offset < cJumpSize)
+    {
+        auto decoded = relocate_instruction({code.data() + offset, code.size() - offset}, address + offset, address + offset);
+        if (decoded.is_branch)
+        {
+            error::send(std::format("Can't move the branch at {:#x} for a fast tracepoint", (address + offset).addr()));
+        }
+        offset += decoded.length;
+    }
+
+    if (!process_->breakpoint_sites().get_in_region(address, address + offset).empty())
+    {
+        error::send(std::format("Fast tracepoint at {:#x} would replace a breakpoint site", address.addr()));
+    }
+
+    auto overlapping = process_->fast_tracepoints().get_in_region(address - (cJumpSize + cMaxInstructionSize), address + offset);
+    for (auto other : overlapping)
+    {
+        if (other->address() + other->saved_code_.size() > address)
+        {
+            error::send(std::format("Fast tracepoint at {:#x} overlaps another", address.addr()));
+        }
+    }
+
+    auto ring = process_->fast_trace_ring();
+    trampoline_ = process_->allocate_trampoline(address, cTrampolineSize);
+    auto trampoline = record_registers(ring, process::cFastTraceSlots - 1, address);
+    for (std::size_t moved = 0; moved < offset;)
+    {
+        auto relocated = relocate_instruction({code.data() + moved, code.size() - moved}, address + moved, trampoline_ + trampoline.size());
+        trampoline.insert(trampoline.end(), relocated.code.begin(), relocated.code.end());
+        moved += relocated.length;
+    }
+    emit_jump(trampoline, trampoline_ + trampoline.size(), address + offset);
+
+    saved_code_.assign(code.begin(), code.begin() + offset);
+    process_->write_memory(trampoline_, {trampoline.data(), trampoline.size()});
+    id_ = get_next_id();
+}
+
+sdb::fast_tracepoint::fast_tracepoint(process& proc, const fast_tracepoint& parent_point)
+    : id_{parent_point.id_}, process_{&proc}, address_{parent_point.address_}, is_enabled_{parent_point.is_enabled_},
+      saved_code_{parent_point.saved_code_}, trampoline_{parent_point.trampoline_}
+{
+}
+
+void sdb::fast_tracepoint::enable()
+{
+    if (is_enabled_)
+    {
+        return;
+    }
+
+    // A thread stopped partway through the replaced instructions would resume into the jump
+    for (auto& [tid, thread] : process_->threads())
+    {
+        auto pc = virtual_address{thread->get_registers().read_by_id_as<std::uint64_t>(register_id::rip)};
+        if (pc > address_ && pc < address_ + saved_code_.size())
+        {
+            error::send(std::format("Thread {} is within the instructions at {:#x}", tid, address_.addr()));
+        }
+    }
+
+    // Any bytes after the jump trap, rather than run part of an instruction
+    std::vector<std::byte> jump;
+    emit_jump(jump, address_, trampoline_);
+    jump.resize(saved_code_.size(), std::byte{0xcc});
+    process_->write_hidden_memory(address_, {jump.data(), jump.size()});
+
+    is_enabled_ = true;
+}
+
+void sdb::fast_tracepoint::disable()
+{
+    if (!is_enabled_)
+    {
+        return;
+    }
+
+    // Threads already in the trampoline still jump back to the right place
+    process_->write_hidden_memory(address_, {saved_code_.data(), saved_code_.size()});
+    is_enabled_ = false;
+}
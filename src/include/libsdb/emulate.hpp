@@ -0,0 +1,20 @@
+#pragma once
+
+#include <libsdb/breakpoint_site.hpp>
+#include <libsdb/types.hpp>
+
+#include <optional>
+
+namespace sdb
+{
+class process;
+class registers;
+
+// Decodes the instruction at the start of code, if it is one we can emulate
+std::optional<emulated_instruction> decode_emulated(span<const std::byte> code);
+
+// Carries out the instruction at address for the thread whose registers these
+// are, leaving rip after it. Returns false, having changed nothing, if it
+// would write memory we can't, or which a watchpoint covers.
+bool emulate(const emulated_instruction& instruction, virtual_address address, registers& regs, process& proc);
+}
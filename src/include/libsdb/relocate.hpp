@@ -0,0 +1,29 @@
+#pragma once
+
+#include <libsdb/types.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace sdb
+{
+// An instruction copied to run at another address
+struct relocated_instruction
+{
+    std::vector<std::byte> code; // To run at the new address
+    std::size_t length;          // Of the original, which code matches
+    bool is_branch;              // Any jump, call, return, system call or interrupt
+    bool is_relative_branch;     // A jump or call to an offset from rip
+    std::int64_t branch_offset;  // From the end of the original instruction, if relative
+    bool is_call;
+    bool is_return;
+    bool is_syscall;
+};
+
+// Decodes the instruction at the start of code, which runs at from, and fixes
+// up any rip-relative operand to reach the same address from to. Short jumps
+// become their rel32 forms, so code may be longer than the original. Throws
+// if it doesn't decode, the operand no longer reaches, or it is a loop or
+// jrcxz, which have only rel8 forms. With to the same as from, it just decodes.
+relocated_instruction relocate_instruction(span<const std::byte> code, virtual_address from, virtual_address to);
+}
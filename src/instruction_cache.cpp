@@ -0,0 +1,189 @@
+#include <libsdb/instruction_cache.hpp>
+
+#include <Zydis/Zydis.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+
+namespace
+{
+constexpr std::size_t cMaxInstructionSize{15};
+
+bool decode(const std::byte* code, std::size_t size, ZydisDecodedInstruction& instruction, ZydisDecodedOperand* operands)
+{
+    ZydisDecoder decoder;
+    ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64);
+    return ZYAN_SUCCESS(ZydisDecoderDecodeFull(&decoder, code, size, &instruction, operands));
+}
+
+// Zydis names registers as we do, though we lack some, such as the segment registers
+std::optional<sdb::register_id> to_register_id(ZydisRegister reg)
+{
+    if (reg == ZYDIS_REGISTER_NONE)
+    {
+        return std::nullopt;
+    }
+
+    std::string_view name = ZydisRegisterGetString(reg);
+    auto info = std::find_if(std::begin(sdb::g_register_infos), std::end(sdb::g_register_infos),
+                             [name](auto& i) { return i.name == name; });
+    if (info == std::end(sdb::g_register_infos))
+    {
+        return std::nullopt;
+    }
+    return info->id;
+}
+
+sdb::control_flow to_control_flow(ZydisInstructionCategory category)
+{
+    switch (category)
+    {
+        case ZYDIS_CATEGORY_UNCOND_BR:
+            return sdb::control_flow::Jump;
+        case ZYDIS_CATEGORY_COND_BR:
+            return sdb::control_flow::ConditionalJump;
+        case ZYDIS_CATEGORY_CALL:
+            return sdb::control_flow::Call;
+        case ZYDIS_CATEGORY_RET:
+            return sdb::control_flow::Return;
+        case ZYDIS_CATEGORY_SYSCALL:
+        case ZYDIS_CATEGORY_SYSRET:
+            return sdb::control_flow::Syscall;
+        case ZYDIS_CATEGORY_INTERRUPT:
+            return sdb::control_flow::Interrupt;
+        default:
+            return sdb::control_flow::Sequential;
+    }
+}
+}
+
+const std::string& sdb::decoded_instruction::text() const
+{
+    if (!text_)
+    {
+        ZydisDecodedInstruction instruction;
+        ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+        decode(bytes.data(), length, instruction, operands);
+
+        ZydisFormatter formatter;
+        ZydisFormatterInit(&formatter, ZYDIS_FORMATTER_STYLE_ATT);
+
+        char buffer[256];
+        ZydisFormatterFormatInstruction(&formatter, &instruction, operands, instruction.operand_count_visible,
+                                        buffer, sizeof(buffer), address.addr(), ZYAN_NULL);
+        text_ = buffer;
+    }
+
+    return *text_;
+}
+
+const sdb::decoded_instruction* sdb::instruction_cache::find(virtual_address address) const
+{
+    if (auto it = instructions_.find(address.addr()); it != instructions_.end())
+    {
+        return &it->second;
+    }
+    auto it = volatile_instructions_.find(address.addr());
+    return it == volatile_instructions_.end() ? nullptr : &it->second;
+}
+
+const sdb::decoded_instruction* sdb::instruction_cache::insert(virtual_address address, span<const std::byte> code, bool is_volatile)
+{
+    ZydisDecodedInstruction instruction;
+    ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+    if (!decode(code.begin(), code.size(), instruction, operands))
+    {
+        return nullptr;
+    }
+
+    decoded_instruction result{};
+    result.address = address;
+    result.length = instruction.length;
+    std::memcpy(result.bytes.data(), code.begin(), instruction.length);
+    result.flow = to_control_flow(instruction.meta.category);
+
+    for (std::size_t i = 0; i < instruction.operand_count; ++i)
+    {
+        auto& operand = operands[i];
+        if (operand.type == ZYDIS_OPERAND_TYPE_IMMEDIATE && operand.imm.is_relative && result.flow != control_flow::Sequential)
+        {
+            ZyanU64 target;
+            if (ZYAN_SUCCESS(ZydisCalcAbsoluteAddress(&instruction, &operand, address.addr(), &target)))
+            {
+                result.target = virtual_address{target};
+            }
+        }
+        else if (operand.type == ZYDIS_OPERAND_TYPE_MEMORY && operand.mem.type != ZYDIS_MEMOP_TYPE_AGEN)
+        {
+            result.memory_operands.push_back(memory_operand{
+                to_register_id(operand.mem.base),
+                to_register_id(operand.mem.index),
+                operand.mem.scale,
+                operand.mem.disp.value,
+                static_cast<std::size_t>(operand.size / 8),
+                (operand.actions & ZYDIS_OPERAND_ACTION_MASK_READ) != 0,
+                (operand.actions & ZYDIS_OPERAND_ACTION_MASK_WRITE) != 0});
+        }
+    }
+
+    (is_volatile ? instructions_ : volatile_instructions_).erase(address.addr());
+    auto& instructions = is_volatile ? volatile_instructions_ : instructions_;
+    return &instructions.insert_or_assign(address.addr(), std::move(result)).first->second;
+}
+
+std::vector<const sdb::decoded_instruction*> sdb::instruction_cache::decode(virtual_address address, std::size_t count, const code_reader& read)
+{
+    std::vector<const decoded_instruction*> result;
+    result.reserve(count);
+
+    // Read on the first miss, enough for every instruction still to decode
+    code_read code{};
+    virtual_address code_address;
+    while (result.size() < count)
+    {
+        auto instruction = find(address);
+        if (!instruction)
+        {
+            if (address < code_address || address + cMaxInstructionSize > code_address + code.code.size())
+            {
+                code = read(address, (count - result.size()) * cMaxInstructionSize);
+                code_address = address;
+            }
+
+            auto offset = address.addr() - code_address.addr();
+            instruction = insert(address, {code.code.begin() + offset, code.code.end()}, code.is_volatile);
+            if (!instruction)
+            {
+                break;
+            }
+        }
+
+        result.push_back(instruction);
+        address += instruction->length;
+    }
+
+    return result;
+}
+
+void sdb::instruction_cache::invalidate(virtual_address address, std::size_t size)
+{
+    // An instruction starting up to 14 bytes before address may run into it
+    auto low = address.addr() < cMaxInstructionSize ? 0 : address.addr() - (cMaxInstructionSize - 1);
+    for (auto instructions : {&instructions_, &volatile_instructions_})
+    {
+        auto it = instructions->lower_bound(low);
+        while (it != instructions->end() && it->first < address.addr() + size)
+        {
+            if (it->first + it->second.length > address.addr())
+            {
+                it = instructions->erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+}
@@ -0,0 +1,216 @@
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/error.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <utility>
+
+namespace
+{
+constexpr char cMagic[8] = {'S', 'D', 'B', 'I', 'T', 'R', 'A', 'C'};
+constexpr std::size_t cBufferSize{1 << 16};
+constexpr std::size_t cFieldCount{sizeof(user_regs_struct) / 8};
+constexpr std::size_t cRipField{offsetof(user_regs_struct, rip) / 8};
+
+std::uint64_t zigzag(std::int64_t value)
+{
+    return (static_cast<std::uint64_t>(value) << 1) ^ static_cast<std::uint64_t>(value >> 63);
+}
+
+std::int64_t unzigzag(std::uint64_t value)
+{
+    return static_cast<std::int64_t>(value >> 1) ^ -static_cast<std::int64_t>(value & 1);
+}
+
+std::uint64_t* fields(user_regs_struct& gprs)
+{
+    return reinterpret_cast<std::uint64_t*>(&gprs);
+}
+
+const std::uint64_t* fields(const user_regs_struct& gprs)
+{
+    return reinterpret_cast<const std::uint64_t*>(&gprs);
+}
+}
+
+sdb::instruction_trace_writer::instruction_trace_writer(const std::filesystem::path& path, bool record_registers)
+    : record_registers_{record_registers}
+{
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        error::send_errno(std::format("Could not open instruction trace {}", path.string()));
+    }
+
+    buffer_.reserve(cBufferSize);
+    buffer_.insert(buffer_.end(), cMagic, cMagic + sizeof(cMagic));
+    std::uint32_t header[2] = {cVersion, record_registers ? 1u : 0u};
+    auto header_bytes = reinterpret_cast<const std::uint8_t*>(header);
+    buffer_.insert(buffer_.end(), header_bytes, header_bytes + sizeof(header));
+}
+
+sdb::instruction_trace_writer::~instruction_trace_writer()
+{
+    try
+    {
+        flush();
+    }
+    catch (const error&)
+    {
+        // Nothing sensible to do with a failure while closing
+    }
+    close(fd_);
+}
+
+void sdb::instruction_trace_writer::record(const user_regs_struct& gprs)
+{
+    // Most instructions fall through to the next, so the delta fits a byte
+    auto pc_delta = zigzag(static_cast<std::int64_t>(gprs.rip - previous_.rip));
+
+    std::uint64_t changed = 0;
+    if (record_registers_)
+    {
+        auto now = fields(gprs);
+        auto before = fields(previous_);
+        for (std::size_t i = 0; i < cFieldCount; ++i)
+        {
+            if (i != cRipField && now[i] != before[i])
+            {
+                changed |= std::uint64_t{1} << i;
+            }
+        }
+    }
+
+    put_varint(pc_delta << 1 | (changed != 0));
+    if (changed != 0)
+    {
+        put_varint(changed);
+        auto now = fields(gprs);
+        auto before = fields(previous_);
+        for (std::size_t i = 0; i < cFieldCount; ++i)
+        {
+            if (changed & (std::uint64_t{1} << i))
+            {
+                put_varint(zigzag(static_cast<std::int64_t>(now[i] - before[i])));
+            }
+        }
+    }
+
+    if (record_registers_)
+    {
+        previous_ = gprs;
+    }
+    else
+    {
+        previous_.rip = gprs.rip;
+    }
+
+    ++size_;
+    // Leaving room for the largest record
+    if (buffer_.size() + 10 * (cFieldCount + 1) > cBufferSize)
+    {
+        flush();
+    }
+}
+
+void sdb::instruction_trace_writer::put_varint(std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        buffer_.push_back(static_cast<std::uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    buffer_.push_back(static_cast<std::uint8_t>(value));
+}
+
+void sdb::instruction_trace_writer::flush()
+{
+    std::size_t written = 0;
+    while (written < buffer_.size())
+    {
+        auto result = write(fd_, buffer_.data() + written, buffer_.size() - written);
+        if (result < 0)
+        {
+            error::send_errno("Could not write instruction trace");
+        }
+        written += result;
+    }
+
+    buffer_.clear();
+}
+
+sdb::instruction_trace_reader::instruction_trace_reader(const std::filesystem::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        error::send(std::format("Could not open instruction trace {}", path.string()));
+    }
+    data_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+    std::uint32_t header[2];
+    if (data_.size() < instruction_trace_writer::cHeaderSize || std::memcmp(data_.data(), cMagic, sizeof(cMagic)) != 0)
+    {
+        error::send(std::format("{} is not an instruction trace", path.string()));
+    }
+    std::memcpy(header, data_.data() + sizeof(cMagic), sizeof(header));
+    if (header[0] != instruction_trace_writer::cVersion)
+    {
+        error::send(std::format("Unsupported instruction trace version {}", header[0]));
+    }
+
+    record_registers_ = header[1] & 1;
+    position_ = instruction_trace_writer::cHeaderSize;
+}
+
+std::optional<sdb::instruction_trace_entry> sdb::instruction_trace_reader::next()
+{
+    if (position_ == data_.size())
+    {
+        return std::nullopt;
+    }
+
+    auto first = get_varint();
+    current_.pc += unzigzag(first >> 1);
+    current_.gprs.rip = current_.pc;
+    if (first & 1)
+    {
+        auto changed = get_varint();
+        auto now = fields(current_.gprs);
+        for (std::size_t i = 0; i < cFieldCount; ++i)
+        {
+            if (changed & (std::uint64_t{1} << i))
+            {
+                now[i] += unzigzag(get_varint());
+            }
+        }
+    }
+
+    return current_;
+}
+
+std::uint64_t sdb::instruction_trace_reader::get_varint()
+{
+    std::uint64_t value = 0;
+    for (auto shift = 0; shift < 64; shift += 7)
+    {
+        if (position_ == data_.size())
+        {
+            error::send("Instruction trace ends partway through a record");
+        }
+
+        auto byte = data_[position_++];
+        value |= std::uint64_t{byte & 0x7fu} << shift;
+        if (!(byte & 0x80))
+        {
+            return value;
+        }
+    }
+
+    error::send("Instruction trace has an overlong varint");
+    std::unreachable();
+}
@@ -0,0 +1,558 @@
+#include <libsdb/line_table.hpp>
+#include <libsdb/error.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <tuple>
+
+namespace
+{
+constexpr std::uint8_t cLineCopy{1};
+constexpr std::uint8_t cLineAdvancePc{2};
+constexpr std::uint8_t cLineAdvanceLine{3};
+constexpr std::uint8_t cLineSetFile{4};
+constexpr std::uint8_t cLineSetColumn{5};
+constexpr std::uint8_t cLineNegateStmt{6};
+constexpr std::uint8_t cLineSetBasicBlock{7};
+constexpr std::uint8_t cLineConstAddPc{8};
+constexpr std::uint8_t cLineFixedAdvancePc{9};
+
+constexpr std::uint8_t cLineEndSequence{1};
+constexpr std::uint8_t cLineSetAddress{2};
+
+constexpr std::uint64_t cContentPath{1};
+constexpr std::uint64_t cContentDirectoryIndex{2};
+
+constexpr std::uint64_t cFormBlock{0x09};
+constexpr std::uint64_t cFormData1{0x0b};
+constexpr std::uint64_t cFormData2{0x05};
+constexpr std::uint64_t cFormData4{0x06};
+constexpr std::uint64_t cFormData8{0x07};
+constexpr std::uint64_t cFormData16{0x1e};
+constexpr std::uint64_t cFormString{0x08};
+constexpr std::uint64_t cFormStrp{0x0e};
+constexpr std::uint64_t cFormLineStrp{0x1f};
+constexpr std::uint64_t cFormUdata{0x0f};
+
+// Reads the little endian encodings DWARF uses, throwing rather than running off the end
+class cursor
+{
+public:
+    explicit cursor(sdb::span<const std::byte> data) : position_{data.begin()}, end_{data.end()} {}
+
+    const std::byte* position() const { return position_; }
+    std::size_t remaining() const { return end_ - position_; }
+    bool finished() const { return position_ >= end_; }
+
+    void skip(std::size_t size)
+    {
+        check(size);
+        position_ += size;
+    }
+
+    template <typename T>
+    T fixed()
+    {
+        check(sizeof(T));
+        T value;
+        std::memcpy(&value, position_, sizeof(T));
+        position_ += sizeof(T);
+        return value;
+    }
+
+    std::uint64_t fixed_of_size(std::size_t size)
+    {
+        check(size);
+        std::uint64_t value = 0;
+        std::memcpy(&value, position_, std::min<std::size_t>(size, sizeof(value)));
+        position_ += size;
+        return value;
+    }
+
+    std::uint64_t uleb128()
+    {
+        std::uint64_t value = 0;
+        for (unsigned shift = 0; ; shift += 7)
+        {
+            auto byte = fixed<std::uint8_t>();
+            if (shift < 64)
+            {
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            }
+            if ((byte & 0x80) == 0)
+            {
+                return value;
+            }
+        }
+    }
+
+    std::int64_t sleb128()
+    {
+        std::uint64_t value = 0;
+        unsigned shift = 0;
+        std::uint8_t byte;
+        do
+        {
+            byte = fixed<std::uint8_t>();
+            if (shift < 64)
+            {
+                value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            }
+            shift += 7;
+        } while (byte & 0x80);
+
+        if (shift < 64 && (byte & 0x40))
+        {
+            value |= ~std::uint64_t{0} << shift;
+        }
+        return static_cast<std::int64_t>(value);
+    }
+
+    std::string_view string()
+    {
+        auto start = reinterpret_cast<const char*>(position_);
+        auto length = strnlen(start, remaining());
+        skip(length + 1);
+        return {start, length};
+    }
+
+private:
+    void check(std::size_t size) const
+    {
+        if (remaining() < size)
+        {
+            sdb::error::send("Line table runs past the end of .debug_line");
+        }
+    }
+
+    const std::byte* position_;
+    const std::byte* end_;
+};
+
+std::string_view string_at(sdb::span<const std::byte> section, std::uint64_t offset)
+{
+    if (offset >= section.size())
+    {
+        sdb::error::send("Line table file name is outside its string section");
+    }
+
+    auto start = reinterpret_cast<const char*>(section.begin() + offset);
+    return {start, strnlen(start, section.size() - offset)};
+}
+
+std::string join_path(std::string_view directory, std::string_view name)
+{
+    if (directory.empty() || name.starts_with('/'))
+    {
+        return std::string{name};
+    }
+    return std::string{directory} + (directory.ends_with('/') ? "" : "/") + std::string{name};
+}
+
+// So main.cpp, src/main.cpp and the full path all match /home/me/src/main.cpp
+bool path_matches(std::string_view file, std::string_view path)
+{
+    return file == path || (file.ends_with(path) && path.size() < file.size() && file[file.size() - path.size() - 1] == '/');
+}
+}
+
+sdb::line_table::line_table(span<const std::byte> debug_line, span<const std::byte> debug_line_str, span<const std::byte> debug_str)
+    : debug_line_str_{debug_line_str}, debug_str_{debug_str}
+{
+    // Only the lengths, so finding the units costs next to nothing
+    cursor data(debug_line);
+    while (data.remaining() >= sizeof(std::uint32_t))
+    {
+        auto start = data.position();
+        std::size_t offset_size = 4;
+        std::uint64_t length = data.fixed<std::uint32_t>();
+        if (length == 0xffffffff)
+        {
+            if (data.remaining() < sizeof(std::uint64_t))
+            {
+                break;
+            }
+            offset_size = 8;
+            length = data.fixed<std::uint64_t>();
+        }
+        if (length > data.remaining())
+        {
+            break;
+        }
+
+        auto& u = units_.emplace_back(&arena_);
+        u.data = {start, data.position() + length};
+        u.offset_size = offset_size;
+        data.skip(length);
+    }
+}
+
+void sdb::line_table::read_header(unit& u) const
+{
+    cursor data(u.data);
+    data.skip(u.offset_size == 8 ? 12 : 4);
+
+    u.version = data.fixed<std::uint16_t>();
+    if (u.version < 2 || u.version > 5)
+    {
+        error::send(std::format("Unsupported line table version {}", u.version));
+    }
+    if (u.version >= 5)
+    {
+        u.address_size = data.fixed<std::uint8_t>();
+        data.skip(1); // Segment selector size
+    }
+
+    auto header_length = data.fixed_of_size(u.offset_size);
+    if (header_length > data.remaining())
+    {
+        error::send("Line table header runs past the end of its unit");
+    }
+    auto program_start = data.position() + header_length;
+
+    u.minimum_instruction_length = data.fixed<std::uint8_t>();
+    if (u.version >= 4)
+    {
+        data.skip(1); // Maximum operations per instruction, only for VLIW
+    }
+    u.default_is_stmt = data.fixed<std::uint8_t>() != 0;
+    u.line_base = data.fixed<std::int8_t>();
+    u.line_range = data.fixed<std::uint8_t>();
+    u.opcode_base = data.fixed<std::uint8_t>();
+    if (u.line_range == 0 || u.opcode_base == 0)
+    {
+        error::send("Line table header has a zero line range or opcode base");
+    }
+    u.standard_opcode_lengths = {data.position(), u.opcode_base - 1u};
+    data.skip(u.opcode_base - 1u);
+
+    std::vector<std::string_view> directories;
+    if (u.version < 5)
+    {
+        // Directory and file 0 are the compilation's own, which only .debug_info names
+        directories.push_back({});
+        for (auto directory = data.string(); !directory.empty(); directory = data.string())
+        {
+            directories.push_back(directory);
+        }
+
+        u.files.emplace_back();
+        for (auto name = data.string(); !name.empty(); name = data.string())
+        {
+            auto directory = data.uleb128();
+            data.uleb128(); // Modification time
+            data.uleb128(); // Length
+            u.files.emplace_back(join_path(directory < directories.size() ? directories[directory] : "", name));
+        }
+    }
+    else
+    {
+        // Each entry is a list of fields, described by a format before the entries
+        auto read_entries = [&](auto&& on_entry) {
+            std::vector<std::pair<std::uint64_t, std::uint64_t>> format(data.fixed<std::uint8_t>());
+            for (auto& [content, form] : format)
+            {
+                content = data.uleb128();
+                form = data.uleb128();
+            }
+
+            auto count = data.uleb128();
+            for (std::uint64_t i = 0; i < count; ++i)
+            {
+                std::string_view path;
+                std::uint64_t directory = 0;
+                for (auto [content, form] : format)
+                {
+                    std::string_view text;
+                    std::uint64_t value = 0;
+                    switch (form)
+                    {
+                        case cFormString: text = data.string(); break;
+                        case cFormLineStrp: text = string_at(debug_line_str_, data.fixed_of_size(u.offset_size)); break;
+                        case cFormStrp: text = string_at(debug_str_, data.fixed_of_size(u.offset_size)); break;
+                        case cFormUdata: value = data.uleb128(); break;
+                        case cFormData1: value = data.fixed_of_size(1); break;
+                        case cFormData2: value = data.fixed_of_size(2); break;
+                        case cFormData4: value = data.fixed_of_size(4); break;
+                        case cFormData8: value = data.fixed_of_size(8); break;
+                        case cFormData16: data.skip(16); break;
+                        case cFormBlock: data.skip(data.uleb128()); break;
+                        default:
+                            error::send(std::format("Unsupported form {:#x} in line table header", form));
+                    }
+
+                    if (content == cContentPath)
+                    {
+                        path = text;
+                    }
+                    else if (content == cContentDirectoryIndex)
+                    {
+                        directory = value;
+                    }
+                }
+                on_entry(path, directory);
+            }
+        };
+
+        read_entries([&](auto path, auto) { directories.push_back(path); });
+        read_entries([&](auto path, auto directory) {
+            u.files.emplace_back(join_path(directory < directories.size() ? directories[directory] : "", path));
+        });
+    }
+
+    u.program = {program_start, u.data.end()};
+    u.is_read = true;
+}
+
+void sdb::line_table::decode(unit& u) const
+{
+    if (!u.is_read)
+    {
+        read_header(u);
+    }
+
+    // Built up on the heap, then copied into the arena at exactly its size
+    std::vector<row> rows;
+    std::size_t sequence_start = 0;
+
+    std::uint64_t address = 0;
+    std::uint32_t file = 1;
+    std::int64_t line = 1;
+    bool is_stmt = u.default_is_stmt;
+    auto emit = [&](bool end_sequence) {
+        rows.push_back({address, file, static_cast<std::uint32_t>(line), is_stmt, end_sequence});
+    };
+
+    cursor program(u.program);
+    while (!program.finished())
+    {
+        auto opcode = program.fixed<std::uint8_t>();
+        if (opcode >= u.opcode_base)
+        {
+            // Special opcodes advance both address and line, then add a row
+            auto adjusted = opcode - u.opcode_base;
+            address += (adjusted / u.line_range) * u.minimum_instruction_length;
+            line += u.line_base + adjusted % u.line_range;
+            emit(false);
+            continue;
+        }
+
+        switch (opcode)
+        {
+            case 0:
+            {
+                auto length = program.uleb128();
+                if (length == 0)
+                {
+                    break;
+                }
+
+                auto extended_start = program.position();
+                auto extended = program.fixed<std::uint8_t>();
+                if (extended == cLineEndSequence)
+                {
+                    emit(true);
+                    // The linker leaves code it discarded at 0 or -1, which would cover real code
+                    auto start = rows[sequence_start].address;
+                    if (start == 0 || start == std::numeric_limits<std::uint64_t>::max())
+                    {
+                        rows.resize(sequence_start);
+                    }
+                    sequence_start = rows.size();
+
+                    address = 0;
+                    file = 1;
+                    line = 1;
+                    is_stmt = u.default_is_stmt;
+                }
+                else if (extended == cLineSetAddress)
+                {
+                    address = program.fixed_of_size(length - 1);
+                }
+
+                // Anything else, such as discriminators, we have no use for
+                auto read = static_cast<std::size_t>(program.position() - extended_start);
+                program.skip(length - std::min<std::uint64_t>(length, read));
+                break;
+            }
+            case cLineCopy:
+                emit(false);
+                break;
+            case cLineAdvancePc:
+                address += program.uleb128() * u.minimum_instruction_length;
+                break;
+            case cLineAdvanceLine:
+                line += program.sleb128();
+                break;
+            case cLineSetFile:
+                file = program.uleb128();
+                break;
+            case cLineSetColumn:
+                program.uleb128();
+                break;
+            case cLineNegateStmt:
+                is_stmt = !is_stmt;
+                break;
+            case cLineSetBasicBlock:
+                break;
+            case cLineConstAddPc:
+                address += ((255 - u.opcode_base) / u.line_range) * u.minimum_instruction_length;
+                break;
+            case cLineFixedAdvancePc:
+                address += program.fixed<std::uint16_t>();
+                break;
+            default:
+                // Those we don't know, as the header says how many operands they have
+                for (auto i = 0; i < std::to_integer<int>(u.standard_opcode_lengths[opcode - 1]); ++i)
+                {
+                    program.uleb128();
+                }
+                break;
+        }
+    }
+    // A program must end its last sequence, so any rows after it aren't code
+    rows.resize(sequence_start);
+
+    // A sequence may start where another ends, so its end comes first
+    std::stable_sort(rows.begin(), rows.end(), [](auto& lhs, auto& rhs) {
+        return lhs.address < rhs.address || (lhs.address == rhs.address && lhs.end_sequence && !rhs.end_sequence);
+    });
+
+    std::vector<line_address> by_line;
+    for (auto& r : rows)
+    {
+        if (r.is_stmt && !r.end_sequence)
+        {
+            by_line.push_back({r.file, r.line, r.address});
+        }
+    }
+    std::sort(by_line.begin(), by_line.end(), [](auto& lhs, auto& rhs) {
+        return std::tie(lhs.file, lhs.line, lhs.address) < std::tie(rhs.file, rhs.line, rhs.address);
+    });
+
+    u.rows.assign(rows.begin(), rows.end());
+    u.by_line.assign(by_line.begin(), by_line.end());
+    if (!rows.empty())
+    {
+        u.low = rows.front().address;
+        u.high = rows.back().address;
+    }
+    u.is_decoded = true;
+    ++decoded_count_;
+}
+
+std::optional<sdb::source_location> sdb::line_table::find_in(const unit& u, std::uint64_t address) const
+{
+    if (address < u.low || address >= u.high)
+    {
+        return std::nullopt;
+    }
+
+    // The last row at or before address, which is its sequence's end if address is in a gap
+    auto it = std::upper_bound(u.rows.begin(), u.rows.end(), address, [](auto address, auto& r) {
+        return address < r.address;
+    });
+    if (it == u.rows.begin() || std::prev(it)->end_sequence)
+    {
+        return std::nullopt;
+    }
+
+    auto& r = *std::prev(it);
+    std::string_view file = r.file < u.files.size() ? std::string_view{u.files[r.file]} : std::string_view{};
+    return source_location{file, r.line};
+}
+
+std::optional<sdb::source_location> sdb::line_table::get_location(virtual_address address) const
+{
+    for (auto& u : units_)
+    {
+        if (u.is_decoded)
+        {
+            if (auto location = find_in(u, address.addr()))
+            {
+                return location;
+            }
+        }
+    }
+
+    // Then decode the rest in order until one covers address, which only
+    // decodes them all when it isn't in any
+    while (next_to_decode_ < units_.size())
+    {
+        auto& u = units_[next_to_decode_++];
+        if (u.is_decoded)
+        {
+            continue;
+        }
+
+        decode(u);
+        if (auto location = find_in(u, address.addr()))
+        {
+            return location;
+        }
+    }
+
+    return std::nullopt;
+}
+
+std::vector<sdb::virtual_address> sdb::line_table::get_addresses(std::string_view path, std::uint32_t line) const
+{
+    // The nearest line with code in each unit, as a header may be in many
+    std::vector<line_address> found;
+    for (auto& u : units_)
+    {
+        if (!u.is_read)
+        {
+            read_header(u);
+        }
+
+        std::optional<line_address> best;
+        for (std::uint32_t file = 0; file < u.files.size(); ++file)
+        {
+            if (!path_matches(u.files[file], path))
+            {
+                continue;
+            }
+
+            if (!u.is_decoded)
+            {
+                decode(u);
+            }
+
+            auto it = std::lower_bound(u.by_line.begin(), u.by_line.end(), line_address{file, line, 0}, [](auto& lhs, auto& rhs) {
+                return std::tie(lhs.file, lhs.line, lhs.address) < std::tie(rhs.file, rhs.line, rhs.address);
+            });
+            if (it != u.by_line.end() && it->file == file
+                && (!best || std::tie(it->line, it->address) < std::tie(best->line, best->address)))
+            {
+                best = *it;
+            }
+        }
+
+        if (best)
+        {
+            found.push_back(*best);
+        }
+    }
+
+    if (found.empty())
+    {
+        return {};
+    }
+
+    auto nearest = std::min_element(found.begin(), found.end(), [](auto& lhs, auto& rhs) { return lhs.line < rhs.line; })->line;
+    std::vector<virtual_address> addresses;
+    for (auto& candidate : found)
+    {
+        if (candidate.line == nearest)
+        {
+            addresses.push_back(virtual_address{candidate.address});
+        }
+    }
+    std::sort(addresses.begin(), addresses.end());
+    addresses.erase(std::unique(addresses.begin(), addresses.end()), addresses.end());
+    return addresses;
+}
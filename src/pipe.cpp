@@ -60,16 +60,16 @@ int sdb::pipe::release_write()
 
 void sdb::pipe::close_read()
 {
-    if (fds_[cReadFd])
+    if (fds_[cReadFd] != -1)
     {
-        close(fds_[cReadFd]);
+        close(std::exchange(fds_[cReadFd], -1));
     }
 }
 
 void sdb::pipe::close_write()
 {
-    if (fds_[cWriteFd])
+    if (fds_[cWriteFd] != -1)
     {
-        close(fds_[cWriteFd]);
+        close(std::exchange(fds_[cWriteFd], -1));
     }
 }
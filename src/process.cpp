@@ -1,52 +1,52 @@
 #include <libsdb/process.hpp>
 
 #include <libsdb/bit.hpp>
+#include <libsdb/emulate.hpp>
 #include <libsdb/error.hpp>
 #include <libsdb/pipe.hpp>
+#include <libsdb/relocate.hpp>
 
+#include <sys/mman.h>
 #include <sys/personality.h>
 #include <sys/ptrace.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
+#include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <format>
+#include <fstream>
 #include <print>
+#include <type_traits>
+#include <variant>
 
 namespace
 {
+constexpr std::size_t cMaxInstructionSize{15};
+
 void exit_with_perror(sdb::pipe& channel, const std::string& prefix)
 {
     auto message = std::format("{}: {}", prefix, std::strerror(errno));
     channel.write(reinterpret_cast<std::byte*>(message.data()), message.size());
     exit(-1);
 }
-}
-
-sdb::stop_reason::stop_reason(int wait_status)
-{
-    if (WIFEXITED(wait_status))
-    {
-        reason = process_state::Exited;
-        info = WEXITSTATUS(wait_status);
-    }
-    else if (WIFSIGNALED(wait_status))
-    {
-        reason = process_state::Terminated;
-        info = WTERMSIG(wait_status);
-    }
-    else if (WIFSTOPPED(wait_status))
-    {
-        reason = process_state::Stopped;
-        info = WSTOPSIG(wait_status);
-    }
 
+// Report exec as a ptrace event rather than with a SIGTRAP we can't distinguish from int3,
+// and automatically trace every new thread and process
+constexpr auto cAttachOptions{PTRACE_O_TRACEEXEC | PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEVFORKDONE};
+// If we launched the process it shouldn't outlive us
+constexpr auto cLaunchOptions{cAttachOptions | PTRACE_O_EXITKILL};
 }
 
-std::unique_ptr<sdb::process> sdb::process::launch(std::filesystem::path path, bool attach, std::optional<int> stdout_replacement)
+std::unique_ptr<sdb::process> sdb::process::launch(std::filesystem::path path, bool attach, std::optional<int> stdout_replacement, bool seize)
 {
     pipe channel(true); // We have to call pipe before we call fork()
+    pipe seized_channel(true); // When seizing, the child waits on this until we have seized it
     pid_t pid;
     if ((pid = fork()) < 0)
     {
@@ -57,10 +57,16 @@ std::unique_ptr<sdb::process> sdb::process::launch(std::filesystem::path path, b
     {
         // We are in the child process
         channel.close_read();
+        seized_channel.close_write();
 
         // Call before exec to disable Address Space Layout Randomisation
         personality(ADDR_NO_RANDOMIZE);
 
+        // The signal mask survives exec, and an event loop blocks SIGCHLD
+        sigset_t empty_mask;
+        sigemptyset(&empty_mask);
+        sigprocmask(SIG_SETMASK, &empty_mask, nullptr);
+
         if (stdout_replacement.has_value())
         {
             close(STDOUT_FILENO);
@@ -69,11 +75,17 @@ std::unique_ptr<sdb::process> sdb::process::launch(std::filesystem::path path, b
                 exit_with_perror(channel, "Failed to replace stdout");
             }
         }
-        if (attach && ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0)
+        if (attach && !seize && ptrace(PTRACE_TRACEME, 0, nullptr, nullptr) < 0)
         {
             exit_with_perror(channel, "Tracing failed");
         }
 
+        if (attach && seize)
+        {
+            // Returns once the parent closes its end of the pipe
+            seized_channel.read();
+        }
+
         if (execlp(path.c_str(), path.c_str(), nullptr) < 0)
         {
             exit_with_perror(channel, "Exec failed");
@@ -83,6 +95,18 @@ std::unique_ptr<sdb::process> sdb::process::launch(std::filesystem::path path, b
     {
         // We are in the parent process
         channel.close_write();
+        seized_channel.close_read();
+
+        if (attach && seize && ptrace(PTRACE_SEIZE, pid, nullptr, cLaunchOptions) < 0)
+        {
+            auto seize_errno = errno;
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+            errno = seize_errno;
+            error::send_errno("Could not seize launched process");
+        }
+        seized_channel.close_write();
+
         auto data = channel.read();
         channel.close_read();
 
@@ -95,264 +119,1869 @@ std::unique_ptr<sdb::process> sdb::process::launch(std::filesystem::path path, b
         }
     }
 
-    std::unique_ptr<process> proc{new process{pid, true, attach}};
+    std::unique_ptr<process> proc{new process{pid, true, attach, attach && seize}};
 
     if (attach)
     {
         proc->wait_on_signal();
+
+        if (!seize && ptrace(PTRACE_SETOPTIONS, pid, nullptr, cLaunchOptions) < 0)
+        {
+            error::send_errno("Could not set trace options");
+        }
+        proc->load_elf();
     }
 
     return proc;
 }
 
-std::unique_ptr<sdb::process> sdb::process::attach(pid_t pid)
+std::unique_ptr<sdb::process> sdb::process::attach(pid_t pid, bool seize)
 {
     if (pid == 0)
     {
         error::send(std::format("Received invalid pid {}", pid));
     }
 
-    if (ptrace(PTRACE_ATTACH, pid, nullptr, nullptr) < 0)
+    if (seize)
+    {
+        if (ptrace(PTRACE_SEIZE, pid, nullptr, cAttachOptions) < 0)
+        {
+            error::send_errno(std::format("Could not seize pid {}", pid));
+        }
+    }
+    else if (ptrace(PTRACE_ATTACH, pid, nullptr, nullptr) < 0)
     {
         error::send_errno(std::format("Could not attach to pid {}", pid));
     }
 
-    std::unique_ptr<process> proc{new process{pid, false, true}};
-    proc->wait_on_signal();
+    std::unique_ptr<process> proc{new process{pid, false, true, seize}};
+    proc->state_ = process_state::Running;
+    proc->attach_untraced_threads();
+    proc->state_ = process_state::Stopped;
+    proc->load_elf();
 
     return proc;
 }
 
-sdb::process::~process()
+void sdb::process::attach_untraced_threads()
 {
-    if (pid_ != 0)
+    // PTRACE_ATTACH sends the main thread SIGSTOP
+    current_thread().stop_requested_ = !is_seized_;
+
+    // Threads can be created while we attach, so repeat until we find no new ones
+    auto found_new_threads = true;
+    while (found_new_threads)
     {
-        int status;
-        if (is_attached_)
+        found_new_threads = false;
+        for (auto& entry : std::filesystem::directory_iterator(std::format("/proc/{}/task", pid_)))
         {
-            if (state_ == process_state::Running)
+            auto tid = std::stoi(entry.path().filename());
+            if (threads_.contains(tid))
             {
-                kill(pid_, SIGSTOP);
-                waitpid(pid_, &status, 0);
+                continue;
             }
 
-            ptrace(PTRACE_DETACH, pid_, nullptr, nullptr);
-            kill(pid_, SIGCONT);
+            auto traced = is_seized_
+                ? ptrace(PTRACE_SEIZE, tid, nullptr, cAttachOptions) == 0
+                : ptrace(PTRACE_ATTACH, tid, nullptr, nullptr) == 0;
+            if (!traced)
+            {
+                continue; // It has probably already exited
+            }
+
+            auto& new_thread = add_thread(tid);
+            new_thread.stop_requested_ = !is_seized_;
+            found_new_threads = true;
         }
 
-        if (terminate_on_end_)
+        stop_all_threads();
+
+        if (!is_seized_)
         {
-            kill(pid_, SIGKILL);
-            waitpid(pid_, &status, 0);
+            // Without PTRACE_SEIZE we can only set options once each thread stops
+            for (auto& [tid, thread] : threads_)
+            {
+                ptrace(PTRACE_SETOPTIONS, tid, nullptr, cAttachOptions);
+            }
         }
     }
 }
 
-void sdb::process::resume()
+sdb::process::~process()
 {
-    auto program_counter = get_program_counter();
-    if (breakpoint_sites_.enabled_stoppoint_at_address(program_counter))
+    release_vfork_parent();
+
+    if (memory_fd_ >= 0)
     {
-        auto& breakpoint = breakpoint_sites_.get_by_address(program_counter);
-        breakpoint.disable();
+        close(memory_fd_);
+    }
+
+    if (pid_ == 0)
+    {
+        return;
+    }
+
+    int status;
+    if (is_attached_ && terminate_on_end_)
+    {
+        kill(pid_, SIGKILL);
+
+        // Traced threads must be reaped by us before the leader can be,
+        // including any new threads whose clone event we never handled
+        std::error_code ec; // The process may already have been reaped
+        for (auto& entry : std::filesystem::directory_iterator(std::format("/proc/{}/task", pid_), ec))
+        {
+            auto tid = std::stoi(entry.path().filename());
+            if (tid != pid_)
+            {
+                waitpid(tid, &status, __WALL);
+            }
+        }
+
+        waitpid(pid_, &status, __WALL);
+        return;
+    }
 
-        if (ptrace(PTRACE_SINGLESTEP, pid_, nullptr, nullptr) < 0)
+    if (is_attached_)
+    {
+        // Every thread must be in a ptrace stop for us to detach it
+        for (auto& [tid, thread] : threads_)
         {
-            error::send_errno("Could not single step");
+            if (thread->state_ == process_state::Running && thread->request_stop())
+            {
+                if (!take_unclaimed_wait_status(tid))
+                {
+                    waitpid(tid, &status, __WALL);
+                }
+                thread->state_ = process_state::Stopped;
+            }
         }
 
-        // Wait until the process has executed the single instruction
-        int wait_status;
-        if (waitpid(pid_, &wait_status, 0) < 0)
+        for (auto& [tid, thread] : threads_)
+        {
+            if (thread->state_ != process_state::Stopped)
+            {
+                continue;
+            }
+
+            try
+            {
+                thread->get_registers().flush();
+            }
+            catch (const error&)
+            {
+                // Nothing sensible to do with a failure while detaching
+            }
+
+            ptrace(PTRACE_DETACH, tid, nullptr, nullptr);
+        }
+
+        if (!is_seized_)
         {
-            error::send_errno("Could not waitpid");
+            // Seized processes were never sent SIGSTOP, so need no SIGCONT
+            kill(pid_, SIGCONT);
         }
-        breakpoint.enable();
     }
 
-    if (ptrace(PTRACE_CONT, pid_, nullptr, nullptr) < 0)
+    if (terminate_on_end_)
     {
-        error::send_errno("Could not resume");
+        kill(pid_, SIGKILL);
+        waitpid(pid_, &status, 0);
     }
-
-    state_ = process_state::Running;
 }
 
-sdb::stop_reason sdb::process::wait_on_signal()
+void sdb::process::resume()
 {
-    int wait_status;
-    int options = 0;
-    if (waitpid(pid_, &wait_status, options) < 0)
+    if (state_ == process_state::Exited || state_ == process_state::Terminated)
     {
-        error::send_errno("waitpid failed");
+        error::send("Could not resume: process has ended");
     }
 
-    stop_reason reason(wait_status);
-    state_ = reason.reason;
+    // Forks seen while stopping every thread, which may switch us to the child
+    handle_pending_forks();
 
-    if (is_attached_ && state_ == process_state::Stopped)
+    auto& current = current_thread();
+    auto program_counter = get_program_counter();
+    // The kernel sets the resume flag after a hardware breakpoint, so we need only step over int3
+    if (breakpoint_sites_.enabled_stoppoint_at_address(program_counter) && !breakpoint_sites_.get_by_address(program_counter).is_hardware()
+        && !emulate_step_over(current, breakpoint_sites_.get_by_address(program_counter)))
     {
-        read_all_registers();
+        step_over_breakpoint(current, breakpoint_sites_.get_by_address(program_counter));
 
-        // Reset the program counter to before we executed int3 instruction
-        auto instruction_start = get_program_counter() - 1;
-        if (reason.info == SIGTRAP && breakpoint_sites_.enabled_stoppoint_at_address(instruction_start))
+        // Wait until the thread has executed the single instruction
+        stop_reason reason(wait_for_thread(current.tid()));
+        current.state_ = reason.reason;
+        finish_step_over(current);
+    }
+
+    // Resume every thread before we wait on any of them
+    for (auto& [tid, thread] : threads_)
+    {
+        if (thread->state_ == process_state::Stopped)
         {
-            set_program_counter(instruction_start); 
+            thread->resume();
         }
     }
 
-    return reason;
+    state_ = process_state::Running;
 }
 
-sdb::stop_reason sdb::process::step_instruction()
+void sdb::process::interrupt()
 {
-    std::optional<sdb::breakpoint_site*> disabled_breakpoint; 
-    auto program_counter = get_program_counter();
-    if (breakpoint_sites_.enabled_stoppoint_at_address(program_counter))
+    auto& thread = current_thread();
+    if (thread.stop_requested_)
     {
-        auto& breakpoint = breakpoint_sites_.get_by_address(program_counter);
-        breakpoint.disable();
-        disabled_breakpoint = &breakpoint;
+        // We already have a stop on the way, so report that one
+        thread.stop_requested_ = false;
+        return;
     }
 
-    if (ptrace(PTRACE_SINGLESTEP, pid_, nullptr, nullptr) < 0)
+    if (!thread.request_stop())
     {
-        error::send_errno("Could not single step");
+        error::send_errno("Could not interrupt process");
     }
+}
+
+sdb::stop_reason sdb::process::wait_on_signal()
+{
+    return *wait_for_stop(true);
+}
 
-    auto reason = wait_on_signal();
+std::optional<sdb::stop_reason> sdb::process::try_wait_on_signal()
+{
+    return wait_for_stop(false);
+}
 
-    if (disabled_breakpoint.has_value())
+std::optional<sdb::stop_reason> sdb::process::wait_for_stop(bool block)
+{
+    if (!is_attached_)
     {
-        disabled_breakpoint.value()->enable();
+        int wait_status;
+        auto result = waitpid(pid_, &wait_status, block ? 0 : WNOHANG);
+        if (result < 0)
+        {
+            error::send_errno("waitpid failed");
+        }
+        else if (result == 0)
+        {
+            return std::nullopt;
+        }
+
+        stop_reason reason(wait_status);
+        state_ = reason.reason;
+        return reason;
     }
 
-    return reason;
+    while (true)
+    {
+        auto waited = wait_for_any_thread(block);
+        if (!waited)
+        {
+            return std::nullopt;
+        }
+
+        auto [tid, wait_status] = *waited;
+        auto& thread = *threads_.at(tid);
+        stop_reason reason(wait_status);
+        thread.state_ = reason.reason;
+        thread.reason_ = reason;
+
+        if (reason.reason != process_state::Stopped)
+        {
+            if (tid != pid_)
+            {
+                // The main thread reports the process ending, after every other thread
+                remove_thread(tid);
+                continue;
+            }
+
+            state_ = reason.reason;
+            release_vfork_parent();
+            return reason;
+        }
+
+        if (reason.event == PTRACE_EVENT_CLONE)
+        {
+            handle_clone(thread, true);
+            continue;
+        }
+
+        if (reason.event == PTRACE_EVENT_FORK || reason.event == PTRACE_EVENT_VFORK)
+        {
+            auto report_fork = follow_fork_mode_ == follow_fork_mode::Both;
+            handle_fork(thread, *reason.event, !report_fork);
+            if (!report_fork)
+            {
+                continue;
+            }
+        }
+
+        if (reason.event == PTRACE_EVENT_VFORK_DONE)
+        {
+            handle_vfork_done();
+            thread.resume(thread.is_stepping_);
+            continue;
+        }
+
+        if (reason.event == PTRACE_EVENT_EXEC)
+        {
+            handle_exec();
+        }
+
+        if (reason.info == SIGCHLD && !reason.event)
+        {
+            // Children ending is routine in a program which forks, so pass it straight on
+            thread.resume(thread.is_stepping_, SIGCHLD);
+            continue;
+        }
+
+        if (thread.stop_requested_ && is_requested_stop(reason))
+        {
+            // Left over from stopping all threads for an earlier stop
+            thread.stop_requested_ = false;
+            thread.resume(thread.is_stepping_);
+            continue;
+        }
+
+        current_thread_ = &thread;
+        state_ = process_state::Stopped;
+        if (thread.stepping_over_)
+        {
+            finish_step_over(thread);
+        }
+        rewind_breakpoint_trap(thread, reason);
+        decode_hardware_trap(thread, reason);
+        thread.reason_ = reason;
+
+        // Single steps stop regardless, as their caller is waiting for them
+        auto carry_on = false;
+        if (reason.breakpoint_id && !thread.is_stepping_ && !reached_return_target(thread))
+        {
+            auto& site = breakpoint_sites_.get_by_id(*reason.breakpoint_id);
+            // Our own site for next or finish, reached by another thread or a deeper call, never stops us
+            carry_on = site.is_internal_ || !site.record_hit(thread) || (site.trace() && record_trace(thread, site));
+        }
+        stop_all_threads();
+
+        if (carry_on && state_ == process_state::Stopped)
+        {
+            resume();
+            continue;
+        }
+
+        return reason;
+    }
 }
 
-void sdb::process::read_all_registers()
+sdb::stop_reason sdb::process::step_instruction()
 {
-    if (ptrace(PTRACE_GETREGS, pid_, nullptr, &get_registers().data_.regs) < 0)
+    auto& current = current_thread();
+    auto program_counter = get_program_counter();
+    if (breakpoint_sites_.enabled_stoppoint_at_address(program_counter) && !breakpoint_sites_.get_by_address(program_counter).is_hardware())
     {
-        error::send_errno("Could not read general purporse registers");
+        // Finished as the step is reported
+        step_over_breakpoint(current, breakpoint_sites_.get_by_address(program_counter));
     }
-
-    if (ptrace(PTRACE_GETFPREGS, pid_, nullptr, &get_registers().data_.i387) < 0)
+    else
     {
-        error::send_errno("Could not read floating point registers");
+        current.resume(true);
     }
+    state_ = process_state::Running;
+
+    return wait_on_signal();
+}
 
-    for (int i = 0; i < 8; ++i)
+sdb::stop_reason sdb::process::step_instructions(std::uint64_t count, const step_predicate& until)
+{
+    if (count == 0)
     {
-        auto id = static_cast<int>(register_id::dr0) + i;
-        auto info = register_info_by_id(static_cast<register_id>(id));
+        error::send("Must step at least once");
+    }
 
-        errno = 0;
-        std::int64_t data = ptrace(PTRACE_PEEKUSER, pid_, info.offset, nullptr);
-        if (errno != 0)
+    for (std::uint64_t steps = 1;; ++steps)
+    {
+        auto reason = step_instruction();
+        if (ends_step_run(reason) || steps == count || (until && until(current_thread().get_registers())))
         {
-            error::send_errno(std::format("Could not read debug register {}", i));
+            return reason;
         }
-
-        get_registers().data_.u_debugreg[i] = data;
     }
 }
 
-void sdb::process::write_user_area(std::size_t offset, std::uint64_t data)
+sdb::stop_reason sdb::process::step_over()
 {
-    if (ptrace(PTRACE_POKEUSER, pid_, offset, data) < 0)
+    auto program_counter = get_program_counter();
+    auto& instruction = decode_instruction(program_counter);
+    if (instruction.flow != control_flow::Call)
     {
-        error::send_errno("Could not write to user area");
+        return step_instruction();
     }
+
+    // Back here, with the stack as it was
+    auto stack_pointer = get_registers().read_by_id_as<std::uint64_t>(register_id::rsp);
+    return run_to_return(program_counter + instruction.length, stack_pointer);
 }
 
-void sdb::process::write_fprs(const user_fpregs_struct& fprs)
+sdb::stop_reason sdb::process::step_out()
 {
-    if (ptrace(PTRACE_SETFPREGS, pid_, nullptr, &fprs) < 0)
+    auto& regs = get_registers();
+    auto program_counter = get_program_counter();
+    auto stack_pointer = regs.read_by_id_as<std::uint64_t>(register_id::rsp);
+
+    // Where the return address is depends on how far through the frame we
+    // are. We assume functions keep a frame pointer, as at -O0.
+    auto& instruction = decode_instruction(program_counter);
+    auto emulated = decode_emulated({instruction.bytes.data(), instruction.length});
+    std::uint64_t return_slot;
+    if (instruction.flow == control_flow::Return
+        || (emulated && emulated->op == emulated_instruction::operation::Nop)
+        || (emulated && emulated->op == emulated_instruction::operation::Push && emulated->source == register_id::rbp))
+    {
+        // Before the frame is made, or after it is gone
+        return_slot = stack_pointer;
+    }
+    else if (emulated && emulated->op == emulated_instruction::operation::Move
+             && emulated->destination == register_id::rbp && emulated->source == register_id::rsp)
+    {
+        // Just past push rbp
+        return_slot = stack_pointer + 8;
+    }
+    else
     {
-        error::send_errno("Could not write floating point registers");
+        return_slot = regs.read_by_id_as<std::uint64_t>(register_id::rbp) + 8;
     }
+
+    auto return_address = read_memory_as<std::uint64_t>(virtual_address{return_slot});
+    return run_to_return(virtual_address{return_address}, return_slot + 8);
 }
 
-void sdb::process::write_gprs(const user_regs_struct& gprs)
+sdb::stop_reason sdb::process::run_to_return(virtual_address address, std::uint64_t stack_pointer)
 {
-    if (ptrace(PTRACE_SETREGS, pid_, nullptr, &gprs) < 0)
+    // A disabled site of the user's is ours until we're done, so its hits don't stop us either
+    std::optional<breakpoint_site::id_type> temporary_id;
+    auto was_enabled = false;
+    if (breakpoint_sites_.contains_address(address))
     {
-        error::send_errno("Could not write general purpose registers");
+        auto& site = breakpoint_sites_.get_by_address(address);
+        was_enabled = site.is_enabled();
+        site.is_internal_ = !was_enabled;
+        site.enable();
+    }
+    else
+    {
+        auto& site = breakpoint_sites_.emplace(*this, address, false);
+        site.is_internal_ = true;
+        site.enable();
+        temporary_id = site.id();
+    }
+
+    return_target_ = return_target{current_thread().tid(), address, stack_pointer};
+    auto clean_up = [&] {
+        return_target_.reset();
+        // The process may have exited, or exec'd and taken its sites with it
+        if (state_ != process_state::Stopped || !breakpoint_sites_.contains_address(address))
+        {
+            return;
+        }
+
+        auto& site = breakpoint_sites_.get_by_address(address);
+        if (temporary_id && site.id() == *temporary_id)
+        {
+            breakpoint_sites_.remove_by_id(*temporary_id);
+        }
+        else if (!was_enabled)
+        {
+            site.disable();
+            site.is_internal_ = false;
+        }
+    };
+
+    try
+    {
+        resume();
+        auto reason = wait_on_signal();
+        clean_up();
+
+        // Reaching the address isn't a breakpoint hit, unless the user has a site there
+        auto at_our_site = reason.breakpoint_id && (!breakpoint_sites_.contains_id(*reason.breakpoint_id)
+            || breakpoint_sites_.get_by_id(*reason.breakpoint_id).address() == address);
+        if (at_our_site && !was_enabled)
+        {
+            reason.breakpoint_id.reset();
+            current_thread().reason_ = reason;
+        }
+        return reason;
+    }
+    catch (const error&)
+    {
+        clean_up();
+        throw;
     }
 }
 
-sdb::breakpoint_site& sdb::process::create_breakpoint_site(virtual_address address)
+bool sdb::process::reached_return_target(const thread& stopped) const
 {
-    if (breakpoint_sites_.contains_address(address))
+    if (!return_target_ || return_target_->tid != stopped.tid())
     {
-        error::send(std::format("Breakpoint site already created at 0x{:#x}", address.addr()));
+        return false;
     }
 
-    return breakpoint_sites_.push(std::unique_ptr<breakpoint_site>(new breakpoint_site(*this, address)));
+    // Below the stack pointer we want is a deeper call of the same function
+    auto& regs = stopped.get_registers();
+    return regs.read_by_id_as<std::uint64_t>(register_id::rip) == return_target_->address.addr()
+        && regs.read_by_id_as<std::uint64_t>(register_id::rsp) >= return_target_->stack_pointer;
 }
 
-std::vector<std::byte> sdb::process::read_memory(sdb::virtual_address address, std::size_t amount) const
+sdb::stop_reason sdb::process::record_instructions(instruction_trace_writer& writer, std::uint64_t max_steps, const step_predicate& until)
 {
-    std::vector<std::byte> result(amount);
+    for (std::uint64_t steps = 1;; ++steps)
+    {
+        // We need rip anyway, and the other registers come in the same fetch
+        writer.record(current_thread().get_registers().read_gprs());
 
-    iovec local_descriptor{result.data(), result.size()};
-    iovec remote_descriptor{reinterpret_cast<void*>(address.addr()), amount};
+        auto reason = step_instruction();
+        if (ends_step_run(reason) || steps == max_steps || (until && until(current_thread().get_registers())))
+        {
+            return reason;
+        }
+    }
+}
 
-    int local_count{1};
-    int remote_count{1};
-    int flags{0}; // Always set to 0 for process_vm_readv
-    if (process_vm_readv(pid_, &local_descriptor, local_count, &remote_descriptor, remote_count, flags) < 0)
+bool sdb::process::ends_step_run(stop_reason& reason)
+{
+    if (reason.reason != process_state::Stopped || reason.info != SIGTRAP || reason.event
+        || reason.breakpoint_id || reason.watchpoint_id)
     {
-        error::send_errno("Could not read process memory");
+        return true;
     }
 
-    return result;
+    // A hardware site traps as the next step starts, but int3 never runs, so we check for it
+    auto& current = current_thread();
+    auto program_counter = get_program_counter();
+    if (breakpoint_sites_.enabled_stoppoint_at_address(program_counter) && !breakpoint_sites_.get_by_address(program_counter).is_hardware())
+    {
+        auto& site = breakpoint_sites_.get_by_address(program_counter);
+        if (site.record_hit(current) && !(site.trace() && record_trace(current, site)))
+        {
+            reason.breakpoint_id = site.id();
+            current.reason_ = reason;
+            return true;
+        }
+    }
+
+    return false;
 }
 
-std::vector<std::byte> sdb::process::read_memory_without_traps(sdb::virtual_address address, std::size_t amount) const
+bool sdb::process::emulate_step_over(thread& stepping, breakpoint_site& site)
 {
-    auto memory = read_memory(address, amount);
+    if (step_over_mode_ != step_over_mode::Emulate)
+    {
+        return false;
+    }
 
-    auto sites = breakpoint_sites_.get_in_region(address, address + amount);
-    for (auto site : sites)
+    if (!site.is_decoded_)
     {
-        // For each breakpoint where we overwrote the instruction with int3,
-        // pretend it still has the original instruction
-        auto offset = site->address() - address.addr();
-        memory[offset.addr()] = site->saved_date_;
+        auto code = read_memory_without_traps(site.address(), cMaxInstructionSize);
+        site.emulated_ = decode_emulated({code.data(), code.size()});
+        site.is_decoded_ = true;
     }
 
-    return memory;
+    return site.emulated_ && emulate(*site.emulated_, site.address(), stepping.get_registers(), *this);
 }
 
-void sdb::process::write_memory(sdb::virtual_address address, span<const std::byte> data)
+void sdb::process::step_over_breakpoint(thread& stepping, breakpoint_site& site)
 {
-    std::size_t bytes_written = 0;
-    while (bytes_written < data.size())
+    if (!site.displaced_ && site.is_displaceable_ && step_over_mode_ != step_over_mode::Remove)
     {
-        auto remaining = data.size() - bytes_written;
-        std::uint64_t word; // The size ptrace allows to write
-        if (remaining >= sizeof(word))
+        try
         {
-            word = from_bytes<std::uint64_t>(data.begin() + bytes_written);
+            displace_instruction(site);
         }
-        else
+        catch (const error&)
         {
-            // We can only write 8 bytes, so if writing less we must first
-            // read 8 bytes, and write back in the existing bytes + our data
-            auto read = read_memory(address + bytes_written, sizeof(word));
-            auto word_data = reinterpret_cast<char*>(&word);
-            std::memcpy(word_data, data.begin() + bytes_written, remaining);
-            std::memcpy(word_data + remaining, read.data() + remaining, sizeof(word) - remaining);
+            // Such as a loop instruction, or nowhere to map a copy within reach
+            site.is_displaceable_ = false;
         }
+    }
 
-        if (ptrace(PTRACE_POKEDATA, pid_, address + bytes_written, word) < 0)
+    if (site.displaced_ && step_over_mode_ != step_over_mode::Remove)
+    {
+        stepping.get_registers().write_by_id(register_id::rip, site.displaced_->address.addr());
+    }
+    else
+    {
+        site.disable();
+    }
+
+    stepping.stepping_over_ = &site;
+    stepping.resume(true);
+}
+
+void sdb::process::finish_step_over(thread& stepped)
+{
+    auto& site = *std::exchange(stepped.stepping_over_, nullptr);
+    if (stepped.state_ != process_state::Stopped)
+    {
+        return;
+    }
+
+    // Only removed if it wasn't stepped displaced
+    if (!site.is_enabled())
+    {
+        site.enable();
+        return;
+    }
+
+    // Put the thread where the original would have left it. A branch taken
+    // already went to the right place, as the copy's offsets are fixed up.
+    auto& displaced = *site.displaced_;
+    auto& regs = stepped.get_registers();
+    auto jump_back = displaced.address + displaced.code_size;
+    auto after = (site.address() + displaced.length).addr();
+
+    auto program_counter = regs.read_by_id_as<std::uint64_t>(register_id::rip);
+    if (program_counter == displaced.address.addr())
+    {
+        // Stopped by a signal or a fault before the copy completed
+        regs.write_by_id(register_id::rip, site.address().addr());
+    }
+    else if (program_counter == jump_back.addr())
+    {
+        regs.write_by_id(register_id::rip, after);
+    }
+
+    if (displaced.is_call)
+    {
+        auto stack_pointer = virtual_address{regs.read_by_id_as<std::uint64_t>(register_id::rsp)};
+        if (read_memory_as<std::uint64_t>(stack_pointer) == jump_back.addr())
         {
-            error::send_errno("Could not write process memory");
+            write_memory(stack_pointer, {as_bytes(after), sizeof(after)});
         }
+    }
 
-        bytes_written += sizeof(word);
+    // The kernel returns from syscall to the address in rcx, and leaves it there
+    if (displaced.is_syscall && regs.read_by_id_as<std::uint64_t>(register_id::rcx) == jump_back.addr())
+    {
+        regs.write_by_id(register_id::rcx, after);
     }
 }
+
+void sdb::process::displace_instruction(breakpoint_site& site)
+{
+    static constexpr std::size_t cJumpSize{5};
+
+    // A short branch grows by at most four bytes once made rel32
+    auto code = read_memory_without_traps(site.address(), cMaxInstructionSize);
+    auto address = allocate_trampoline(site.address(), cMaxInstructionSize + 4 + cJumpSize);
+    auto relocated = relocate_instruction({code.data(), code.size()}, site.address(), address);
+
+    // Any thread which runs on past the copy without us, such as into a signal
+    // handler which returns to it, still ends up after the original
+    auto copy = relocated.code;
+    auto jump_from = address + copy.size() + cJumpSize;
+    auto jump_offset = static_cast<std::int32_t>((site.address() + relocated.length).addr() - jump_from.addr());
+    copy.push_back(std::byte{0xe9});
+    copy.insert(copy.end(), as_bytes(jump_offset), as_bytes(jump_offset) + sizeof(jump_offset));
+    write_memory(address, {copy.data(), copy.size()});
+
+    site.displaced_ = breakpoint_site::displaced_instruction{
+        address, relocated.code.size(), relocated.length, relocated.is_call, relocated.is_syscall};
+}
+
+void sdb::process::set_current_thread(pid_t tid)
+{
+    auto it = threads_.find(tid);
+    if (it == threads_.end())
+    {
+        error::send(std::format("No thread with tid {}", tid));
+    }
+
+    current_thread_ = it->second.get();
+}
+
+sdb::thread& sdb::process::add_thread(pid_t tid)
+{
+    auto [it, inserted] = threads_.emplace(tid, std::unique_ptr<thread>(new thread(*this, tid)));
+    return *it->second;
+}
+
+void sdb::process::remove_thread(pid_t tid)
+{
+    if (current_thread_->tid() == tid)
+    {
+        current_thread_ = threads_.at(pid_).get();
+    }
+
+    threads_.erase(tid);
+}
+
+void sdb::process::stop_all_threads()
+{
+    // Ask every thread to stop before waiting on any, so they stop in parallel.
+    // The lists are kept between calls, so a stop allocates nothing once warm.
+    auto& stopping = stopping_threads_;
+    auto& ended = ended_threads_;
+    stopping.clear();
+    ended.clear();
+    for (auto& [tid, thread] : threads_)
+    {
+        if (thread->state_ != process_state::Running)
+        {
+            continue;
+        }
+
+        if (!thread->stop_requested_)
+        {
+            thread->stop_requested_ = thread->request_stop();
+        }
+        stopping.push_back(thread.get());
+    }
+
+    auto execed = false;
+    for (auto thread : stopping)
+    {
+        stop_reason reason(wait_for_thread(thread->tid()));
+        thread->state_ = reason.reason;
+        thread->reason_ = reason;
+
+        if (reason.reason != process_state::Stopped)
+        {
+            ended.push_back(thread->tid());
+        }
+        else if (thread->stop_requested_ && is_requested_stop(reason))
+        {
+            thread->stop_requested_ = false;
+        }
+        else if (reason.event == PTRACE_EVENT_CLONE)
+        {
+            handle_clone(*thread, false);
+        }
+        else if (reason.event == PTRACE_EVENT_FORK || reason.event == PTRACE_EVENT_VFORK)
+        {
+            // Following the child would switch processes under us, so wait until we resume
+            thread->pending_fork_event_ = reason.event;
+        }
+        else if (reason.event == PTRACE_EVENT_VFORK_DONE)
+        {
+            handle_vfork_done();
+        }
+        else if (reason.event == PTRACE_EVENT_EXEC)
+        {
+            execed = true;
+        }
+        else
+        {
+            // It stopped for another reason before our request arrived.
+            // If that was a breakpoint, rewinding means it hits it again when resumed.
+            rewind_breakpoint_trap(*thread, reason);
+        }
+    }
+
+    for (auto tid : ended)
+    {
+        if (tid == pid_)
+        {
+            state_ = threads_.at(tid)->state_;
+            continue;
+        }
+        remove_thread(tid);
+    }
+
+    if (execed)
+    {
+        handle_exec();
+    }
+}
+
+void sdb::process::handle_clone(thread& parent, bool resume_threads)
+{
+    unsigned long tid;
+    if (ptrace(PTRACE_GETEVENTMSG, parent.tid(), nullptr, &tid) < 0)
+    {
+        error::send_errno("Could not get new thread id");
+    }
+
+    // New threads start with SIGSTOP, or PTRACE_EVENT_STOP if seized
+    auto& new_thread = add_thread(tid);
+    stop_reason reason(wait_for_thread(tid));
+    new_thread.state_ = reason.reason;
+    if (reason.reason != process_state::Stopped)
+    {
+        remove_thread(tid);
+    }
+    else
+    {
+        // Debug registers are not inherited by new threads
+        write_debug_registers(new_thread);
+        if (resume_threads && !parent.is_stepping_)
+        {
+            new_thread.resume();
+        }
+    }
+
+    if (resume_threads)
+    {
+        parent.resume(parent.is_stepping_);
+    }
+}
+
+void sdb::process::handle_fork(thread& parent, int event, bool resume_threads)
+{
+    unsigned long child_pid;
+    if (ptrace(PTRACE_GETEVENTMSG, parent.tid(), nullptr, &child_pid) < 0)
+    {
+        error::send_errno("Could not get forked process id");
+    }
+
+    // The child starts with SIGSTOP, or PTRACE_EVENT_STOP if seized,
+    // and a copy of our memory including every int3 we inserted
+    std::unique_ptr<process> child{new process{static_cast<pid_t>(child_pid), terminate_on_end_, true, is_seized_}};
+    stop_reason reason(wait_for_thread(child_pid));
+    child->current_thread().state_ = reason.reason;
+    if (reason.reason != process_state::Stopped)
+    {
+        child->pid_ = 0; // Nothing left to detach from or kill
+        if (resume_threads)
+        {
+            parent.resume(parent.is_stepping_);
+        }
+        return;
+    }
+
+    breakpoint_sites_.for_each([&](auto& site) {
+        child->breakpoint_sites_.emplace(*child, site);
+    });
+    watchpoints_.for_each([&](auto& point) {
+        child->watchpoints_.emplace(*child, point);
+    });
+    child->trace_buffer_ = trace_buffer_;
+    fast_tracepoints_.for_each([&](auto& point) {
+        child->fast_tracepoints_.emplace(*child, point);
+    });
+    child->elf_ = elf_;
+    child->unclaimed_wait_statuses_ = unclaimed_wait_statuses_;
+    child->step_over_mode_ = step_over_mode_;
+    child->patched_code_ = patched_code_;
+    child->code_arenas_ = code_arenas_;
+    child->fast_trace_ring_ = fast_trace_ring_;
+    child->fast_trace_read_ = fast_trace_read_;
+
+    // Nor are debug registers, so a child we detach never hits our hardware stoppoints
+    child->debug_addresses_ = debug_addresses_;
+    child->debug_control_ = debug_control_;
+    child->used_debug_registers_ = used_debug_registers_;
+    if (follow_fork_mode_ != follow_fork_mode::Parent)
+    {
+        child->write_debug_registers(child->current_thread());
+    }
+
+    auto is_vfork = event == PTRACE_EVENT_VFORK;
+    auto is_stepping = parent.is_stepping_;
+    switch (follow_fork_mode_)
+    {
+        case follow_fork_mode::Parent:
+            if (is_vfork)
+            {
+                // The child shares our memory, so our breakpoints must go until it execs or exits
+                write_breakpoint_bytes(false);
+                awaiting_vfork_done_ = true;
+            }
+            else
+            {
+                child->write_breakpoint_bytes(false);
+            }
+            child->terminate_on_end_ = false;
+            child.reset(); // Detaches
+            break;
+        case follow_fork_mode::Both:
+            forked_processes_.push_back(std::move(child));
+            break;
+        case follow_fork_mode::Child:
+        {
+            swap_identity(*child);
+            auto former_parent = std::move(child);
+            former_parent->terminate_on_end_ = false;
+            former_parent->follow_fork_mode_ = follow_fork_mode::Parent;
+            former_parent->stop_all_threads();
+            former_parent->handle_pending_forks();
+
+            if (is_vfork)
+            {
+                // Its memory is ours until we exec or exit, so it keeps its breakpoints until then
+                vfork_parent_ = std::move(former_parent);
+            }
+            else
+            {
+                former_parent->write_breakpoint_bytes(false);
+                former_parent.reset(); // Detaches
+            }
+
+            if (resume_threads)
+            {
+                current_thread().resume(is_stepping);
+            }
+            return;
+        }
+    }
+
+    if (resume_threads)
+    {
+        parent.resume(is_stepping);
+    }
+}
+
+void sdb::process::handle_pending_forks()
+{
+    for (auto& [tid, thread] : threads_)
+    {
+        if (auto event = std::exchange(thread->pending_fork_event_, std::nullopt))
+        {
+            auto following_child = follow_fork_mode_ == follow_fork_mode::Child;
+            handle_fork(*thread, *event, false);
+            if (following_child)
+            {
+                // We are now the child, and our former parent dealt with its other forks
+                return;
+            }
+        }
+    }
+}
+
+void sdb::process::handle_vfork_done()
+{
+    if (awaiting_vfork_done_)
+    {
+        write_breakpoint_bytes(true);
+        awaiting_vfork_done_ = false;
+    }
+}
+
+void sdb::process::handle_exec()
+{
+    // Every other thread has gone, and the thread which called exec now has our pid
+    for (auto it = threads_.begin(); it != threads_.end();)
+    {
+        auto tid = it->first;
+        if (tid != pid_ && !take_unclaimed_wait_status(tid))
+        {
+            int wait_status;
+            waitpid(tid, &wait_status, __WALL | WNOHANG);
+        }
+        it = tid == pid_ ? std::next(it) : threads_.erase(it);
+    }
+    current_thread_ = threads_.at(pid_).get();
+    current_thread_->stepping_over_ = nullptr;
+
+    // Anything which depends on addresses in the old image is meaningless now
+    if (memory_fd_ >= 0)
+    {
+        close(memory_fd_);
+        memory_fd_ = -1;
+    }
+    // The kernel clears every thread's debug registers on exec, and the mirror follows as stoppoints go
+    breakpoint_sites_ = {};
+    watchpoints_ = {};
+    fast_tracepoints_ = {};
+    instruction_cache_.clear();
+    patched_code_.clear();
+    load_elf();
+    code_arenas_.clear();
+    fast_trace_ring_ = virtual_address{};
+    fast_trace_read_ = 0;
+    awaiting_vfork_done_ = false;
+
+    release_vfork_parent();
+}
+
+void sdb::process::release_vfork_parent()
+{
+    if (!vfork_parent_)
+    {
+        return;
+    }
+
+    try
+    {
+        vfork_parent_->write_breakpoint_bytes(false);
+    }
+    catch (const error&)
+    {
+        // Nothing sensible to do with a failure while detaching
+    }
+
+    vfork_parent_.reset(); // Detaches
+}
+
+void sdb::process::load_elf()
+{
+    // Without it, code is read from the inferior as before
+    elf_.reset();
+    try
+    {
+        auto file = std::make_shared<elf>(std::format("/proc/{}/exe", pid_), elf::default_cache_directory());
+
+        // The auxiliary vector has where the entry point was loaded
+        std::ifstream auxv(std::format("/proc/{}/auxv", pid_), std::ios::binary);
+        std::array<std::uint64_t, 2> entry;
+        while (auxv.read(reinterpret_cast<char*>(entry.data()), sizeof(entry)) && entry[0] != AT_NULL)
+        {
+            if (entry[0] == AT_ENTRY)
+            {
+                file->notify_loaded(virtual_address{entry[1] - file->get_header().e_entry});
+                elf_ = std::move(file);
+                return;
+            }
+        }
+    }
+    catch (const error&)
+    {
+    }
+}
+
+void sdb::process::swap_identity(process& other)
+{
+    std::swap(pid_, other.pid_);
+    std::swap(memory_fd_, other.memory_fd_);
+    std::swap(state_, other.state_);
+    std::swap(threads_, other.threads_);
+    std::swap(current_thread_, other.current_thread_);
+    std::swap(breakpoint_sites_, other.breakpoint_sites_);
+    std::swap(watchpoints_, other.watchpoints_);
+    std::swap(debug_addresses_, other.debug_addresses_);
+    std::swap(debug_control_, other.debug_control_);
+    std::swap(used_debug_registers_, other.used_debug_registers_);
+    std::swap(fast_tracepoints_, other.fast_tracepoints_);
+    std::swap(instruction_cache_, other.instruction_cache_);
+    std::swap(elf_, other.elf_);
+    std::swap(patched_code_, other.patched_code_);
+    std::swap(code_arenas_, other.code_arenas_);
+    std::swap(fast_trace_ring_, other.fast_trace_ring_);
+    std::swap(fast_trace_read_, other.fast_trace_read_);
+
+    for (auto proc : {this, &other})
+    {
+        for (auto& [tid, thread] : proc->threads_)
+        {
+            thread->process_ = proc;
+        }
+        proc->breakpoint_sites_.for_each([proc](auto& site) { site.process_ = proc; });
+        proc->watchpoints_.for_each([proc](auto& point) { point.process_ = proc; });
+        proc->fast_tracepoints_.for_each([proc](auto& point) { point.process_ = proc; });
+    }
+}
+
+void sdb::process::write_breakpoint_bytes(bool install)
+{
+    std::vector<breakpoint_site*> sites; // In order of address
+    breakpoint_sites_.for_each([&](auto& site) {
+        if (site.is_enabled() && !site.is_hardware())
+        {
+            sites.push_back(&site);
+        }
+    });
+
+    write_breakpoint_bytes(sites, install);
+}
+
+void sdb::process::write_breakpoint_bytes(const std::vector<breakpoint_site*>& sites, bool install)
+{
+    // Sites close together share one read and one write, each of the bytes in between
+    static constexpr std::uint64_t cMaximumGap{4096};
+    auto first = sites.begin();
+    while (first != sites.end())
+    {
+        auto last = first;
+        while (std::next(last) != sites.end() && (*std::next(last))->address().addr() - (*last)->address().addr() < cMaximumGap)
+        {
+            ++last;
+        }
+
+        auto low = (*first)->address();
+        auto size = (*last)->address().addr() - low.addr() + 1;
+        auto memory = read_memory(low, size);
+        for (auto it = first; it != std::next(last); ++it)
+        {
+            auto offset = (*it)->address().addr() - low.addr();
+            if (install && !(*it)->is_enabled())
+            {
+                (*it)->saved_data_ = memory[offset];
+            }
+            memory[offset] = install ? std::byte{0xcc} : (*it)->saved_data_;
+        }
+        write_hidden_memory(low, {memory.data(), memory.size()});
+
+        first = std::next(last);
+    }
+}
+
+bool sdb::process::wake_stop_waiter()
+{
+    if (!stop_waiter_)
+    {
+        return false;
+    }
+
+    auto reason = try_wait_on_signal();
+    if (!reason)
+    {
+        return false;
+    }
+
+    stop_awaiter_->reason_ = reason;
+    stop_awaiter_ = nullptr;
+    std::exchange(stop_waiter_, nullptr).resume();
+    return true;
+}
+
+bool sdb::process::stop_awaiter::await_ready()
+{
+    reason_ = process_->try_wait_on_signal();
+    return reason_.has_value();
+}
+
+void sdb::process::stop_awaiter::await_suspend(std::coroutine_handle<> waiter)
+{
+    process_->stop_waiter_ = waiter;
+    process_->stop_awaiter_ = this;
+}
+
+bool sdb::process::is_requested_stop(const stop_reason& reason) const
+{
+    if (is_seized_)
+    {
+        return reason.event == PTRACE_EVENT_STOP;
+    }
+
+    return reason.info == SIGSTOP && !reason.event;
+}
+
+bool sdb::process::record_trace(const thread& stopped, const breakpoint_site& site)
+{
+    auto& spec = *site.trace();
+    auto size = spec.record_size();
+    auto record = trace_buffer_ ? trace_buffer_->allocate(size) : nullptr;
+    if (!record)
+    {
+        return false;
+    }
+
+    auto put = [record](std::size_t offset, auto value) { std::memcpy(record + offset, &value, sizeof(value)); };
+    std::memset(record + trace_buffer::cRecordHeaderSize, 0, size - trace_buffer::cRecordHeaderSize);
+    put(4, site.id());
+    put(16, static_cast<std::int32_t>(stopped.tid()));
+    put(20, static_cast<std::uint16_t>(spec.registers.size()));
+    put(22, static_cast<std::uint16_t>(spec.memory.size()));
+
+    auto& regs = stopped.get_registers();
+    auto offset = trace_buffer::cRecordHeaderSize;
+    for (auto id : spec.registers)
+    {
+        auto& info = register_info_by_id(id);
+        auto value = std::visit([](auto value) -> std::uint64_t {
+            if constexpr (std::is_integral_v<decltype(value)>)
+            {
+                return static_cast<std::uint64_t>(value);
+            }
+            else
+            {
+                return 0; // Ruled out by trace_spec::validate
+            }
+        }, regs.read(info));
+
+        put(offset, static_cast<std::uint32_t>(info.dwarf_id));
+        put(offset + 8, value);
+        offset += 16;
+    }
+
+    // Every range is read by one syscall, straight into the record
+    std::array<iovec, trace_spec::cMaximumMemoryRanges> local_descriptors;
+    std::array<iovec, trace_spec::cMaximumMemoryRanges> remote_descriptors;
+    std::array<std::size_t, trace_spec::cMaximumMemoryRanges> range_offsets;
+    auto range_count = spec.memory.size();
+    for (std::size_t i = 0; i < range_count; ++i)
+    {
+        auto& range = spec.memory[i];
+        std::uint64_t address = 0; // Never readable, so records nothing if evaluation fails
+        try
+        {
+            address = range.address.evaluate(regs, *this);
+        }
+        catch (const error&)
+        {
+        }
+
+        put(offset, address);
+        put(offset + 8, range.size);
+        local_descriptors[i] = {record + offset + 16, range.size};
+        remote_descriptors[i] = {reinterpret_cast<void*>(address), range.size};
+        range_offsets[i] = offset;
+        offset += 16 + ((range.size + 7) & ~std::uint32_t{7});
+    }
+
+    if (range_count > 0)
+    {
+        auto read = process_vm_readv(pid_, local_descriptors.data(), range_count, remote_descriptors.data(), range_count, 0);
+        auto remaining = static_cast<std::size_t>(std::max<ssize_t>(read, 0));
+        for (std::size_t i = 0; i < range_count; ++i)
+        {
+            auto bytes_read = std::min<std::size_t>(remaining, spec.memory[i].size);
+            put(range_offsets[i] + 12, static_cast<std::uint32_t>(bytes_read));
+            remaining -= bytes_read;
+        }
+    }
+
+    return true;
+}
+
+void sdb::process::rewind_breakpoint_trap(thread& stopped, stop_reason& reason)
+{
+    if (reason.info != SIGTRAP || reason.event || breakpoint_sites_.empty())
+    {
+        return;
+    }
+
+    // Reset the program counter to before we executed int3 instruction
+    auto& regs = stopped.get_registers();
+    auto instruction_start = virtual_address{regs.read_by_id_as<std::uint64_t>(register_id::rip)} - 1;
+    if (breakpoint_sites_.enabled_stoppoint_at_address(instruction_start) && !breakpoint_sites_.get_by_address(instruction_start).is_hardware())
+    {
+        regs.write_by_id(register_id::rip, instruction_start.addr());
+        reason.breakpoint_id = breakpoint_sites_.get_by_address(instruction_start).id();
+    }
+}
+
+void sdb::process::decode_hardware_trap(thread& stopped, stop_reason& reason)
+{
+    if (reason.info != SIGTRAP || reason.event || used_debug_registers_ == 0)
+    {
+        return;
+    }
+
+    // Bits 0-3 say which of DR0-DR3 fired. The kernel leaves them set until
+    // we clear them, so a later single step would report them again.
+    auto& regs = stopped.get_registers();
+    auto status = regs.read_by_id_as<std::uint64_t>(register_id::dr6);
+    if ((status & 0b1111) == 0)
+    {
+        return;
+    }
+    regs.write_by_id(register_id::dr6, std::uint64_t{0});
+
+    auto program_counter = virtual_address{regs.read_by_id_as<std::uint64_t>(register_id::rip)};
+    if (breakpoint_sites_.enabled_stoppoint_at_address(program_counter))
+    {
+        auto& site = breakpoint_sites_.get_by_address(program_counter);
+        if (site.is_hardware() && (status & (std::uint64_t{1} << site.hardware_register_index_)))
+        {
+            reason.breakpoint_id = site.id();
+        }
+    }
+
+    watchpoints_.for_each([&](auto& point) {
+        if (status & (std::uint64_t{1} << point.hardware_register_index_))
+        {
+            point.update_data();
+            reason.watchpoint_id = point.id();
+        }
+    });
+}
+
+std::optional<std::pair<pid_t, int>> sdb::process::wait_for_any_thread(bool block)
+{
+    auto& unclaimed = *unclaimed_wait_statuses_;
+    for (auto it = unclaimed.begin(); it != unclaimed.end(); ++it)
+    {
+        if (threads_.contains(it->first))
+        {
+            auto status = *it;
+            unclaimed.erase(it);
+            return status;
+        }
+    }
+
+    // One wait for any child, however many threads we have, rather than one for each
+    while (true)
+    {
+        int wait_status;
+        auto tid = waitpid(-1, &wait_status, __WALL | (block ? 0 : WNOHANG));
+        if (tid < 0)
+        {
+            error::send_errno("waitpid failed");
+        }
+        if (tid == 0)
+        {
+            return std::nullopt; // Nothing has changed state yet
+        }
+
+        if (threads_.contains(tid))
+        {
+            return std::pair{tid, wait_status};
+        }
+
+        unclaimed.emplace_back(tid, wait_status);
+    }
+}
+
+int sdb::process::wait_for_thread(pid_t tid)
+{
+    if (auto wait_status = take_unclaimed_wait_status(tid))
+    {
+        return *wait_status;
+    }
+
+    int wait_status;
+    if (waitpid(tid, &wait_status, __WALL) < 0)
+    {
+        error::send_errno("waitpid failed");
+    }
+
+    return wait_status;
+}
+
+std::optional<int> sdb::process::take_unclaimed_wait_status(pid_t tid)
+{
+    auto& unclaimed = *unclaimed_wait_statuses_;
+    auto it = std::find_if(unclaimed.begin(), unclaimed.end(), [tid](auto& status) { return status.first == tid; });
+    if (it == unclaimed.end())
+    {
+        return std::nullopt;
+    }
+
+    auto wait_status = it->second;
+    unclaimed.erase(it);
+    return wait_status;
+}
+
+sdb::breakpoint_site& sdb::process::create_breakpoint_site(virtual_address address, bool hardware)
+{
+    if (breakpoint_sites_.contains_address(address))
+    {
+        error::send(std::format("Breakpoint site already created at 0x{:#x}", address.addr()));
+    }
+
+    return breakpoint_sites_.emplace(*this, address, hardware);
+}
+
+sdb::watchpoint& sdb::process::create_watchpoint(virtual_address address, stoppoint_mode mode, std::size_t size)
+{
+    if (watchpoints_.contains_address(address))
+    {
+        error::send(std::format("Watchpoint already created at {:#x}", address.addr()));
+    }
+
+    return watchpoints_.emplace(*this, address, mode, size);
+}
+
+sdb::fast_tracepoint& sdb::process::create_fast_tracepoint(virtual_address address)
+{
+    if (fast_tracepoints_.contains_address(address))
+    {
+        error::send(std::format("Fast tracepoint already created at {:#x}", address.addr()));
+    }
+
+    return fast_tracepoints_.emplace(*this, address);
+}
+
+std::size_t sdb::process::drain_fast_trace(std::vector<fast_trace_record>& records)
+{
+    if (fast_trace_ring_.addr() == 0)
+    {
+        return 0;
+    }
+
+    std::size_t lost = 0;
+    auto reserved = read_memory_as<std::uint64_t>(fast_trace_ring_);
+    if (reserved - fast_trace_read_ > cFastTraceSlots)
+    {
+        lost += reserved - fast_trace_read_ - cFastTraceSlots;
+        fast_trace_read_ = reserved - cFastTraceSlots;
+    }
+
+    // The slots we want are at most two runs, either side of the end of the ring
+    auto first = records.size();
+    records.resize(first + (reserved - fast_trace_read_));
+    for (auto index = fast_trace_read_; index < reserved;)
+    {
+        auto slot = index % cFastTraceSlots;
+        auto count = std::min<std::uint64_t>(reserved - index, cFastTraceSlots - slot);
+        auto into = reinterpret_cast<std::byte*>(records.data() + first + (index - fast_trace_read_));
+        read_memory(fast_trace_ring_ + cFastTraceHeaderSize + slot * sizeof(fast_trace_record), span<std::byte>{into, count * sizeof(fast_trace_record)});
+        index += count;
+    }
+
+    // A slot is written after it is reserved, and may be overwritten by a later lap as we read
+    auto kept = first;
+    auto index = fast_trace_read_;
+    for (; index < reserved; ++index)
+    {
+        auto& record = records[first + (index - fast_trace_read_)];
+        if (record.sequence < index + 1)
+        {
+            break; // Still being written, so left for next time
+        }
+        if (record.sequence > index + 1)
+        {
+            ++lost;
+            continue;
+        }
+        records[kept++] = record;
+    }
+
+    records.resize(kept);
+    fast_trace_read_ = index;
+    return lost;
+}
+
+std::uint64_t sdb::process::inferior_syscall(long number, std::array<std::uint64_t, 6> args)
+{
+    if (state_ != process_state::Stopped)
+    {
+        error::send("Process must be stopped to make a system call");
+    }
+
+    auto& current = current_thread();
+    current.get_registers().flush();
+
+    user_regs_struct saved;
+    current.read_gprs(saved);
+    auto call = saved;
+    call.rax = number;
+    call.rdi = args[0];
+    call.rsi = args[1];
+    call.rdx = args[2];
+    call.r10 = args[3];
+    call.r8 = args[4];
+    call.r9 = args[5];
+    // Otherwise if we stopped in a system call, the kernel would try to restart it instead
+    call.orig_rax = -1;
+
+    // Wherever the thread is must be executable
+    static constexpr std::byte cSyscall[] = {std::byte{0x0f}, std::byte{0x05}};
+    auto address = virtual_address{saved.rip};
+    auto saved_code = read_memory(address, sizeof(cSyscall));
+    // Put back before anything can decode it, so the code is still as in the file
+    write_hidden_memory(address, {cSyscall, sizeof(cSyscall)});
+
+    current.write_gprs(call);
+    current.resume(true);
+    stop_reason reason(wait_for_thread(current.tid()));
+    current.state_ = reason.reason;
+    current.is_stepping_ = false;
+    if (reason.reason != process_state::Stopped)
+    {
+        state_ = reason.reason;
+        error::send("Process ended during a system call we made");
+    }
+
+    current.read_gprs(call);
+    current.write_gprs(saved);
+    write_hidden_memory(address, saved_code);
+
+    if (reason.info != SIGTRAP || call.rip != saved.rip + sizeof(cSyscall))
+    {
+        error::send(std::format("System call {} was interrupted by signal {}", number, sigabbrev_np(reason.info)));
+    }
+
+    // Errors come back as -errno
+    if (call.rax > static_cast<std::uint64_t>(-4096))
+    {
+        errno = -static_cast<std::int64_t>(call.rax);
+        error::send_errno(std::format("System call {} failed in the inferior", number));
+    }
+
+    return call.rax;
+}
+
+sdb::virtual_address sdb::process::allocate_trampoline(virtual_address near, std::size_t size)
+{
+    // Leaving room for the trampoline itself, and the instructions we jump from
+    static constexpr std::uint64_t cReach{(std::uint64_t{1} << 31) - (std::uint64_t{1} << 20)};
+    auto within_reach = [near](std::uint64_t address) {
+        auto distance = address > near.addr() ? address - near.addr() : near.addr() - address;
+        return distance < cReach;
+    };
+
+    size = (size + 15) & ~std::size_t{15};
+    for (auto& arena : code_arenas_)
+    {
+        if (within_reach(arena.base.addr()) && arena.used + size <= arena.size)
+        {
+            auto address = arena.base + arena.used;
+            arena.used += size;
+            return address;
+        }
+    }
+
+    // The kernel maps at a hint if it's free, so try a few either side of near.
+    // Trampolines are written through /proc/<pid>/mem, so needn't be writable.
+    static constexpr std::size_t cArenaSize{64 * 1024};
+    static constexpr std::uint64_t cHintStep{256 << 20};
+    for (std::int64_t step : {-1, 1, -2, 2, -4, 4})
+    {
+        auto hint = (near.addr() & ~std::uint64_t{0xffff}) + step * cHintStep;
+        auto mapped = inferior_syscall(SYS_mmap, {hint, cArenaSize, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, static_cast<std::uint64_t>(-1), 0});
+        if (within_reach(mapped))
+        {
+            code_arenas_.push_back({virtual_address{mapped}, cArenaSize, size});
+            return virtual_address{mapped};
+        }
+
+        inferior_syscall(SYS_munmap, {mapped, cArenaSize, 0, 0, 0, 0});
+    }
+
+    error::send(std::format("Could not map trampolines near {:#x}", near.addr()));
+    std::unreachable();
+}
+
+sdb::virtual_address sdb::process::fast_trace_ring()
+{
+    if (fast_trace_ring_.addr() == 0)
+    {
+        auto size = cFastTraceHeaderSize + cFastTraceSlots * sizeof(fast_trace_record);
+        auto mapped = inferior_syscall(SYS_mmap, {0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, static_cast<std::uint64_t>(-1), 0});
+        fast_trace_ring_ = virtual_address{mapped};
+    }
+
+    return fast_trace_ring_;
+}
+
+int sdb::process::allocate_debug_register(virtual_address address, stoppoint_mode mode, std::size_t size)
+{
+    for (auto i = 0; i < static_cast<int>(debug_addresses_.size()); ++i)
+    {
+        if (used_debug_registers_ & (1 << i))
+        {
+            continue;
+        }
+
+        used_debug_registers_ |= 1 << i;
+        debug_addresses_[i] = address.addr();
+        auto id = static_cast<register_id>(static_cast<int>(register_id::dr0) + i);
+        for (auto& [tid, thread] : threads_)
+        {
+            thread->get_registers().write_by_id(id, address.addr());
+        }
+
+        // Each register has four bits of DR7 from bit 16, the condition then the length.
+        // They only take effect once the register is enabled, so needn't be written yet.
+        auto condition = mode == stoppoint_mode::Execute ? 0b00 : mode == stoppoint_mode::Write ? 0b01 : 0b11;
+        auto length = size == 1 ? 0b00 : size == 2 ? 0b01 : size == 8 ? 0b10 : 0b11;
+        auto shift = 16 + i * 4;
+        debug_control_ &= ~(std::uint64_t{0b1111} << shift);
+        debug_control_ |= static_cast<std::uint64_t>(condition | length << 2) << shift;
+
+        return i;
+    }
+
+    error::send("No free debug registers");
+    std::unreachable();
+}
+
+void sdb::process::set_debug_register_enabled(int index, bool enabled)
+{
+    // Local enable bits are the even bits of DR7
+    auto enable_bit = std::uint64_t{1} << (index * 2);
+    debug_control_ = enabled ? (debug_control_ | enable_bit) : (debug_control_ & ~enable_bit);
+
+    for (auto& [tid, thread] : threads_)
+    {
+        thread->get_registers().write_by_id(register_id::dr7, debug_control_);
+    }
+}
+
+void sdb::process::free_debug_register(int index)
+{
+    // Freed stoppoints have been disabled already, or are gone with their thread's registers
+    used_debug_registers_ &= ~(1 << index);
+    debug_control_ &= ~(std::uint64_t{1} << (index * 2));
+    debug_control_ &= ~(std::uint64_t{0b1111} << (16 + index * 4));
+}
+
+void sdb::process::write_debug_registers(thread& target)
+{
+    if (used_debug_registers_ == 0)
+    {
+        return;
+    }
+
+    for (auto i = 0; i < static_cast<int>(debug_addresses_.size()); ++i)
+    {
+        if (used_debug_registers_ & (1 << i))
+        {
+            auto id = static_cast<register_id>(static_cast<int>(register_id::dr0) + i);
+            target.get_registers().write_by_id(id, debug_addresses_[i]);
+        }
+    }
+    target.get_registers().write_by_id(register_id::dr7, debug_control_);
+}
+
+std::vector<std::byte> sdb::process::read_memory(sdb::virtual_address address, std::size_t amount) const
+{
+    std::vector<std::byte> result(amount);
+    read_memory(address, span<std::byte>{result.data(), result.size()});
+    return result;
+}
+
+void sdb::process::read_memory(sdb::virtual_address address, span<std::byte> buffer) const
+{
+    iovec local_descriptor{buffer.begin(), buffer.size()};
+    iovec remote_descriptor{reinterpret_cast<void*>(address.addr()), buffer.size()};
+
+    int local_count{1};
+    int remote_count{1};
+    int flags{0}; // Always set to 0 for process_vm_readv
+    if (process_vm_readv(pid_, &local_descriptor, local_count, &remote_descriptor, remote_count, flags) < 0)
+    {
+        error::send_errno("Could not read process memory");
+    }
+}
+
+std::vector<std::byte> sdb::process::read_memory_without_traps(sdb::virtual_address address, std::size_t amount) const
+{
+    std::vector<std::byte> memory(amount);
+    read_memory_without_traps(address, {memory.data(), memory.size()});
+    return memory;
+}
+
+void sdb::process::read_memory_without_traps(sdb::virtual_address address, span<std::byte> buffer) const
+{
+    read_memory(address, buffer);
+    auto amount = buffer.size();
+
+    // Fast tracepoints replace up to 19 bytes, so one may start before address
+    static constexpr std::int64_t cMaximumReplaced{19};
+    fast_tracepoints_.for_each_in_region(address - cMaximumReplaced, address + amount, [&](const fast_tracepoint& point) {
+        if (!point.is_enabled())
+        {
+            return;
+        }
+
+        for (std::size_t i = 0; i < point.saved_code_.size(); ++i)
+        {
+            auto at = point.address().addr() + i;
+            if (at >= address.addr() && at < address.addr() + amount)
+            {
+                buffer.begin()[at - address.addr()] = point.saved_code_[i];
+            }
+        }
+    });
+
+    breakpoint_sites_.for_each_in_region(address, address + amount, [&](const breakpoint_site& site) {
+        if (!site.is_enabled() || site.is_hardware())
+        {
+            return;
+        }
+
+        // For each breakpoint where we overwrote the instruction with int3,
+        // pretend it still has the original instruction
+        auto offset = site.address() - address.addr();
+        buffer.begin()[offset.addr()] = site.saved_data_;
+    });
+}
+
+void sdb::process::write_memory(sdb::virtual_address address, span<const std::byte> data, memory_write_method method)
+{
+    if (elf_ && elf_->contains_code(address, data.size()))
+    {
+        add_patched_code(address, data.size());
+    }
+
+    write_hidden_memory(address, data, method);
+}
+
+void sdb::process::add_patched_code(virtual_address address, std::size_t size)
+{
+    auto start = address.addr();
+    auto end = start + size;
+
+    // Merge with every range it overlaps or touches, so lookups need only one
+    auto it = patched_code_.upper_bound(start);
+    if (it != patched_code_.begin() && std::prev(it)->second >= start)
+    {
+        --it;
+    }
+    while (it != patched_code_.end() && it->first <= end)
+    {
+        start = std::min(start, it->first);
+        end = std::max(end, it->second);
+        it = patched_code_.erase(it);
+    }
+
+    patched_code_.emplace_hint(it, start, end);
+}
+
+bool sdb::process::is_patched_code(virtual_address address, std::size_t size) const
+{
+    // Ranges are disjoint, so only the last starting before the end can overlap
+    auto it = patched_code_.lower_bound(address.addr() + size);
+    return it != patched_code_.begin() && std::prev(it)->second > address.addr();
+}
+
+void sdb::process::write_hidden_memory(sdb::virtual_address address, span<const std::byte> data, memory_write_method method)
+{
+    // Breakpoint sites write through here too, so enabling one drops what it covers
+    instruction_cache_.invalidate(address, data.size());
+
+    std::size_t bytes_written = 0;
+    auto remaining = [&]() { return span<const std::byte>{data.begin() + bytes_written, data.end()}; };
+
+    switch (method)
+    {
+        case memory_write_method::Automatic:
+            // process_vm_writev stops short at the first page we can't write,
+            // e.g. program text, so pick up from there with the slower paths
+            bytes_written = write_memory_with_vm_writev(address, data);
+            if (bytes_written < data.size())
+            {
+                bytes_written += write_memory_with_proc_mem(address + bytes_written, remaining());
+            }
+            if (bytes_written < data.size())
+            {
+                bytes_written += write_memory_with_ptrace(address + bytes_written, remaining());
+            }
+            break;
+        case memory_write_method::VmWritev:
+            bytes_written = write_memory_with_vm_writev(address, data);
+            break;
+        case memory_write_method::ProcMem:
+            bytes_written = write_memory_with_proc_mem(address, data);
+            break;
+        case memory_write_method::Ptrace:
+            bytes_written = write_memory_with_ptrace(address, data);
+            break;
+    }
+
+    // Only the last path tried leaves errno, which is 0 if it stopped short without failing
+    if (bytes_written < data.size())
+    {
+        auto saved_errno = errno;
+        auto message = std::format("Could not write process memory at {:#x}, after {} of {} bytes",
+            (address + bytes_written).addr(), bytes_written, data.size());
+        if (saved_errno == 0)
+        {
+            error::send(message);
+        }
+        errno = saved_errno;
+        error::send_errno(message);
+    }
+}
+
+std::vector<const sdb::decoded_instruction*> sdb::process::decode_instructions(virtual_address address, std::size_t count)
+{
+    // The file's mapping saves a read through the inferior, and the patching back of our traps
+    std::vector<std::byte> memory;
+    return instruction_cache_.decode(address, count, [&](virtual_address at, std::size_t size) {
+        if (elf_)
+        {
+            auto code = elf_->code_at(at, size);
+            if (code.size() > 0 && !is_patched_code(at, code.size()))
+            {
+                return instruction_cache::code_read{code, false};
+            }
+        }
+
+        // Such as JIT or library code, which the inferior may rewrite whenever it runs
+        memory = read_memory_without_traps(at, size);
+        return instruction_cache::code_read{{memory.data(), memory.size()}, true};
+    });
+}
+
+const sdb::decoded_instruction& sdb::process::decode_instruction(virtual_address address)
+{
+    auto instructions = decode_instructions(address, 1);
+    if (instructions.empty())
+    {
+        error::send(std::format("Could not decode instruction at {:#x}", address.addr()));
+    }
+
+    return *instructions.front();
+}
+
+std::size_t sdb::process::write_memory_with_vm_writev(sdb::virtual_address address, span<const std::byte> data)
+{
+    std::size_t bytes_written = 0;
+    while (bytes_written < data.size())
+    {
+        auto remaining = data.size() - bytes_written;
+        iovec local_descriptor{const_cast<std::byte*>(data.begin() + bytes_written), remaining};
+        iovec remote_descriptor{reinterpret_cast<void*>((address + bytes_written).addr()), remaining};
+
+        // A partial write means we hit a page we can't write, which the next call reports
+        auto result = process_vm_writev(pid_, &local_descriptor, 1, &remote_descriptor, 1, 0);
+        if (result <= 0)
+        {
+            errno = result < 0 ? errno : 0;
+            break;
+        }
+
+        bytes_written += result;
+    }
+
+    return bytes_written;
+}
+
+std::size_t sdb::process::write_memory_with_proc_mem(sdb::virtual_address address, span<const std::byte> data)
+{
+    auto fd = memory_fd();
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    std::size_t bytes_written = 0;
+    while (bytes_written < data.size())
+    {
+        auto result = pwrite(fd, data.begin() + bytes_written, data.size() - bytes_written, (address + bytes_written).addr());
+        if (result <= 0)
+        {
+            errno = result < 0 ? errno : 0;
+            break;
+        }
+
+        bytes_written += result;
+    }
+
+    return bytes_written;
+}
+
+std::size_t sdb::process::write_memory_with_ptrace(sdb::virtual_address address, span<const std::byte> data)
+{
+    std::size_t bytes_written = 0;
+    while (bytes_written < data.size())
+    {
+        auto remaining = data.size() - bytes_written;
+        std::uint64_t word; // The size ptrace allows to write
+        if (remaining >= sizeof(word))
+        {
+            word = from_bytes<std::uint64_t>(data.begin() + bytes_written);
+        }
+        else
+        {
+            // We can only write 8 bytes, so if writing less we must first
+            // read 8 bytes, and write back in the existing bytes + our data
+            auto read = read_memory(address + bytes_written, sizeof(word));
+            auto word_data = reinterpret_cast<char*>(&word);
+            std::memcpy(word_data, data.begin() + bytes_written, remaining);
+            std::memcpy(word_data + remaining, read.data() + remaining, sizeof(word) - remaining);
+        }
+
+        if (ptrace(PTRACE_POKEDATA, pid_, address + bytes_written, word) < 0)
+        {
+            break;
+        }
+
+        bytes_written += std::min(remaining, sizeof(word));
+    }
+
+    return bytes_written;
+}
+
+int sdb::process::memory_fd()
+{
+    if (memory_fd_ < 0)
+    {
+        memory_fd_ = open(std::format("/proc/{}/mem", pid_).c_str(), O_RDWR | O_CLOEXEC);
+    }
+
+    return memory_fd_;
+}
@@ -1,5 +1,5 @@
-#include <libsdb/process.hpp>
 #include <libsdb/registers.hpp>
+#include <libsdb/thread.hpp>
 #include <libsdb/bit.hpp>
 
 #include <algorithm>
@@ -46,8 +46,84 @@ sdb::byte128 widen(const sdb::register_info& info, T t)
 }
 }
 
+void sdb::registers::invalidate()
+{
+    gprs_fetched_ = false;
+    fprs_fetched_ = false;
+    fetched_debug_registers_ = 0;
+}
+
+namespace
+{
+int debug_register_index(const sdb::register_info& info)
+{
+    return (info.offset - offsetof(user, u_debugreg)) / 8;
+}
+}
+
+void sdb::registers::fetch(const register_info& info) const
+{
+    if (thread_->state() != process_state::Stopped)
+    {
+        return;
+    }
+
+    switch (info.type)
+    {
+        case register_type::Gpr:
+        case register_type::SubGpr:
+            if (!gprs_fetched_)
+            {
+                thread_->read_gprs(data_.regs);
+                gprs_fetched_ = true;
+            }
+            break;
+        case register_type::Fpr:
+            if (!fprs_fetched_)
+            {
+                thread_->read_fprs(data_.i387);
+                fprs_fetched_ = true;
+            }
+            break;
+        case register_type::Dr:
+        {
+            // Each debug register takes its own PEEKUSER, so only read the one we need
+            auto index = debug_register_index(info);
+            if (!(fetched_debug_registers_ & (1 << index)))
+            {
+                data_.u_debugreg[index] = thread_->read_user_area(info.offset);
+                fetched_debug_registers_ |= 1 << index;
+            }
+            break;
+        }
+    }
+}
+
+bool sdb::registers::is_fetched(const register_info& info) const
+{
+    switch (info.type)
+    {
+        case register_type::Gpr:
+        case register_type::SubGpr:
+            return gprs_fetched_;
+        case register_type::Fpr:
+            return fprs_fetched_;
+        case register_type::Dr:
+            return fetched_debug_registers_ & (1 << debug_register_index(info));
+    }
+    return false;
+}
+
+const user_regs_struct& sdb::registers::read_gprs() const
+{
+    fetch(register_info_by_id(register_id::rip));
+    return data_.regs;
+}
+
 sdb::registers::value sdb::registers::read(const register_info& info) const
 {
+    fetch(info);
+
     auto bytes = as_bytes(data_);
 
     if (info.format == register_format::UnsignedInt)
@@ -86,6 +162,15 @@ sdb::registers::value sdb::registers::read(const register_info& info) const
 
 void sdb::registers::write(const register_info& info, value val)
 {
+    // We write back whole register sets, so need the current contents,
+    // but debug registers are written back one by one
+    auto overwrites_debug_register = info.type == register_type::Dr
+        && std::visit([&info](auto& v) { return sizeof(v) == info.size; }, val);
+    if (!overwrites_debug_register)
+    {
+        fetch(info);
+    }
+
     auto bytes = as_bytes(data_);
     std::visit([&info, &bytes](auto& v) {
         if (sizeof(v) <= info.size)
@@ -101,14 +186,45 @@ void sdb::registers::write(const register_info& info, value val)
         }
     }, val);
 
-    if (info.type == register_type::Fpr)
+    switch (info.type)
     {
-        proc_->write_fprs(data_.i387); 
+        case register_type::Gpr:
+        case register_type::SubGpr:
+            gprs_dirty_ = true;
+            break;
+        case register_type::Fpr:
+            fprs_dirty_ = true;
+            break;
+        case register_type::Dr:
+            fetched_debug_registers_ |= 1 << debug_register_index(info);
+            dirty_debug_registers_ |= 1 << debug_register_index(info);
+            break;
     }
-    else
+}
+
+void sdb::registers::flush()
+{
+    if (gprs_dirty_)
+    {
+        thread_->write_gprs(data_.regs);
+        gprs_dirty_ = false;
+    }
+
+    if (fprs_dirty_)
+    {
+        thread_->write_fprs(data_.i387);
+        fprs_dirty_ = false;
+    }
+
+    // There's no register set for the debug registers, so write each individually
+    for (int i = 0; i < 8; ++i)
     {
-        // Apparently PTRACE_PEEKUSER and PTRACE_POKEUSER need 8 byte aligned addresses
-        auto aligned_offset = info.offset & ~0b111;
-        proc_->write_user_area(aligned_offset, from_bytes<std::uint64_t>(bytes + aligned_offset));
+        if (dirty_debug_registers_ & (1 << i))
+        {
+            auto id = static_cast<int>(register_id::dr0) + i;
+            auto info = register_info_by_id(static_cast<register_id>(id));
+            thread_->write_user_area(info.offset, data_.u_debugreg[i]);
+        }
     }
+    dirty_debug_registers_ = 0;
 }
@@ -0,0 +1,127 @@
+#include <libsdb/relocate.hpp>
+#include <libsdb/error.hpp>
+
+#include <Zydis/Zydis.h>
+
+#include <cstring>
+#include <limits>
+
+namespace
+{
+// The displacement from end to target, which must fit in 32 bits
+std::int32_t rel32(std::uint64_t target, sdb::virtual_address end, sdb::virtual_address from)
+{
+    auto displacement = static_cast<std::int64_t>(target - end.addr());
+    if (displacement < std::numeric_limits<std::int32_t>::min() || displacement > std::numeric_limits<std::int32_t>::max())
+    {
+        sdb::error::send(std::format("Instruction at {:#x} can't reach {:#x} once moved", from.addr(), target));
+    }
+
+    return static_cast<std::int32_t>(displacement);
+}
+
+// Rewrites a jump or call to go to the same place from to, as rel32
+template <typename Immediate>
+void relocate_branch(sdb::relocated_instruction& result, const ZydisDecodedInstruction& instruction,
+                     const Immediate& imm, sdb::virtual_address from, sdb::virtual_address to)
+{
+    auto target = from.addr() + instruction.length + imm.value.s;
+    if (imm.size == 32)
+    {
+        auto displacement = rel32(target, to + instruction.length, from);
+        std::memcpy(result.code.data() + imm.offset, &displacement, sizeof(displacement));
+        return;
+    }
+
+    // Keep any prefixes, such as branch hints, and replace the opcode
+    result.code.resize(instruction.raw.prefix_count);
+    if (instruction.opcode == 0xeb)
+    {
+        result.code.push_back(std::byte{0xe9});
+    }
+    else if (instruction.opcode >= 0x70 && instruction.opcode <= 0x7f)
+    {
+        result.code.push_back(std::byte{0x0f});
+        result.code.push_back(static_cast<std::byte>(instruction.opcode + 0x10));
+    }
+    else
+    {
+        sdb::error::send(std::format("Can't move the short branch at {:#x}", from.addr()));
+    }
+
+    auto displacement = rel32(target, to + (result.code.size() + 4), from);
+    auto bytes = reinterpret_cast<const std::byte*>(&displacement);
+    result.code.insert(result.code.end(), bytes, bytes + sizeof(displacement));
+}
+}
+
+sdb::relocated_instruction sdb::relocate_instruction(span<const std::byte> code, virtual_address from, virtual_address to)
+{
+    ZydisDecoder decoder;
+    ZydisDecoderInit(&decoder, ZYDIS_MACHINE_MODE_LONG_64, ZYDIS_STACK_WIDTH_64);
+
+    ZydisDecodedInstruction instruction;
+    ZydisDecodedOperand operands[ZYDIS_MAX_OPERAND_COUNT];
+    if (!ZYAN_SUCCESS(ZydisDecoderDecodeFull(&decoder, code.begin(), code.size(), &instruction, operands)))
+    {
+        error::send(std::format("Could not decode instruction at {:#x}", from.addr()));
+    }
+
+    relocated_instruction result{};
+    result.length = instruction.length;
+    result.code.assign(code.begin(), code.begin() + instruction.length);
+
+    switch (instruction.meta.category)
+    {
+        case ZYDIS_CATEGORY_CALL:
+            result.is_branch = true;
+            result.is_call = true;
+            break;
+        case ZYDIS_CATEGORY_SYSCALL:
+            result.is_branch = true;
+            result.is_syscall = true;
+            break;
+        case ZYDIS_CATEGORY_RET:
+            result.is_branch = true;
+            result.is_return = true;
+            break;
+        case ZYDIS_CATEGORY_COND_BR:
+        case ZYDIS_CATEGORY_UNCOND_BR:
+        case ZYDIS_CATEGORY_SYSRET:
+        case ZYDIS_CATEGORY_INTERRUPT:
+            result.is_branch = true;
+            break;
+        default:
+            break;
+    }
+
+    if (!(instruction.attributes & ZYDIS_ATTRIB_IS_RELATIVE))
+    {
+        return result;
+    }
+
+    for (auto& imm : instruction.raw.imm)
+    {
+        if (imm.is_relative)
+        {
+            result.is_relative_branch = true;
+            result.branch_offset = imm.value.s;
+            if (from != to)
+            {
+                relocate_branch(result, instruction, imm, from, to);
+            }
+            return result;
+        }
+    }
+
+    if (from == to)
+    {
+        return result;
+    }
+
+    // Otherwise a rip-relative memory operand, whose displacement is always 32 bits
+    auto target = from.addr() + instruction.length + instruction.raw.disp.value;
+    auto displacement = rel32(target, to + instruction.length, from);
+    std::memcpy(result.code.data() + instruction.raw.disp.offset, &displacement, sizeof(displacement));
+    return result;
+}
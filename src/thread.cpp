@@ -0,0 +1,109 @@
+#include <libsdb/thread.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/error.hpp>
+
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+sdb::stop_reason::stop_reason(int wait_status)
+{
+    if (WIFEXITED(wait_status))
+    {
+        reason = process_state::Exited;
+        info = WEXITSTATUS(wait_status);
+    }
+    else if (WIFSIGNALED(wait_status))
+    {
+        reason = process_state::Terminated;
+        info = WTERMSIG(wait_status);
+    }
+    else if (WIFSTOPPED(wait_status))
+    {
+        reason = process_state::Stopped;
+        info = WSTOPSIG(wait_status);
+
+        if (auto ptrace_event = wait_status >> 16; ptrace_event != 0)
+        {
+            event = ptrace_event;
+        }
+    }
+}
+
+void sdb::thread::resume(bool single_step, int signal)
+{
+    registers_->flush();
+    process_->instruction_cache_.drop_volatile();
+
+    if (ptrace(single_step ? PTRACE_SINGLESTEP : PTRACE_CONT, tid_, nullptr, signal) < 0)
+    {
+        error::send_errno(single_step ? "Could not single step" : "Could not resume");
+    }
+
+    state_ = process_state::Running;
+    is_stepping_ = single_step;
+    registers_->invalidate();
+}
+
+bool sdb::thread::request_stop()
+{
+    if (process_->is_seized_)
+    {
+        return ptrace(PTRACE_INTERRUPT, tid_, nullptr, nullptr) == 0;
+    }
+
+    return syscall(SYS_tgkill, process_->pid(), tid_, SIGSTOP) == 0;
+}
+
+std::uint64_t sdb::thread::read_user_area(std::size_t offset) const
+{
+    errno = 0;
+    std::uint64_t data = ptrace(PTRACE_PEEKUSER, tid_, offset, nullptr);
+    if (errno != 0)
+    {
+        error::send_errno("Could not read from user area");
+    }
+
+    return data;
+}
+
+void sdb::thread::read_fprs(user_fpregs_struct& fprs) const
+{
+    if (ptrace(PTRACE_GETFPREGS, tid_, nullptr, &fprs) < 0)
+    {
+        error::send_errno("Could not read floating point registers");
+    }
+}
+
+void sdb::thread::read_gprs(user_regs_struct& gprs) const
+{
+    if (ptrace(PTRACE_GETREGS, tid_, nullptr, &gprs) < 0)
+    {
+        error::send_errno("Could not read general purpose registers");
+    }
+}
+
+void sdb::thread::write_user_area(std::size_t offset, std::uint64_t data)
+{
+    if (ptrace(PTRACE_POKEUSER, tid_, offset, data) < 0)
+    {
+        error::send_errno("Could not write to user area");
+    }
+}
+
+void sdb::thread::write_fprs(const user_fpregs_struct& fprs)
+{
+    if (ptrace(PTRACE_SETFPREGS, tid_, nullptr, &fprs) < 0)
+    {
+        error::send_errno("Could not write floating point registers");
+    }
+}
+
+void sdb::thread::write_gprs(const user_regs_struct& gprs)
+{
+    if (ptrace(PTRACE_SETREGS, tid_, nullptr, &gprs) < 0)
+    {
+        error::send_errno("Could not write general purpose registers");
+    }
+}
@@ -0,0 +1,196 @@
+#include <libsdb/trace_buffer.hpp>
+#include <libsdb/error.hpp>
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <utility>
+
+namespace
+{
+constexpr char cMagic[8] = {'S', 'D', 'B', 'T', 'R', 'A', 'C', 'E'};
+
+std::uint64_t round_up(std::uint64_t value)
+{
+    return (value + 7) & ~std::uint64_t{7};
+}
+}
+
+void sdb::trace_spec::validate() const
+{
+    for (auto id : registers)
+    {
+        auto& info = register_info_by_id(id);
+        if (info.format != register_format::UnsignedInt || info.size > 8 || info.dwarf_id < 0)
+        {
+            error::send(std::format("Register {} can't be traced", info.name));
+        }
+    }
+
+    if (memory.size() > cMaximumMemoryRanges)
+    {
+        error::send(std::format("Tracepoints can record at most {} memory ranges", cMaximumMemoryRanges));
+    }
+}
+
+std::size_t sdb::trace_spec::record_size() const
+{
+    auto size = trace_buffer::cRecordHeaderSize + registers.size() * 16;
+    for (auto& range : memory)
+    {
+        size += 16 + round_up(range.size);
+    }
+
+    return size;
+}
+
+sdb::trace_buffer::trace_buffer(std::size_t capacity)
+{
+    capacity = round_up(capacity);
+    memory_.resize(cHeaderSize + capacity);
+    data_ = memory_.data();
+    initialise(capacity);
+}
+
+sdb::trace_buffer::trace_buffer(const std::filesystem::path& path, std::size_t capacity)
+{
+    capacity = round_up(capacity);
+    auto fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error::send_errno(std::format("Could not open trace file {}", path.string()));
+    }
+
+    auto size = cHeaderSize + capacity;
+    if (ftruncate(fd, size) < 0)
+    {
+        close(fd);
+        error::send_errno("Could not size trace file");
+    }
+
+    // The mapping keeps the file open
+    auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        error::send_errno("Could not map trace file");
+    }
+
+    data_ = static_cast<std::byte*>(mapping);
+    mapped_size_ = size;
+    initialise(capacity);
+}
+
+sdb::trace_buffer::~trace_buffer()
+{
+    if (mapped_size_ != 0)
+    {
+        munmap(data_, mapped_size_);
+    }
+}
+
+void sdb::trace_buffer::initialise(std::size_t capacity)
+{
+    auto& head = get_header();
+    head = header{};
+    std::memcpy(head.magic, cMagic, sizeof(cMagic));
+    head.version = cVersion;
+    head.header_size = cHeaderSize;
+    head.capacity = capacity;
+}
+
+std::size_t sdb::trace_buffer::capacity() const
+{
+    return get_header().capacity;
+}
+
+std::size_t sdb::trace_buffer::size() const
+{
+    return get_header().count;
+}
+
+std::size_t sdb::trace_buffer::overwritten() const
+{
+    return get_header().overwritten;
+}
+
+std::uint64_t sdb::trace_buffer::wrap(std::uint64_t offset) const
+{
+    if (offset + cRecordHeaderSize > capacity())
+    {
+        return 0;
+    }
+
+    std::uint32_t size;
+    std::memcpy(&size, records() + offset, sizeof(size));
+    return size == 0 ? 0 : offset;
+}
+
+void sdb::trace_buffer::evict_oldest()
+{
+    auto& head = get_header();
+    head.oldest = wrap(head.oldest);
+    std::uint32_t size;
+    std::memcpy(&size, records() + head.oldest, sizeof(size));
+    head.oldest = wrap(head.oldest + size);
+    --head.count;
+    ++head.overwritten;
+}
+
+std::byte* sdb::trace_buffer::allocate(std::uint32_t size)
+{
+    auto& head = get_header();
+    if (size > head.capacity)
+    {
+        return nullptr;
+    }
+
+    auto position = head.next;
+    if (position + size > head.capacity)
+    {
+        // Whatever lies between here and the end is the oldest, and is lost as we wrap
+        while (head.count > 0 && head.oldest >= position)
+        {
+            evict_oldest();
+        }
+
+        if (position + cRecordHeaderSize <= head.capacity)
+        {
+            std::uint32_t wrap_marker = 0;
+            std::memcpy(records() + position, &wrap_marker, sizeof(wrap_marker));
+        }
+        position = 0;
+    }
+
+    // Records in the way of this one are either all before it or all after it
+    while (head.count > 0 && head.oldest >= position && head.oldest < position + size)
+    {
+        evict_oldest();
+    }
+
+    if (head.count == 0)
+    {
+        head.oldest = position;
+    }
+
+    auto record = records() + position;
+    std::memcpy(record, &size, sizeof(size));
+    std::memcpy(record + 8, &head.sequence, sizeof(head.sequence));
+
+    head.next = position + size;
+    ++head.count;
+    ++head.sequence;
+    return record;
+}
+
+void sdb::trace_buffer::dump(const std::filesystem::path& path) const
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(data_), cHeaderSize + capacity());
+    if (!file)
+    {
+        error::send(std::format("Could not write trace file {}", path.string()));
+    }
+}
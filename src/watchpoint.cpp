@@ -0,0 +1,86 @@
+#include <libsdb/watchpoint.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/error.hpp>
+
+#include <algorithm>
+
+namespace
+{
+auto get_next_id() {
+    static sdb::watchpoint::id_type id = 0;
+    return ++id;
+}
+}
+
+sdb::watchpoint::watchpoint(process& proc, virtual_address address, stoppoint_mode mode, std::size_t size)
+    : process_{&proc}, address_{address}, mode_{mode}, size_{size}, is_enabled_{false}
+{
+    if (size != 1 && size != 2 && size != 4 && size != 8)
+    {
+        error::send("Watchpoint size must be 1, 2, 4 or 8 bytes");
+    }
+
+    // The hardware ignores the low bits of the address
+    if ((address.addr() & (size - 1)) != 0)
+    {
+        error::send("Watchpoint must be aligned to its size");
+    }
+
+    if (mode == stoppoint_mode::Execute)
+    {
+        error::send("Use a hardware breakpoint site to trap on execution");
+    }
+
+    // Read first, as the destructor won't free the register if reading throws
+    update_data();
+    hardware_register_index_ = process_->allocate_debug_register(address_, mode_, size_);
+    id_ = get_next_id();
+}
+
+sdb::watchpoint::watchpoint(process& proc, const watchpoint& parent_watchpoint)
+    : id_{parent_watchpoint.id_}, process_{&proc}, address_{parent_watchpoint.address_}, mode_{parent_watchpoint.mode_},
+      size_{parent_watchpoint.size_}, is_enabled_{parent_watchpoint.is_enabled_}, data_{parent_watchpoint.data_},
+      previous_data_{parent_watchpoint.previous_data_}, hardware_register_index_{parent_watchpoint.hardware_register_index_}
+{
+}
+
+sdb::watchpoint::~watchpoint()
+{
+    if (hardware_register_index_ >= 0)
+    {
+        process_->free_debug_register(hardware_register_index_);
+    }
+}
+
+void sdb::watchpoint::enable()
+{
+    if (is_enabled_)
+    {
+        return;
+    }
+
+    process_->set_debug_register_enabled(hardware_register_index_, true);
+    is_enabled_ = true;
+}
+
+void sdb::watchpoint::disable()
+{
+    if (!is_enabled_)
+    {
+        return;
+    }
+
+    process_->set_debug_register_enabled(hardware_register_index_, false);
+    is_enabled_ = false;
+}
+
+void sdb::watchpoint::update_data()
+{
+    auto memory = process_->read_memory(address_, size_);
+
+    std::uint64_t new_data = 0;
+    std::copy(memory.begin(), memory.end(), reinterpret_cast<std::byte*>(&new_data));
+
+    previous_data_ = data_;
+    data_ = new_data;
+}
@@ -0,0 +1,835 @@
+#include <catch2/catch_test_macros.hpp>
+#include <libsdb/process.hpp>
+#include <libsdb/pipe.hpp>
+#include <libsdb/bit.hpp>
+#include <libsdb/disassembler.hpp>
+#include <libsdb/elf.hpp>
+#include <libsdb/expression.hpp>
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/line_table.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <print>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace sdb;
+
+namespace
+{
+constexpr auto cMinimumDuration{std::chrono::milliseconds(200)};
+
+// A duration as a count of Unit, such as std::milli, with the fraction kept
+template <typename Unit = std::ratio<1>>
+double count_in(std::chrono::steady_clock::duration duration)
+{
+    return std::chrono::duration<double, Unit>(duration).count();
+}
+
+// Run f repeatedly for at least cMinimumDuration, returning calls per second
+template <typename F>
+double calls_per_second(F&& f)
+{
+    std::size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = std::chrono::steady_clock::duration{};
+    while (elapsed < cMinimumDuration)
+    {
+        f();
+        ++calls;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+
+    return calls / count_in(elapsed);
+}
+
+template <typename F>
+void report_throughput(std::string_view name, std::size_t bytes_per_call, F&& f)
+{
+    auto bytes_per_second = calls_per_second(f) * bytes_per_call;
+    std::println("{:<48} {:>14.0f} bytes/s", name, bytes_per_second);
+}
+
+std::string_view method_name(memory_write_method method)
+{
+    switch (method)
+    {
+        case memory_write_method::Automatic: return "automatic";
+        case memory_write_method::VmWritev: return "process_vm_writev";
+        case memory_write_method::ProcMem: return "/proc/pid/mem";
+        case memory_write_method::Ptrace: return "PTRACE_POKEDATA";
+    }
+
+    return "unknown";
+}
+
+// An ELF file with nothing but count function symbols, function0() onwards, sixteen bytes each from 0x1000
+void write_symbol_file(const std::filesystem::path& path, std::size_t count)
+{
+    std::string strings(1, '\0');
+    std::vector<Elf64_Sym> symbols(1);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        auto name = std::format("function{}", i);
+        Elf64_Sym symbol{};
+        symbol.st_name = strings.size();
+        symbol.st_info = ELF64_ST_INFO(STB_GLOBAL, STT_FUNC);
+        symbol.st_shndx = 1;
+        symbol.st_value = 0x1000 + 16 * i;
+        symbol.st_size = 16;
+        symbols.push_back(symbol);
+        strings += std::format("_Z{}{}v", name.size(), name);
+        strings += '\0';
+    }
+    std::string section_names("\0.symtab\0.strtab\0.shstrtab\0.note.gnu.build-id\0", 46);
+
+    // A build ID, so the symbol index can be cached, which differs with count
+    std::string build_id = std::format("{:040x}", count);
+    std::string note(sizeof(Elf64_Nhdr), '\0');
+    Elf64_Nhdr note_header{4, static_cast<Elf64_Word>(build_id.size()), NT_GNU_BUILD_ID};
+    std::memcpy(note.data(), &note_header, sizeof(note_header));
+    note += std::string("GNU\0", 4) + build_id;
+
+    auto symbols_offset = sizeof(Elf64_Ehdr);
+    auto symbols_size = symbols.size() * sizeof(Elf64_Sym);
+    auto strings_offset = symbols_offset + symbols_size;
+    auto names_offset = strings_offset + strings.size();
+    auto note_offset = (names_offset + section_names.size() + 3) & ~std::size_t{3};
+    auto headers_offset = (note_offset + note.size() + 7) & ~std::size_t{7};
+
+    Elf64_Shdr sections[5]{};
+    sections[1] = {1, SHT_SYMTAB, 0, 0, symbols_offset, symbols_size, 2, 1, 8, sizeof(Elf64_Sym)};
+    sections[2] = {9, SHT_STRTAB, 0, 0, strings_offset, strings.size(), 0, 0, 1, 0};
+    sections[3] = {17, SHT_STRTAB, 0, 0, names_offset, section_names.size(), 0, 0, 1, 0};
+    sections[4] = {27, SHT_NOTE, SHF_ALLOC, 0, note_offset, note.size(), 0, 0, 4, 0};
+
+    Elf64_Ehdr header{};
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_shoff = headers_offset;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = 5;
+    header.e_shstrndx = 3;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(symbols.data()), symbols_size);
+    file.write(strings.data(), strings.size());
+    file.write(section_names.data(), section_names.size());
+    file.write("\0\0\0", note_offset - (names_offset + section_names.size()));
+    file.write(note.data(), note.size());
+    file.write("\0\0\0\0\0\0\0", headers_offset - (note_offset + note.size()));
+    file.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+}
+
+struct called_process
+{
+    std::unique_ptr<process> proc;
+    virtual_address address; // Of called, which targets/called calls 10000 times
+};
+
+// Stopped where targets/called reports called's address, before any calls
+called_process launch_called()
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("targets/called", true, channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto address_bytes = channel.read();
+    return {std::move(proc), virtual_address{from_bytes<std::uint64_t>(address_bytes.data())}};
+}
+
+// Resets the peak resident set size the kernel reports to the current one
+void reset_peak_rss()
+{
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+// VmHWM, in KiB
+std::size_t peak_rss()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.starts_with("VmHWM:"))
+        {
+            return std::stoull(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+// A DWARF 4 .debug_line with units of rows lines each, one line per four bytes of code.
+// Unit i is the whole of /src/file{i}.cpp, and its code starts at 0x1000 + i * 0x10000.
+std::vector<std::byte> write_line_table(std::size_t units, std::size_t rows)
+{
+    constexpr std::int8_t cLineBase{-5};
+    constexpr std::uint8_t cLineRange{14};
+    constexpr std::uint8_t cOpcodeBase{13};
+    // Four bytes and one line on
+    constexpr std::uint8_t cNextLine{(1 - cLineBase) + cLineRange * 4 + cOpcodeBase};
+
+    std::vector<std::byte> section;
+    auto append = [&section](const void* data, std::size_t size) {
+        auto bytes = static_cast<const std::byte*>(data);
+        section.insert(section.end(), bytes, bytes + size);
+    };
+    auto append_byte = [&section](std::uint8_t byte) { section.push_back(std::byte{byte}); };
+
+    for (std::size_t i = 0; i < units; ++i)
+    {
+        auto unit_start = section.size();
+        std::uint32_t length = 0;
+        std::uint16_t version = 4;
+        std::uint32_t header_length = 0;
+        append(&length, sizeof(length));
+        append(&version, sizeof(version));
+        auto header_start = section.size();
+        append(&header_length, sizeof(header_length));
+
+        for (auto byte : std::initializer_list<std::uint8_t>{1, 1, 1, static_cast<std::uint8_t>(cLineBase), cLineRange, cOpcodeBase})
+        {
+            append_byte(byte);
+        }
+        for (std::uint8_t operands : {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1})
+        {
+            append_byte(operands);
+        }
+        append("/src\0\0", 6);
+        auto name = std::format("file{}.cpp", i);
+        append(name.c_str(), name.size() + 1);
+        for (std::uint8_t byte : {1, 0, 0, 0})
+        {
+            append_byte(byte);
+        }
+
+        header_length = section.size() - header_start - sizeof(header_length);
+        std::memcpy(section.data() + header_start, &header_length, sizeof(header_length));
+
+        std::uint64_t address = 0x1000 + i * 0x10000;
+        for (std::uint8_t byte : {0, 9, 2})
+        {
+            append_byte(byte);
+        }
+        append(&address, sizeof(address));
+        for (std::size_t row = 0; row < rows; ++row)
+        {
+            append_byte(cNextLine);
+        }
+        for (std::uint8_t byte : {2, 4, 0, 1, 1})
+        {
+            append_byte(byte);
+        }
+
+        length = section.size() - unit_start - sizeof(length);
+        std::memcpy(section.data() + unit_start, &length, sizeof(length));
+    }
+
+    return section;
+}
+}
+
+TEST_CASE("Memory write throughput", "benchmark")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("targets/big_buffers", true, channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto addresses = channel.read();
+    REQUIRE(addresses.size() == 2 * sizeof(std::uint64_t));
+    virtual_address writable{from_bytes<std::uint64_t>(addresses.data())};
+    virtual_address read_only{from_bytes<std::uint64_t>(addresses.data() + sizeof(std::uint64_t))};
+
+    static constexpr std::size_t cSizes[] = {8, 4 << 10, 1 << 20};
+    std::vector<std::byte> data(cSizes[std::size(cSizes) - 1], std::byte{0x2a});
+
+    for (auto size : cSizes)
+    {
+        span<const std::byte> chunk{data.data(), size};
+        for (auto method : {memory_write_method::VmWritev, memory_write_method::ProcMem, memory_write_method::Ptrace})
+        {
+            auto name = std::format("writable {} B via {}", size, method_name(method));
+            report_throughput(name, size, [&] { proc->write_memory(writable, chunk, method); });
+        }
+
+        for (auto method : {memory_write_method::ProcMem, memory_write_method::Ptrace})
+        {
+            auto name = std::format("read only {} B via {}", size, method_name(method));
+            report_throughput(name, size, [&] { proc->write_memory(read_only, chunk, method); });
+        }
+    }
+}
+
+TEST_CASE("Attach pause time", "benchmark")
+{
+    auto target = process::launch("targets/run_endlessly", false);
+
+    static constexpr auto cIterations{100};
+    for (auto seize : {false, true})
+    {
+        auto time_to_first_stop = std::chrono::steady_clock::duration{};
+        auto pause_time = std::chrono::steady_clock::duration{};
+
+        for (auto i = 0; i < cIterations; ++i)
+        {
+            auto start = std::chrono::steady_clock::now();
+            auto proc = process::attach(target->pid(), seize);
+            auto stopped = std::chrono::steady_clock::now();
+
+            proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rip);
+            proc.reset(); // Detaches
+            auto detached = std::chrono::steady_clock::now();
+
+            time_to_first_stop += stopped - start;
+            pause_time += detached - stopped;
+        }
+
+        std::println("{:<24} time to first stop {:>8.1f} us, pause {:>8.1f} us",
+            seize ? "PTRACE_SEIZE" : "PTRACE_ATTACH", count_in<std::micro>(time_to_first_stop) / cIterations, count_in<std::micro>(pause_time) / cIterations);
+    }
+}
+
+TEST_CASE("Stop and resume all threads", "benchmark")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    bool seize = true;
+    auto proc = process::launch("targets/many_threads", true, channel.get_write(), seize);
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    static constexpr auto cIterations{20};
+    auto resume_time = std::chrono::steady_clock::duration{};
+    auto stop_time = std::chrono::steady_clock::duration{};
+    for (auto i = 0; i < cIterations; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        proc->resume();
+        auto resumed = std::chrono::steady_clock::now();
+        proc->interrupt();
+        proc->wait_on_signal();
+        auto stopped = std::chrono::steady_clock::now();
+
+        resume_time += resumed - start;
+        stop_time += stopped - resumed;
+    }
+
+    std::println("{} threads: resume all {:>8.1f} us, stop all {:>8.1f} us",
+        proc->threads().size(), count_in<std::micro>(resume_time) / cIterations, count_in<std::micro>(stop_time) / cIterations);
+}
+
+TEST_CASE("Breakpoint toggle cost", "benchmark")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    auto address = proc->get_program_counter();
+
+    for (auto hardware : {false, true})
+    {
+        auto& site = proc->create_breakpoint_site(address + hardware, hardware);
+        auto toggles_per_second = calls_per_second([&] {
+            site.enable();
+            site.disable();
+            // Hardware sites only reach the inferior when registers are flushed
+            proc->get_registers().flush();
+        });
+        std::println("{:<48} {:>14.0f} toggles/s", hardware ? "hardware breakpoint" : "int3 breakpoint", toggles_per_second);
+    }
+}
+
+TEST_CASE("Breakpoint site lookup", "benchmark")
+{
+    auto proc = process::launch("targets/run_endlessly");
+
+    std::uint64_t next_address = 0x1000;
+    for (auto count : {10, 1000, 100000})
+    {
+        // Spaced out like function entries, and never enabled so memory is untouched
+        while (proc->breakpoint_sites().size() < static_cast<std::size_t>(count))
+        {
+            proc->create_breakpoint_site(virtual_address{next_address});
+            next_address += 64;
+        }
+
+        std::uint64_t probe = 0x1000;
+        auto lookups_per_second = calls_per_second([&] {
+            probe = probe + 64 * 7919 < next_address ? probe + 64 * 7919 : probe + 64 * 7919 - (next_address - 0x1000);
+            proc->breakpoint_sites().enabled_stoppoint_at_address(virtual_address{probe});
+        });
+        auto regions_per_second = calls_per_second([&] {
+            proc->breakpoint_sites().get_in_region(virtual_address{probe}, virtual_address{probe + 4096});
+        });
+
+        std::println("{:>6} sites: {:>14.0f} address lookups/s, {:>14.0f} region queries/s", count, lookups_per_second, regions_per_second);
+    }
+}
+
+TEST_CASE("Bulk breakpoint toggle cost", "benchmark")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    auto address = proc->get_program_counter();
+
+    constexpr auto cSites = 1000;
+    for (auto i = 0; i < cSites; ++i)
+    {
+        proc->create_breakpoint_site(address + i);
+    }
+
+    auto& sites = proc->breakpoint_sites();
+    auto individual_per_second = calls_per_second([&] {
+        sites.for_each([](auto& site) { site.enable(); });
+        sites.for_each([](auto& site) { site.disable(); });
+    }) * cSites;
+    auto bulk_per_second = calls_per_second([&] {
+        sites.enable_all(address, address + cSites);
+        sites.disable_all(address, address + cSites);
+    }) * cSites;
+
+    std::println("{:<48} {:>14.0f} toggles/s", "int3 breakpoints one at a time", individual_per_second);
+    std::println("{:<48} {:>14.0f} toggles/s", "int3 breakpoints in bulk", bulk_per_second);
+}
+
+TEST_CASE("False breakpoint condition cost", "benchmark")
+{
+    constexpr auto cCalls = 10000; // Made by targets/called
+
+    for (auto hardware : {false, true})
+    {
+        auto [proc, address] = launch_called();
+
+        auto& site = proc->create_breakpoint_site(address, hardware);
+        site.set_condition(expression::compile("rdi == 0xffffffff && *(u64*)(rsp) != 0"));
+        site.enable();
+
+        auto start = std::chrono::steady_clock::now();
+        proc->resume();
+        proc->wait_on_signal();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        auto hits_per_second = cCalls / count_in(elapsed);
+        std::println("{:<48} {:>14.0f} hits/s", hardware ? "false condition, hardware breakpoint" : "false condition, int3 breakpoint", hits_per_second);
+    }
+}
+
+TEST_CASE("Tracepoint hit cost", "benchmark")
+{
+    constexpr auto cCalls = 10000; // Made by targets/called
+
+    auto [proc, address] = launch_called();
+
+    trace_spec spec;
+    spec.registers = {register_id::rdi, register_id::rsi, register_id::rsp};
+    spec.memory.push_back({expression::compile("rsp"), 64});
+    spec.memory.push_back({expression::compile("*(u64*)rsp"), 16});
+    proc->set_trace_buffer(std::make_shared<trace_buffer>(1 << 20));
+
+    auto& site = proc->create_breakpoint_site(address);
+    site.set_trace(std::move(spec));
+    site.enable();
+
+    auto start = std::chrono::steady_clock::now();
+    proc->resume();
+    proc->wait_on_signal();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    auto hits_per_second = cCalls / count_in(elapsed);
+    std::println("{:<48} {:>14.0f} hits/s", "tracepoint, 3 registers and 2 ranges", hits_per_second);
+}
+
+TEST_CASE("Fast tracepoint hit cost", "benchmark")
+{
+    constexpr auto cCalls = 10000; // Made by targets/called
+
+    auto [proc, address] = launch_called();
+
+    proc->create_fast_tracepoint(address).enable();
+
+    auto start = std::chrono::steady_clock::now();
+    proc->resume();
+    proc->wait_on_signal();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<fast_trace_record> records;
+    proc->drain_fast_trace(records);
+
+    auto hits_per_second = cCalls / count_in(elapsed);
+    std::println("{:<48} {:>14.0f} hits/s", "fast tracepoint, every register", hits_per_second);
+}
+
+TEST_CASE("Continue from breakpoint latency", "benchmark")
+{
+    constexpr auto cCalls = 10000; // Made by targets/called
+
+    // The same site in the prologue of called each way, which any of them can step over
+    for (auto mode : {step_over_mode::Remove, step_over_mode::Displace, step_over_mode::Emulate})
+    {
+        auto [proc, address] = launch_called();
+        proc->set_step_over_mode(mode);
+
+        auto& site = proc->create_breakpoint_site(address);
+        site.set_condition(expression::compile("0"));
+        site.enable();
+
+        auto start = std::chrono::steady_clock::now();
+        proc->resume();
+        proc->wait_on_signal();
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        auto hits_per_second = cCalls / count_in(elapsed);
+        auto name = mode == step_over_mode::Remove ? "continue, removing the site to step"
+            : mode == step_over_mode::Displace     ? "continue, stepping a displaced copy"
+                                                   : "continue, emulated";
+        std::println("{:<48} {:>14.0f} hits/s", name, hits_per_second);
+    }
+}
+
+TEST_CASE("Instruction recording rate", "benchmark")
+{
+    constexpr std::uint64_t cSteps{20000};
+
+    for (auto record_registers : {false, true})
+    {
+        auto [proc, address] = launch_called();
+
+        // Somewhere in the loop of calls, which is longer than we record
+        auto& site = proc->create_breakpoint_site(address);
+        site.enable();
+        proc->resume();
+        proc->wait_on_signal();
+        site.disable();
+
+        auto path = std::filesystem::temp_directory_path() / std::format("sdb_benchmark_{}", proc->pid());
+        instruction_trace_writer writer(path, record_registers);
+        auto start = std::chrono::steady_clock::now();
+        proc->record_instructions(writer, cSteps);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        writer.flush();
+
+        auto steps_per_second = writer.size() / count_in(elapsed);
+        std::println("{:<48} {:>14.0f} instructions/s", record_registers ? "recording pc and registers" : "recording pc", steps_per_second);
+        std::filesystem::remove(path);
+    }
+}
+
+TEST_CASE("Single step rate", "benchmark")
+{
+    constexpr std::uint64_t cSteps{20000};
+
+    for (auto one_at_a_time : {true, false})
+    {
+        auto [proc, address] = launch_called();
+
+        auto& site = proc->create_breakpoint_site(address);
+        site.enable();
+        proc->resume();
+        proc->wait_on_signal();
+        site.disable();
+
+        // One at a time is what a step command did for each instruction, including its report
+        auto start = std::chrono::steady_clock::now();
+        if (one_at_a_time)
+        {
+            disassembler dis(*proc);
+            for (std::uint64_t i = 0; i < cSteps; ++i)
+            {
+                proc->step_instruction();
+                dis.disassemble(5, proc->get_program_counter());
+            }
+        }
+        else
+        {
+            // Which never holds, so we step every time
+            proc->step_instructions(cSteps, [](const registers& regs) {
+                return regs.read_by_id_as<std::uint64_t>(register_id::rdi) == 0xffffffff;
+            });
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        auto steps_per_second = cSteps / count_in(elapsed);
+        std::println("{:<48} {:>14.0f} steps/s", one_at_a_time ? "step, one command at a time" : "step until, inside libsdb", steps_per_second);
+    }
+}
+
+TEST_CASE("Disassembly at a stop", "benchmark")
+{
+    constexpr std::uint64_t cStops{20000};
+
+    auto [proc, address] = launch_called();
+    auto code = proc->read_memory(address, 64);
+
+    // Writing the code back over itself drops it from the cache, so it is read and decoded again
+    disassembler dis(*proc);
+    for (auto cached : {false, true})
+    {
+        std::chrono::steady_clock::duration elapsed{};
+        for (std::uint64_t i = 0; i < cStops; ++i)
+        {
+            if (!cached)
+            {
+                proc->write_memory(address, {code.data(), code.size()});
+            }
+
+            auto start = std::chrono::steady_clock::now();
+            for (auto instruction : dis.disassemble(5, address))
+            {
+                instruction->text();
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+        }
+
+        auto stops_per_second = cStops / count_in(elapsed);
+        std::println("{:<48} {:>14.0f} stops/s", cached ? "disassemble 5, cached" : "disassemble 5, read and decoded", stops_per_second);
+    }
+}
+
+TEST_CASE("Disassembly throughput", "benchmark")
+{
+    constexpr std::size_t cChunk{256};
+    constexpr std::size_t cMaxInstructions{1 << 18};
+
+    // Our own executable is the biggest to hand, and it never runs past exec
+    auto proc = process::launch(std::filesystem::read_symlink("/proc/self/exe"));
+    auto file = proc->get_elf();
+    REQUIRE(file != nullptr);
+    auto entry = file->load_bias() + file->get_header().e_entry;
+
+    auto disassemble_from_entry = [&] {
+        std::size_t count = 0;
+        auto address = entry;
+        // Reading from the inferior runs past what we decode, so stay clear of the segment's end
+        while (count < cMaxInstructions && file->code_at(address, cChunk * 15).size() == cChunk * 15)
+        {
+            auto instructions = proc->decode_instructions(address, cChunk);
+            count += instructions.size();
+            if (instructions.size() < cChunk)
+            {
+                break;
+            }
+            address = instructions.back()->address + instructions.back()->length;
+        }
+        return std::pair{count, address};
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    auto [count, end] = disassemble_from_entry();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::println("{:<48} {:>14.0f} instructions/s", "disassemble from the ELF file", count / count_in(elapsed));
+
+    // Writing the code back over itself means it must be read from the inferior
+    auto code = proc->read_memory(entry, end.addr() - entry.addr());
+    proc->write_memory(entry, {code.data(), code.size()});
+
+    start = std::chrono::steady_clock::now();
+    count = disassemble_from_entry().first;
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::println("{:<48} {:>14.0f} instructions/s", "disassemble from inferior memory", count / count_in(elapsed));
+}
+
+TEST_CASE("Symbol table load and lookup", "benchmark")
+{
+    constexpr std::size_t cSymbols{1 << 20};
+    constexpr std::size_t cNames{1024};
+
+    auto path = std::filesystem::temp_directory_path() / "sdb_benchmark_symbols";
+    write_symbol_file(path, cSymbols);
+
+    auto start = std::chrono::steady_clock::now();
+    elf file(path);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(file.symbol_count() == cSymbols);
+    std::println("{:<48} {:>14.1f} ms", "load 1M symbols", count_in<std::milli>(elapsed));
+
+    // Scattered, so the search isn't all in cache
+    std::uint64_t random = 1;
+    auto by_address = calls_per_second([&] {
+        random = random * 6364136223846793005 + 1442695040888963407;
+        file.get_symbol_containing_address(virtual_address{0x1000 + (random >> 20) % (cSymbols * 16)});
+    });
+    std::println("{:<48} {:>14.0f} lookups/s", "symbol containing address", by_address);
+
+    std::vector<std::string> names;
+    for (std::size_t i = 0; i < cNames; ++i)
+    {
+        auto name = std::format("function{}", i * (cSymbols / cNames));
+        names.push_back(std::format("_Z{}{}v", name.size(), name));
+    }
+    std::size_t next = 0;
+    auto by_name = calls_per_second([&] {
+        file.get_symbols_by_name(names[next++ % cNames]);
+    });
+    std::println("{:<48} {:>14.0f} lookups/s", "symbol by mangled name", by_name);
+
+    // Demangles every symbol, once
+    start = std::chrono::steady_clock::now();
+    REQUIRE(file.get_symbols_by_name("function12345").size() == 1);
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::println("{:<48} {:>14.1f} ms", "first lookup by demangled name", count_in<std::milli>(elapsed));
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Symbol index cold and warm start", "benchmark")
+{
+    constexpr std::size_t cSymbols{1 << 20};
+    constexpr auto cIterations{5};
+
+    auto cache = std::filesystem::temp_directory_path() / "sdb_benchmark_index";
+    auto path = std::filesystem::temp_directory_path() / "sdb_benchmark_indexed_symbols";
+    write_symbol_file(path, cSymbols);
+
+    std::filesystem::remove_all(cache);
+    auto start = std::chrono::steady_clock::now();
+    elf cold(path, cache);
+    auto cold_elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(!cold.is_index_cached());
+
+    start = std::chrono::steady_clock::now();
+    elf warm(path, cache);
+    auto warm_elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(warm.is_index_cached());
+    REQUIRE(warm.get_symbols_by_name("_Z14function123456v").size() == 1);
+
+    std::println("{:<48} {:>14.1f} ms", "load 1M symbols, building the index", count_in<std::milli>(cold_elapsed));
+    std::println("{:<48} {:>14.1f} ms", "load 1M symbols, mapping the cached index", count_in<std::milli>(warm_elapsed));
+
+    // Attaching ends by loading the inferior's ELF file, as process::load_elf
+    // does, before the first prompt. That of a target this size stands in for it.
+    auto previous_cache_home = std::getenv("XDG_CACHE_HOME");
+    auto saved_cache_home = previous_cache_home ? std::optional<std::string>{previous_cache_home} : std::nullopt;
+    setenv("XDG_CACHE_HOME", cache.c_str(), 1);
+
+    for (auto warm_start : {false, true})
+    {
+        auto elapsed = std::chrono::steady_clock::duration{};
+        for (auto i = 0; i < cIterations; ++i)
+        {
+            if (!warm_start)
+            {
+                std::filesystem::remove_all(cache);
+            }
+
+            start = std::chrono::steady_clock::now();
+            auto file = std::make_shared<elf>(path, elf::default_cache_directory());
+            elapsed += std::chrono::steady_clock::now() - start;
+            REQUIRE(file->symbol_count() == cSymbols);
+            REQUIRE(file->is_index_cached() == warm_start);
+        }
+
+        std::println("{:<48} {:>14.1f} ms", warm_start ? "attach to 1M symbols, warm start" : "attach to 1M symbols, cold start",
+            count_in<std::milli>(elapsed) / cIterations);
+    }
+
+    if (saved_cache_home)
+    {
+        setenv("XDG_CACHE_HOME", saved_cache_home->c_str(), 1);
+    }
+    else
+    {
+        unsetenv("XDG_CACHE_HOME");
+    }
+    std::filesystem::remove_all(cache);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Line table lookup", "benchmark")
+{
+    constexpr std::size_t cUnits{1000};
+    constexpr std::size_t cRows{1000};
+    auto section = write_line_table(cUnits, cRows);
+
+    auto start = std::chrono::steady_clock::now();
+    line_table lines({section.data(), section.size()}, {}, {});
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(lines.unit_count() == cUnits);
+    std::println("{:<48} {:>14.3f} ms", "find 1000 units", count_in<std::milli>(elapsed));
+
+    // Only the unit with the file is decoded
+    start = std::chrono::steady_clock::now();
+    auto addresses = lines.get_addresses("file999.cpp", 500);
+    elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(addresses.size() == 1);
+    REQUIRE(lines.decoded_unit_count() == 1);
+    std::println("{:<48} {:>14.3f} ms", "first breakpoint by file:line", count_in<std::milli>(elapsed));
+
+    start = std::chrono::steady_clock::now();
+    auto location = lines.get_location(virtual_address{0x1000 + (cUnits - 2) * 0x10000 + 40});
+    elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(location);
+    REQUIRE(location->file == "/src/file998.cpp");
+    std::println("{:<48} {:>14.3f} ms", "first lookup by address, decoding 998 units", count_in<std::milli>(elapsed));
+
+    std::uint64_t random = 1;
+    auto by_address = calls_per_second([&] {
+        random = random * 6364136223846793005 + 1442695040888963407;
+        auto unit = (random >> 20) % cUnits;
+        lines.get_location(virtual_address{0x1000 + unit * 0x10000 + (random >> 40) % (cRows * 4)});
+    });
+    std::println("{:<48} {:>14.0f} lookups/s", "line containing address", by_address);
+
+    std::size_t next = 0;
+    auto by_line = calls_per_second([&] {
+        lines.get_addresses(std::format("file{}.cpp", next++ % cUnits), 500);
+    });
+    std::println("{:<48} {:>14.0f} lookups/s", "address of file:line", by_line);
+}
+
+TEST_CASE("Compressed debug section decompression", "benchmark")
+{
+    constexpr auto cPath{"targets/compressed_debug"};
+    static constexpr std::string_view cSections[] = {".debug_info", ".debug_abbrev", ".debug_line", ".debug_str", ".debug_line_str"};
+    auto cache = std::filesystem::temp_directory_path() / "sdb_benchmark_sections";
+    std::filesystem::remove_all(cache);
+
+    // Each starts from just having mapped the file, as a session would
+    auto measure = [&](std::string_view name, std::optional<std::filesystem::path> cache_directory) {
+        elf file(cPath, cache_directory);
+        reset_peak_rss();
+        auto rss_before = peak_rss();
+
+        auto start = std::chrono::steady_clock::now();
+        auto addresses = file.get_line_table().get_addresses("compressed_debug.cpp", 24);
+        auto first_lookup = std::chrono::steady_clock::now() - start;
+        REQUIRE(addresses.size() == 1);
+
+        std::size_t decompressed = 0;
+        for (auto section : cSections)
+        {
+            decompressed += file.get_section_contents(section).size();
+        }
+        auto every_section = std::chrono::steady_clock::now() - start;
+
+        std::println("{:<24} first lookup {:>8.3f} ms, every section {:>8.3f} ms ({} KiB), peak RSS +{} KiB",
+            name, count_in<std::milli>(first_lookup),
+            count_in<std::milli>(every_section), decompressed / 1024, peak_rss() - rss_before);
+    };
+
+    measure("uncached", std::nullopt);
+    measure("cold cache", cache);
+    measure("warm cache", cache);
+
+    std::filesystem::remove_all(cache);
+}
@@ -0,0 +1,23 @@
+#include <sys/signal.h>
+#include <unistd.h>
+
+namespace
+{
+constexpr auto cBufferSize{1 << 20};
+
+char writable_buffer[cBufferSize];
+
+// Initialised so that it lands in .rodata and is mapped read only
+const char read_only_buffer[cBufferSize] = {1};
+}
+
+int main()
+{
+    auto writable_address = &writable_buffer;
+    write(STDOUT_FILENO, &writable_address, sizeof(void*));
+
+    auto read_only_address = &read_only_buffer;
+    write(STDOUT_FILENO, &read_only_address, sizeof(void*));
+
+    raise(SIGTRAP);
+}
@@ -0,0 +1,27 @@
+#include <unistd.h>
+#include <signal.h>
+
+#include <cstdint>
+
+// Never inlined, so every call reaches a breakpoint on its first instruction
+__attribute__((noinline)) std::uint64_t called(std::uint64_t n)
+{
+    return n * 2;
+}
+
+int main()
+{
+    auto function_address = &called;
+    write(STDOUT_FILENO, &function_address, sizeof(void*));
+    raise(SIGTRAP);
+
+    volatile std::uint64_t total = 0;
+    for (std::uint64_t i = 0; i < 10000; ++i)
+    {
+        total = total + called(i);
+    }
+
+    // So whatever was recorded can be read before we exit
+    raise(SIGTRAP);
+    return 0;
+}
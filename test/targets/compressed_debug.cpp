@@ -0,0 +1,25 @@
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+// Each instance is its own function, for debug sections big enough that decompressing them shows
+template <int N>
+__attribute__((noinline)) std::size_t instance(std::size_t n)
+{
+    std::vector<std::string> strings(n, std::to_string(N));
+    std::map<int, std::string> by_index;
+    by_index[N] = strings.front();
+    return by_index.size() + instance<N - 1>(n);
+}
+
+template <>
+std::size_t instance<0>(std::size_t)
+{
+    return 0;
+}
+
+int main()
+{
+    return instance<500>(1) == 500 ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include <sys/signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+// Called by both parents and children, so a breakpoint here is hit by whichever we trace
+__attribute__((noinline)) void in_every_process()
+{
+    asm volatile("" ::: "memory");
+}
+
+int exit_code(int status)
+{
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+}
+
+int main()
+{
+    auto address = &in_every_process;
+    write(STDOUT_FILENO, &address, sizeof(void*));
+
+    raise(SIGTRAP);
+
+    if (auto child = fork(); child == 0)
+    {
+        in_every_process();
+        _exit(42);
+    }
+    else
+    {
+        int status;
+        waitpid(child, &status, 0);
+        if (exit_code(status) != 42)
+        {
+            return 1;
+        }
+    }
+
+    if (auto child = vfork(); child == 0)
+    {
+        in_every_process();
+        _exit(43);
+    }
+    else
+    {
+        int status;
+        waitpid(child, &status, 0);
+        if (exit_code(status) != 43)
+        {
+            return 2;
+        }
+    }
+
+    in_every_process();
+}
@@ -0,0 +1,49 @@
+#include <sys/signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr auto cThreadCount{500};
+
+std::atomic<int> started_threads{0};
+
+void worker_tick()
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+}
+
+int main()
+{
+    std::vector<std::thread> threads;
+    for (auto i = 0; i < cThreadCount; ++i)
+    {
+        threads.emplace_back([] {
+            ++started_threads;
+            while (true)
+            {
+                worker_tick();
+            }
+        });
+    }
+
+    while (started_threads < cThreadCount)
+    {
+        std::this_thread::yield();
+    }
+
+    auto tick_address = &worker_tick;
+    write(STDOUT_FILENO, &tick_address, sizeof(void*));
+
+    raise(SIGTRAP);
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
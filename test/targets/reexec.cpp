@@ -0,0 +1,15 @@
+#include <sys/signal.h>
+#include <unistd.h>
+
+int main(int argc, char** argv)
+{
+    if (argc > 1)
+    {
+        return 0;
+    }
+
+    raise(SIGTRAP);
+
+    execl("/proc/self/exe", argv[0], "again", nullptr);
+    return 1;
+}
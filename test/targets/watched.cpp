@@ -0,0 +1,26 @@
+#include <unistd.h>
+#include <signal.h>
+
+#include <cstdint>
+
+volatile std::uint32_t g_counter = 0;
+
+int main()
+{
+    auto counter_address = &g_counter;
+    write(STDOUT_FILENO, &counter_address, sizeof(void*));
+    raise(SIGTRAP);
+
+    for (auto i = 0; i < 3; ++i)
+    {
+        g_counter = g_counter + 1;
+    }
+
+    std::uint32_t total = 0;
+    for (auto i = 0; i < 2; ++i)
+    {
+        total += g_counter;
+    }
+
+    return total == 6 ? 0 : 1;
+}
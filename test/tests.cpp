@@ -3,12 +3,22 @@
 #include <libsdb/error.hpp>
 #include <libsdb/pipe.hpp>
 #include <libsdb/bit.hpp>
+#include <libsdb/disassembler.hpp>
+#include <libsdb/event_loop.hpp>
+#include <libsdb/expression.hpp>
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/line_table.hpp>
 
+#include <sys/ptrace.h>
 #include <sys/types.h>
 
 #include <elf.h>
+#include <zstd.h>
 
+#include <algorithm>
+#include <cstring>
 #include <fstream>
+#include <limits>
 #include <format>
 #include <regex>
 
@@ -62,6 +72,26 @@ virtual_address get_load_address(pid_t pid, std::int64_t offset)
 
     throw std::runtime_error{"Failed to find address"};
 }
+
+// Launches targets/called, stopped before its calls, returning the address of called
+virtual_address launch_called(std::unique_ptr<process>& proc)
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    proc = process::launch("targets/called", true, channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto address_bytes = channel.read();
+    return virtual_address{from_bytes<std::uint64_t>(address_bytes.data())};
+}
+
+sdb::task wait_for_stop(process& proc, std::optional<stop_reason>& reason)
+{
+    reason = co_await proc.stopped();
+}
 }
 
 TEST_CASE("Launching", "process")
@@ -80,7 +110,316 @@ TEST_CASE("Attaching", "process")
     auto target = process::launch("targets/run_endlessly", false);
     auto proc = process::attach(target->pid());
     static constexpr char cStoppedUnderTrace{'t'};
-    REQUIRE(get_process_status(target->pid() == cStoppedUnderTrace));
+    REQUIRE(get_process_status(target->pid()) == cStoppedUnderTrace);
+}
+
+TEST_CASE("Seizing", "process")
+{
+    auto target = process::launch("targets/run_endlessly", false);
+    bool seize = true;
+    auto proc = process::attach(target->pid(), seize);
+
+    static constexpr char cStoppedUnderTrace{'t'};
+    REQUIRE(get_process_status(target->pid()) == cStoppedUnderTrace);
+    REQUIRE(proc->get_program_counter().addr() != 0);
+}
+
+TEST_CASE("Launching seized", "process")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+
+    bool seize = true;
+    auto proc = process::launch("targets/hello_sdb", true, channel.get_write(), seize);
+    channel.close_write();
+
+    auto offset = get_entry_point("targets/hello_sdb");
+    auto load_address = get_load_address(proc->pid(), offset);
+
+    proc->create_breakpoint_site(load_address).enable();
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(!reason.event.has_value());
+    REQUIRE(proc->get_program_counter() == load_address);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Exited);
+
+    auto data = channel.read();
+    REQUIRE(to_string_view(data) == "Hello, sdb!\n");
+}
+
+TEST_CASE("Interrupting seized process", "process")
+{
+    bool seize = true;
+    auto proc = process::launch("targets/run_endlessly", true, std::nullopt, seize);
+    proc->resume();
+    proc->interrupt();
+    auto reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(reason.event == PTRACE_EVENT_STOP);
+}
+
+TEST_CASE("New threads are traced", "thread")
+{
+    for (auto seize : {false, true})
+    {
+        bool close_on_exec = false;
+        sdb::pipe channel(close_on_exec);
+        auto proc = process::launch("targets/many_threads", true, channel.get_write(), seize);
+        channel.close_write();
+
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(reason.info == SIGTRAP);
+        REQUIRE(proc->current_thread().tid() == proc->pid());
+
+        static constexpr auto cThreadCount{501};
+        REQUIRE(proc->threads().size() == cThreadCount);
+        for (auto& [tid, thread] : proc->threads())
+        {
+            REQUIRE(thread->state() == process_state::Stopped);
+        }
+
+        proc->resume();
+        proc->interrupt();
+        proc->wait_on_signal();
+        for (auto& [tid, thread] : proc->threads())
+        {
+            REQUIRE(thread->state() == process_state::Stopped);
+        }
+    }
+}
+
+TEST_CASE("Breakpoint hit on another thread", "thread")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    bool seize = true;
+    auto proc = process::launch("targets/many_threads", true, channel.get_write(), seize);
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    virtual_address tick_address{from_bytes<std::uint64_t>(channel.read().data())};
+    proc->create_breakpoint_site(tick_address).enable();
+
+    for (auto i = 0; i < 3; ++i)
+    {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(reason.info == SIGTRAP);
+        REQUIRE(proc->current_thread().tid() != proc->pid());
+        REQUIRE(proc->get_program_counter() == tick_address);
+    }
+
+    auto other_tid = proc->current_thread().tid();
+    proc->set_current_thread(proc->pid());
+    REQUIRE(proc->current_thread().tid() == proc->pid());
+    REQUIRE(proc->get_program_counter() != tick_address);
+    proc->set_current_thread(other_tid);
+    REQUIRE_THROWS_AS(proc->set_current_thread(0), error);
+}
+
+TEST_CASE("Following the parent removes breakpoints from children", "fork")
+{
+    for (auto seize : {false, true})
+    {
+        bool close_on_exec = false;
+        sdb::pipe channel(close_on_exec);
+        auto proc = process::launch("targets/forks", true, channel.get_write(), seize);
+        channel.close_write();
+
+        proc->resume();
+        proc->wait_on_signal();
+
+        virtual_address address{from_bytes<std::uint64_t>(channel.read().data())};
+        proc->create_breakpoint_site(address).enable();
+
+        // Children which hit our int3 untraced would die, and the parent would fail
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(reason.info == SIGTRAP);
+        REQUIRE(proc->current_thread().tid() == proc->pid());
+        REQUIRE(proc->get_program_counter() == address);
+
+        proc->resume();
+        reason = proc->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Exited);
+        REQUIRE(reason.info == 0);
+    }
+}
+
+TEST_CASE("Following the child", "fork")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("targets/forks", true, channel.get_write());
+    channel.close_write();
+    proc->set_follow_fork_mode(follow_fork_mode::Child);
+
+    proc->resume();
+    proc->wait_on_signal();
+    auto parent_pid = proc->pid();
+
+    virtual_address address{from_bytes<std::uint64_t>(channel.read().data())};
+    proc->create_breakpoint_site(address).enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(proc->pid() != parent_pid);
+    REQUIRE(proc->get_program_counter() == address);
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Exited);
+    REQUIRE(reason.info == 42);
+}
+
+TEST_CASE("Following both parent and child", "fork")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    bool seize = true;
+    auto proc = process::launch("targets/forks", true, channel.get_write(), seize);
+    channel.close_write();
+    proc->set_follow_fork_mode(follow_fork_mode::Both);
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    virtual_address address{from_bytes<std::uint64_t>(channel.read().data())};
+    auto& site = proc->create_breakpoint_site(address);
+    site.enable();
+
+    for (auto [event, exit_code] : {std::pair{PTRACE_EVENT_FORK, 42}, std::pair{PTRACE_EVENT_VFORK, 43}})
+    {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(reason.event == event);
+
+        auto children = proc->take_forked_processes();
+        REQUIRE(children.size() == 1);
+        auto& child = children[0];
+        REQUIRE(child->breakpoint_sites().get_by_address(address).id() == site.id());
+
+        child->resume();
+        reason = child->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(child->get_program_counter() == address);
+
+        child->resume();
+        reason = child->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Exited);
+        REQUIRE(reason.info == exit_code);
+    }
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(proc->get_program_counter() == address);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Exited);
+    REQUIRE(reason.info == 0);
+}
+
+TEST_CASE("Exec invalidates breakpoints and memory", "fork")
+{
+    auto proc = process::launch("targets/reexec");
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto program_counter = proc->get_program_counter();
+    proc->create_breakpoint_site(program_counter).enable();
+    auto code = proc->read_memory_without_traps(program_counter, 8);
+    proc->write_memory(program_counter + 1, {code.data() + 1, code.size() - 1}, memory_write_method::ProcMem);
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.event == PTRACE_EVENT_EXEC);
+    REQUIRE(proc->breakpoint_sites().empty());
+
+    // Our /proc/<pid>/mem from before the exec can no longer write anything
+    program_counter = proc->get_program_counter();
+    code = proc->read_memory(program_counter, 8);
+    REQUIRE_NOTHROW(proc->write_memory(program_counter, {code.data(), code.size()}, memory_write_method::ProcMem));
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Exited);
+    REQUIRE(reason.info == 0);
+}
+
+TEST_CASE("Polling for a stop", "event_loop")
+{
+    bool seize = true;
+    auto proc = process::launch("targets/run_endlessly", true, std::nullopt, seize);
+    proc->resume();
+    REQUIRE(!proc->try_wait_on_signal().has_value());
+
+    proc->interrupt();
+    std::optional<stop_reason> reason;
+    while (!reason)
+    {
+        reason = proc->try_wait_on_signal();
+    }
+
+    REQUIRE(reason->reason == process_state::Stopped);
+    REQUIRE(reason->info == SIGTRAP);
+    REQUIRE(reason->event == PTRACE_EVENT_STOP);
+    REQUIRE(proc->state() == process_state::Stopped);
+}
+
+TEST_CASE("One event loop drives several processes", "event_loop")
+{
+    event_loop loop;
+    bool seize = true;
+    auto endless = process::launch("targets/run_endlessly", true, std::nullopt, seize);
+    auto ending = process::launch("targets/end_immediately");
+    loop.add_process(*endless);
+    loop.add_process(*ending);
+
+    std::optional<stop_reason> endless_reason;
+    endless->resume();
+    auto endless_task = wait_for_stop(*endless, endless_reason);
+
+    std::optional<stop_reason> ending_reason;
+    ending->resume();
+    auto ending_task = wait_for_stop(*ending, ending_reason);
+
+    while (!ending_task.done())
+    {
+        loop.run_once();
+    }
+    REQUIRE(ending_reason->reason == process_state::Exited);
+    REQUIRE(!endless_task.done());
+
+    endless->interrupt();
+    while (!endless_task.done())
+    {
+        loop.run_once();
+    }
+    REQUIRE(endless_reason->reason == process_state::Stopped);
+    REQUIRE(endless_reason->event == PTRACE_EVENT_STOP);
+
+    loop.remove_process(*endless);
+    loop.remove_process(*ending);
 }
 
 TEST_CASE("Attaching invalid pid", "process")
@@ -215,6 +554,56 @@ TEST_CASE("Read register", "register")
     REQUIRE(regs.read_by_id_as<long double>(register_id::st0) == 64.125L);
 }
 
+TEST_CASE("Register writes are cached until flushed", "register")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    auto& regs = proc->get_registers();
+
+    regs.write_by_id(register_id::r13, std::uint64_t{0xcafecafe});
+    REQUIRE(regs.read_by_id_as<std::uint64_t>(register_id::r13) == 0xcafecafe);
+
+    user_regs_struct gprs;
+    proc->current_thread().read_gprs(gprs);
+    REQUIRE(gprs.r13 != 0xcafecafe);
+
+    regs.flush();
+    proc->current_thread().read_gprs(gprs);
+    REQUIRE(gprs.r13 == 0xcafecafe);
+}
+
+TEST_CASE("Registers are only fetched when first read after a stop", "register")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    proc->resume();
+    proc->interrupt();
+    proc->wait_on_signal();
+
+    auto& regs = proc->get_registers();
+    auto fetched = [&](register_id id) { return regs.is_fetched(register_info_by_id(id)); };
+    REQUIRE(!fetched(register_id::rip));
+    REQUIRE(!fetched(register_id::xmm0));
+    REQUIRE(!fetched(register_id::dr6));
+
+    // Reading rip fetches the other general purpose registers with it, but nothing else
+    proc->get_program_counter();
+    REQUIRE(fetched(register_id::rip));
+    REQUIRE(fetched(register_id::rsp));
+    REQUIRE(!fetched(register_id::xmm0));
+    REQUIRE(!fetched(register_id::st0));
+    REQUIRE(!fetched(register_id::dr6));
+    REQUIRE(!fetched(register_id::dr7));
+
+    regs.read_by_id_as<std::uint64_t>(register_id::dr7);
+    REQUIRE(fetched(register_id::dr7));
+    REQUIRE(!fetched(register_id::dr6));
+
+    proc->resume();
+    proc->interrupt();
+    proc->wait_on_signal();
+    REQUIRE(!fetched(register_id::rip));
+    REQUIRE(!fetched(register_id::dr7));
+}
+
 TEST_CASE("Create breakpoint site", "breakpoint")
 {
     auto proc = process::launch("targets/run_endlessly");
@@ -351,44 +740,1080 @@ TEST_CASE("Breakpoint on address works", "breakpoint")
     REQUIRE(to_string_view(data) == "Hello, sdb!\n");
 }
 
-TEST_CASE("Can remove breakpoint sites", "breakpoint")
+TEST_CASE("Hardware breakpoint on address works", "breakpoint")
 {
-    auto proc = process::launch("targets/run_endlessly");
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
 
-    auto& site = proc->create_breakpoint_site(virtual_address{ 42 });
-    proc->create_breakpoint_site(virtual_address{ 43 });
-    REQUIRE(proc->breakpoint_sites().size() == 2);
+    auto proc = process::launch("targets/hello_sdb", true, channel.get_write());
+    channel.close_write();
 
-    proc->breakpoint_sites().remove_by_id(site.id());
-    proc->breakpoint_sites().remove_by_address(virtual_address{ 43 });
-    REQUIRE(proc->breakpoint_sites().empty());
+    auto offset = get_entry_point("targets/hello_sdb");
+    auto load_address = get_load_address(proc->pid(), offset);
+    auto original_code = proc->read_memory(load_address, 8);
+
+    auto& site = proc->create_breakpoint_site(load_address, true);
+    site.enable();
+    REQUIRE(site.is_hardware());
+    REQUIRE(proc->read_memory(load_address, 8) == original_code);
+    REQUIRE((proc->get_registers().read_by_id_as<std::uint64_t>(register_id::dr7) & 0b11) == 0b01);
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(proc->get_program_counter() == load_address);
+
+    // Resuming continues from the breakpoint without stepping over it first
+    proc->resume();
+    reason = proc->wait_on_signal();
+
+    REQUIRE(reason.reason == process_state::Exited);
+    REQUIRE(reason.info == 0);
+
+    auto data = channel.read();
+    REQUIRE(to_string_view(data) == "Hello, sdb!\n");
 }
 
-TEST_CASE("Reading and writing memory", "memory")
+TEST_CASE("Hardware breakpoints reach new threads", "breakpoint")
 {
     bool close_on_exec = false;
     sdb::pipe channel(close_on_exec);
-
-    auto proc = process::launch("targets/memory", true, channel.get_write());
+    bool seize = true;
+    auto proc = process::launch("targets/many_threads", true, channel.get_write(), seize);
     channel.close_write();
 
+    // Every worker thread calls worker_tick, but none exist yet
     proc->resume();
     proc->wait_on_signal();
+    virtual_address tick_address{from_bytes<std::uint64_t>(channel.read().data())};
+    proc.reset();
 
-    auto data_pointer = from_bytes<std::uint64_t>(channel.read().data());
-    auto data_vec = proc->read_memory(virtual_address{data_pointer}, 8);
-    auto data = from_bytes<std::uint64_t>(data_vec.data());
-    REQUIRE(data == 0xcafecafe);
+    proc = process::launch("targets/many_threads", true, std::nullopt, seize);
+    proc->create_breakpoint_site(tick_address, true).enable();
 
     proc->resume();
-    proc->wait_on_signal();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(proc->current_thread().tid() != proc->pid());
+    REQUIRE(proc->get_program_counter() == tick_address);
+}
 
-    auto str_pointer = from_bytes<std::uint64_t>(channel.read().data());
-    proc->write_memory(virtual_address{str_pointer}, {as_bytes("Hello, sdb!"), 12});
+TEST_CASE("Only four hardware breakpoints fit", "breakpoint")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    auto address = proc->get_program_counter();
+
+    for (auto i = 0; i < 4; ++i)
+    {
+        proc->create_breakpoint_site(address + i, true);
+    }
+    REQUIRE_THROWS_AS(proc->create_breakpoint_site(address + 4, true), error);
+
+    // Removing one frees its debug register
+    proc->breakpoint_sites().remove_by_address(address);
+    REQUIRE_NOTHROW(proc->create_breakpoint_site(address + 4, true));
+}
+
+TEST_CASE("Write watchpoint reports old and new values", "watchpoint")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("targets/watched", true, channel.get_write());
+    channel.close_write();
 
     proc->resume();
     proc->wait_on_signal();
 
-    auto read = channel.read();
-    REQUIRE(to_string_view(read) == "Hello, sdb!");
+    auto address_bytes = channel.read();
+    virtual_address counter_address{from_bytes<std::uint64_t>(address_bytes.data())};
+
+    auto& point = proc->create_watchpoint(counter_address, stoppoint_mode::Write, 4);
+    point.enable();
+    REQUIRE(point.data() == 0);
+
+    for (std::uint64_t expected = 1; expected <= 3; ++expected)
+    {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(reason.info == SIGTRAP);
+        REQUIRE(reason.watchpoint_id == point.id());
+        REQUIRE(point.previous_data() == expected - 1);
+        REQUIRE(point.data() == expected);
+    }
+
+    // The reads which follow don't trap
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Exited);
+    REQUIRE(reason.info == 0);
+}
+
+TEST_CASE("Read write watchpoint traps on reads", "watchpoint")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+    auto proc = process::launch("targets/watched", true, channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto address_bytes = channel.read();
+    virtual_address counter_address{from_bytes<std::uint64_t>(address_bytes.data())};
+
+    auto& point = proc->create_watchpoint(counter_address, stoppoint_mode::ReadWrite, 4);
+    point.enable();
+
+    // Three increments each read then write, and then two more reads
+    auto hits = 0;
+    while (true)
+    {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        if (reason.reason != process_state::Stopped)
+        {
+            REQUIRE(reason.reason == process_state::Exited);
+            REQUIRE(reason.info == 0);
+            break;
+        }
+
+        REQUIRE(reason.watchpoint_id == point.id());
+        ++hits;
+    }
+    REQUIRE(hits == 8);
+}
+
+TEST_CASE("Watchpoints must be aligned", "watchpoint")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    auto stack_pointer = proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rsp);
+    auto address = virtual_address{stack_pointer & ~std::uint64_t{7}};
+
+    REQUIRE_THROWS_AS(proc->create_watchpoint(address + 2, stoppoint_mode::Write, 4), error);
+    REQUIRE_THROWS_AS(proc->create_watchpoint(address, stoppoint_mode::Write, 3), error);
+    REQUIRE_NOTHROW(proc->create_watchpoint(address, stoppoint_mode::Write, 8));
+
+    // Watchpoints and hardware breakpoint sites share the four debug registers
+    for (auto i = 1; i < 4; ++i)
+    {
+        proc->create_breakpoint_site(proc->get_program_counter() + i, true);
+    }
+    REQUIRE_THROWS_AS(proc->create_watchpoint(address + 8, stoppoint_mode::Write, 8), error);
+}
+
+TEST_CASE("Can remove breakpoint sites", "breakpoint")
+{
+    auto proc = process::launch("targets/run_endlessly");
+
+    auto& site = proc->create_breakpoint_site(virtual_address{ 42 });
+    proc->create_breakpoint_site(virtual_address{ 43 });
+    REQUIRE(proc->breakpoint_sites().size() == 2);
+
+    proc->breakpoint_sites().remove_by_id(site.id());
+    proc->breakpoint_sites().remove_by_address(virtual_address{ 43 });
+    REQUIRE(proc->breakpoint_sites().empty());
+}
+
+TEST_CASE("Breakpoint sites are ordered by address", "breakpoint")
+{
+    auto proc = process::launch("targets/run_endlessly");
+
+    // Created out of order, and enough of them to need more than one chunk of storage
+    for (auto i = 0; i < 1000; ++i)
+    {
+        proc->create_breakpoint_site(virtual_address{ 1000 + (i * 7) % 1000 });
+    }
+
+    auto in_region = proc->breakpoint_sites().get_in_region(virtual_address{ 1100 }, virtual_address{ 1110 });
+    REQUIRE(in_region.size() == 10);
+    for (auto i = 0; i < 10; ++i)
+    {
+        REQUIRE(in_region[i]->address() == virtual_address{ 1100 + i });
+    }
+
+    auto next_address = 1000;
+    proc->breakpoint_sites().for_each([&](auto& site) {
+        REQUIRE(site.address() == virtual_address(next_address++));
+    });
+
+    proc->breakpoint_sites().remove_by_address(virtual_address{ 1105 });
+    REQUIRE(proc->breakpoint_sites().get_in_region(virtual_address{ 1100 }, virtual_address{ 1110 }).size() == 9);
+    REQUIRE_THROWS_AS(proc->breakpoint_sites().remove_by_address(virtual_address{ 1105 }), error);
+    REQUIRE(proc->breakpoint_sites().size() == 999);
+}
+
+TEST_CASE("Can enable and disable breakpoint sites in bulk", "breakpoint")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    auto address = proc->get_program_counter();
+    auto original = proc->read_memory(address, 64);
+
+    // Every other byte, so the bytes between sites must be kept too
+    for (auto i = 0; i < 64; i += 2)
+    {
+        proc->create_breakpoint_site(address + i);
+    }
+
+    proc->breakpoint_sites().enable_all(address, address + 32);
+    auto patched = proc->read_memory(address, 64);
+    for (auto i = 0; i < 64; ++i)
+    {
+        REQUIRE(patched[i] == (i % 2 == 0 && i < 32 ? std::byte{0xcc} : original[i]));
+    }
+    REQUIRE(proc->read_memory_without_traps(address, 64) == original);
+    REQUIRE(proc->breakpoint_sites().get_by_address(address + 30).is_enabled());
+    REQUIRE(!proc->breakpoint_sites().get_by_address(address + 32).is_enabled());
+
+    proc->breakpoint_sites().get_by_address(address + 40).enable();
+    proc->breakpoint_sites().disable_all(address, address + 64);
+    REQUIRE(proc->read_memory(address, 64) == original);
+    proc->breakpoint_sites().for_each([](auto& site) { REQUIRE(!site.is_enabled()); });
+}
+
+TEST_CASE("Expressions compile and evaluate", "expression")
+{
+    auto proc = process::launch("targets/run_endlessly");
+    auto& regs = proc->get_registers();
+    regs.write_by_id(register_id::rdi, std::uint64_t{0x1234});
+    auto stack_pointer = regs.read_by_id_as<std::uint64_t>(register_id::rsp);
+    auto stack_top = proc->read_memory_as<std::uint64_t>(virtual_address{stack_pointer});
+    auto evaluate = [&](std::string_view source) { return expression::compile(source).evaluate(regs, *proc); };
+
+    REQUIRE(evaluate("rdi == 0x1234") == 1);
+    REQUIRE(evaluate("rdi != 0x1234") == 0);
+    REQUIRE(evaluate("1 + 2 * 3 - 8 / 4 % 3") == 5);
+    REQUIRE(evaluate("(1 + 2) * 3 << 1 | 1") == 19);
+    REQUIRE(evaluate("edi + di") == 0x1234 + 0x1234);
+    REQUIRE(evaluate("-1 == ~0 && !0") == 1);
+    REQUIRE(evaluate("*rsp") == stack_top);
+    REQUIRE(evaluate("*(u8*)(rsp + 1)") == ((stack_top >> 8) & 0xff));
+    REQUIRE(evaluate("*(i8*)rsp") == static_cast<std::uint64_t>(static_cast<std::int8_t>(stack_top)));
+
+    // The right hand side would read unmapped memory if evaluated
+    REQUIRE(evaluate("0 && *0") == 0);
+    REQUIRE(evaluate("1 || *0") == 1);
+    REQUIRE_THROWS_AS(evaluate("*0"), error);
+    REQUIRE_THROWS_AS(evaluate("1 / (rdi - 0x1234)"), error);
+
+    REQUIRE_THROWS_AS(expression::compile("rdi =="), error);
+    REQUIRE_THROWS_AS(expression::compile("(rdi"), error);
+    REQUIRE_THROWS_AS(expression::compile("nosuchregister"), error);
+    REQUIRE_THROWS_AS(expression::compile("xmm0 == 1"), error);
+    REQUIRE_THROWS_AS(expression::compile("1 2"), error);
+}
+
+TEST_CASE("Conditional breakpoint only stops when true", "breakpoint")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto& site = proc->create_breakpoint_site(address);
+    site.set_condition(expression::compile("rdi == 42 || rdi == 9000"));
+    site.enable();
+
+    for (auto expected : {std::uint64_t{42}, std::uint64_t{9000}})
+    {
+        proc->resume();
+        auto reason = proc->wait_on_signal();
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(reason.breakpoint_id == site.id());
+        REQUIRE(proc->get_program_counter() == address);
+        REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rdi) == expected);
+    }
+    REQUIRE(site.hit_count() == 2);
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    REQUIRE(!reason.breakpoint_id);
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Exited);
+    REQUIRE(reason.info == 0);
+}
+
+TEST_CASE("Conditions see memory without our traps", "breakpoint")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    // Only true of the byte we saved, not the int3 we put in its place
+    auto& site = proc->create_breakpoint_site(address);
+    site.set_condition(expression::compile("*(u8*)rip != 0xcc"));
+    site.enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.breakpoint_id == site.id());
+    REQUIRE(site.hit_count() == 1);
+
+    // One which fails stops us, and still counts as a hit
+    site.set_condition(expression::compile("*0"));
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.breakpoint_id == site.id());
+    REQUIRE(site.hit_count() == 2);
+}
+
+TEST_CASE("Breakpoint ignore count skips hits", "breakpoint")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto& site = proc->create_breakpoint_site(address, true);
+    site.set_ignore_count(10);
+    site.enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.breakpoint_id == site.id());
+    REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rdi) == 10);
+    REQUIRE(site.hit_count() == 11);
+    REQUIRE(site.ignore_count() == 0);
+
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rdi) == 11);
+}
+
+TEST_CASE("Stepping over a breakpoint leaves it in place", "breakpoint")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto& called_site = proc->create_breakpoint_site(address);
+    called_site.enable();
+    proc->resume();
+    proc->wait_on_signal();
+
+    // The call to called is a rel32 call just before where it returns to
+    auto return_address = proc->read_memory_as<std::uint64_t>(virtual_address{proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rsp)});
+    auto call_address = virtual_address{return_address - 5};
+    REQUIRE(proc->read_memory_without_traps(call_address, 1)[0] == std::byte{0xe8});
+    auto& call_site = proc->create_breakpoint_site(call_address);
+    call_site.enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.breakpoint_id == call_site.id());
+
+    // The copy of the call ran elsewhere, but returns to the right place
+    reason = proc->step_instruction();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(proc->get_program_counter() == address);
+    auto stack_pointer = virtual_address{proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rsp)};
+    REQUIRE(proc->read_memory_as<std::uint64_t>(stack_pointer) == return_address);
+    REQUIRE(proc->read_memory(call_address, 1)[0] == std::byte{0xcc});
+
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.breakpoint_id == call_site.id());
+    REQUIRE(called_site.hit_count() == 1);
+}
+
+TEST_CASE("Every step over mode continues past a site", "breakpoint")
+{
+    for (auto mode : {step_over_mode::Remove, step_over_mode::Displace, step_over_mode::Emulate})
+    {
+        std::unique_ptr<process> proc;
+        auto address = launch_called(proc);
+        proc->set_step_over_mode(mode);
+
+        auto& site = proc->create_breakpoint_site(address);
+        site.enable();
+        for (std::uint64_t call = 0; call < 3; ++call)
+        {
+            proc->resume();
+            auto reason = proc->wait_on_signal();
+            REQUIRE(reason.breakpoint_id == site.id());
+            REQUIRE(proc->get_program_counter() == address);
+            REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rdi) == call);
+        }
+        REQUIRE(site.is_enabled());
+    }
+}
+
+TEST_CASE("Stepping over a function prologue is emulated correctly", "breakpoint")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    // At -O0 called starts push rbp; mov rbp, rsp, perhaps after endbr64
+    auto push_address = address;
+    auto code = proc->read_memory(address, 8);
+    if (code[0] == std::byte{0xf3})
+    {
+        REQUIRE(code[1] == std::byte{0x0f});
+        push_address += 4;
+    }
+    auto prologue = proc->read_memory(push_address, 4);
+    REQUIRE(prologue[0] == std::byte{0x55});
+    REQUIRE(prologue[1] == std::byte{0x48});
+    REQUIRE(prologue[2] == std::byte{0x89});
+    REQUIRE(prologue[3] == std::byte{0xe5});
+
+    for (auto site_address : {address, push_address, push_address + 1, push_address + 4})
+    {
+        if (!proc->breakpoint_sites().contains_address(site_address))
+        {
+            proc->create_breakpoint_site(site_address).enable();
+        }
+    }
+
+    auto read = [&](register_id id) { return proc->get_registers().read_by_id_as<std::uint64_t>(id); };
+    proc->resume();
+    proc->wait_on_signal();
+    if (push_address != address)
+    {
+        auto flags = read(register_id::eflags);
+        proc->resume();
+        proc->wait_on_signal();
+        REQUIRE(proc->get_program_counter() == push_address);
+        REQUIRE(read(register_id::eflags) == flags);
+    }
+
+    auto rbp = read(register_id::rbp);
+    auto rsp = read(register_id::rsp);
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(proc->get_program_counter() == push_address + 1);
+    REQUIRE(read(register_id::rsp) == rsp - 8);
+    REQUIRE(proc->read_memory_as<std::uint64_t>(virtual_address{rsp - 8}) == rbp);
+
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(proc->get_program_counter() == push_address + 4);
+    REQUIRE(read(register_id::rbp) == rsp - 8);
+    REQUIRE(read(register_id::rdi) == 0);
+
+    // And the function still works out its result from there
+    proc->breakpoint_sites().for_each([](auto& site) { site.disable(); });
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.info == SIGTRAP);
+    proc->resume();
+    reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Exited);
+    REQUIRE(reason.info == 0);
+}
+
+TEST_CASE("Stepping many instructions", "process")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto& site = proc->create_breakpoint_site(address);
+    site.enable();
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto reason = proc->step_instructions(3);
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(!reason.breakpoint_id);
+    REQUIRE(proc->get_program_counter() != address);
+
+    // Through two more calls of called, to where the loop sets up the third
+    site.disable();
+    reason = proc->step_instructions(std::numeric_limits<std::uint64_t>::max(), [](const registers& regs) {
+        return regs.read_by_id_as<std::uint64_t>(register_id::rdi) == 3;
+    });
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rdi) == 3);
+    REQUIRE(site.hit_count() == 1);
+
+    // Stepping onto a site is a hit
+    site.enable();
+    reason = proc->step_instructions(1000);
+    REQUIRE(reason.breakpoint_id == site.id());
+    REQUIRE(proc->get_program_counter() == address);
+    REQUIRE(site.hit_count() == 2);
+
+    REQUIRE_THROWS_AS(proc->step_instructions(0), error);
+}
+
+TEST_CASE("Next steps over calls and finish runs to the caller", "process")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto& called_site = proc->create_breakpoint_site(address);
+    called_site.enable();
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto read = [&](register_id id) { return proc->get_registers().read_by_id_as<std::uint64_t>(id); };
+    auto entry_stack_pointer = read(register_id::rsp);
+    auto return_address = proc->read_memory_as<std::uint64_t>(virtual_address{entry_stack_pointer});
+
+    // From the very start of called, before its frame exists
+    auto reason = proc->step_out();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(!reason.breakpoint_id);
+    REQUIRE(proc->get_program_counter().addr() == return_address);
+    REQUIRE(read(register_id::rsp) == entry_stack_pointer + 8);
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+
+    // Into the next call, then from partway through its body
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(read(register_id::rdi) == 1);
+    proc->step_instructions(4);
+    reason = proc->step_out();
+    REQUIRE(proc->get_program_counter().addr() == return_address);
+    REQUIRE(read(register_id::rsp) == entry_stack_pointer + 8);
+
+    // next over the call in the loop stays in the loop, unless a site in called stops it
+    called_site.disable();
+    auto call_address = virtual_address{return_address - 5};
+    while (proc->get_program_counter() != call_address)
+    {
+        reason = proc->step_over();
+        REQUIRE(reason.reason == process_state::Stopped);
+    }
+    auto stack_pointer = read(register_id::rsp);
+    reason = proc->step_over();
+    REQUIRE(proc->get_program_counter().addr() == return_address);
+    REQUIRE(read(register_id::rsp) == stack_pointer);
+    REQUIRE(called_site.hit_count() == 2);
+
+    called_site.enable();
+    while (proc->get_program_counter() != call_address)
+    {
+        proc->step_over();
+    }
+    reason = proc->step_over();
+    REQUIRE(reason.breakpoint_id == called_site.id());
+    REQUIRE(proc->get_program_counter() == address);
+    REQUIRE(proc->breakpoint_sites().size() == 1);
+}
+
+TEST_CASE("Decoded instructions are cached until written", "disassembler")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto& site = proc->create_breakpoint_site(address);
+    site.enable();
+    proc->resume();
+    proc->wait_on_signal();
+    auto return_address = proc->read_memory_as<std::uint64_t>(
+        virtual_address{proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rsp)});
+
+    auto call_address = virtual_address{return_address - 5};
+    auto& call = proc->decode_instruction(call_address);
+    REQUIRE(call.flow == control_flow::Call);
+    REQUIRE(call.length == 5);
+    REQUIRE(call.target == address);
+    REQUIRE(call.text().starts_with("call"));
+    REQUIRE(&proc->decode_instruction(call_address) == &call);
+
+    // At -O0, called stores its argument to the stack, beneath the int3 of the site
+    auto body = proc->decode_instructions(address, 4);
+    REQUIRE(body.size() == 4);
+    REQUIRE(body.front()->flow == control_flow::Sequential);
+    auto stores_argument = std::any_of(body.begin(), body.end(), [](auto instruction) {
+        return instruction->memory_operands.size() == 1
+            && instruction->memory_operands.front().base == register_id::rbp
+            && instruction->memory_operands.front().is_written
+            && instruction->memory_operands.front().size == 8;
+    });
+    REQUIRE(stores_argument);
+
+    auto original = proc->read_memory(call_address, 5);
+    std::vector<std::byte> nops(5, std::byte{0x90});
+    proc->write_memory(call_address, {nops.data(), nops.size()});
+    auto& nop = proc->decode_instruction(call_address);
+    REQUIRE(nop.flow == control_flow::Sequential);
+    REQUIRE(nop.length == 1);
+
+    proc->write_memory(call_address, {original.data(), original.size()});
+    REQUIRE(proc->decode_instruction(call_address).flow == control_flow::Call);
+}
+
+TEST_CASE("Unwritten code is disassembled from the ELF file", "disassembler")
+{
+    auto proc = process::launch("targets/hello_sdb");
+    auto entry_point = get_entry_point("targets/hello_sdb");
+    auto entry = get_load_address(proc->pid(), entry_point);
+
+    auto file = proc->get_elf();
+    REQUIRE(file != nullptr);
+    REQUIRE(file->load_bias() + file->get_header().e_entry == entry);
+
+    auto original = proc->read_memory(entry, 16);
+    auto& first = proc->decode_instruction(entry);
+    auto length = first.length;
+    REQUIRE(std::equal(first.bytes.begin(), first.bytes.begin() + length, original.begin()));
+
+    // The file never has our int3
+    auto& site = proc->create_breakpoint_site(entry);
+    site.enable();
+    REQUIRE(proc->decode_instruction(entry).bytes[0] == original[0]);
+    site.disable();
+
+    // Once we write code, it is read from the inferior instead
+    std::vector<std::byte> nops(16, std::byte{0x90});
+    proc->write_memory(entry, {nops.data(), nops.size()});
+    REQUIRE(proc->decode_instruction(entry).length == 1);
+    proc->write_memory(entry, {original.data(), original.size()});
+    REQUIRE(proc->decode_instruction(entry).length == length);
+
+    // Without a process, code is at the addresses it was linked at
+    elf unloaded("targets/hello_sdb");
+    disassembler dis(unloaded);
+    auto instructions = dis.disassemble(3);
+    REQUIRE(instructions.size() == 3);
+    REQUIRE(instructions.front()->address.addr() == static_cast<std::uint64_t>(entry_point));
+    REQUIRE(instructions.front()->length == length);
+}
+
+TEST_CASE("Symbols are found by name and by address", "elf")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto file = proc->get_elf();
+    REQUIRE(file != nullptr);
+    REQUIRE(file->get_section(".symtab") != nullptr);
+
+    auto symbols = file->get_symbols_by_name("_Z6calledm");
+    REQUIRE(symbols.size() == 1);
+    auto called = symbols.front();
+    REQUIRE(file->load_bias() + called->st_value == address);
+    REQUIRE(file->get_symbol_name(*called) == "_Z6calledm");
+    REQUIRE(file->get_demangled_name(*called) == "called(unsigned long)");
+
+    // As written in the source, with or without its parameters
+    REQUIRE(file->get_symbols_by_name("called") == symbols);
+    REQUIRE(file->get_symbols_by_name("called(unsigned long)") == symbols);
+    REQUIRE(!file->get_symbols_by_name("main").empty());
+    REQUIRE(file->get_symbols_by_name("not_a_symbol").empty());
+
+    auto linked = address - file->load_bias().addr();
+    REQUIRE(file->get_symbol_containing_address(linked) == called);
+    REQUIRE(file->get_symbol_containing_address(linked + called->st_size - 1) == called);
+    REQUIRE(file->get_symbol_containing_address(linked + called->st_size) != called);
+}
+
+TEST_CASE("A file without sections has no symbols", "elf")
+{
+    Elf64_Ehdr header{};
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+
+    auto path = std::filesystem::temp_directory_path() / std::format("sdb_sectionless_{}", getpid());
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    elf file(path);
+    REQUIRE(file.section_count() == 0);
+    REQUIRE(file.symbol_count() == 0);
+    REQUIRE(file.get_symbols_by_name("main").empty());
+    REQUIRE(file.get_symbol_containing_address(virtual_address{0x1000}) == nullptr);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("The symbol index is cached by build ID", "elf")
+{
+    std::unique_ptr<process> proc;
+    launch_called(proc);
+    auto path = proc->get_elf()->path();
+    auto cache = std::filesystem::temp_directory_path() / std::format("sdb_index_{}", proc->pid());
+
+    elf cold(path, cache);
+    REQUIRE(!cold.build_id().empty());
+    REQUIRE(!cold.is_index_cached());
+    REQUIRE(std::filesystem::exists(cache / cold.build_id()));
+
+    elf warm(path, cache);
+    REQUIRE(warm.is_index_cached());
+    REQUIRE(warm.symbol_count() == cold.symbol_count());
+    auto called = warm.get_symbols_by_name("_Z6calledm");
+    REQUIRE(called.size() == 1);
+    REQUIRE(called.front()->st_value == cold.get_symbols_by_name("_Z6calledm").front()->st_value);
+    REQUIRE(warm.get_symbol_containing_address(virtual_address{called.front()->st_value}) == called.front());
+
+    // One written for another file, or another version of this one, is rebuilt
+    std::filesystem::resize_file(cache / cold.build_id(), 16);
+    elf rebuilt(path, cache);
+    REQUIRE(!rebuilt.is_index_cached());
+    REQUIRE(rebuilt.symbol_count() == cold.symbol_count());
+
+    // As is one whose refs run past the symbol tables
+    {
+        std::fstream file(cache / cold.build_id(), std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(-static_cast<std::streamoff>(sizeof(std::uint32_t)), std::ios::end);
+        std::uint32_t corrupt = 0xffffffff;
+        file.write(reinterpret_cast<const char*>(&corrupt), sizeof(corrupt));
+    }
+    elf corrupted(path, cache);
+    REQUIRE(!corrupted.is_index_cached());
+    REQUIRE(corrupted.get_symbols_by_name("_Z6calledm").size() == 1);
+
+    std::filesystem::remove_all(cache);
+}
+
+TEST_CASE("Source lines are found by address and by line", "elf")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto file = proc->get_elf();
+    REQUIRE(file != nullptr);
+    auto& lines = file->get_line_table();
+    REQUIRE(lines.unit_count() > 0);
+    REQUIRE(lines.decoded_unit_count() == 0);
+
+    // The line called is declared on has no code of its own, so the next line with code is used
+    auto linked = address - file->load_bias().addr();
+    auto addresses = lines.get_addresses("called.cpp", 7);
+    REQUIRE(addresses.size() == 1);
+    REQUIRE(addresses.front() == linked);
+    REQUIRE(lines.get_addresses("targets/called.cpp", 7) == addresses);
+    REQUIRE(lines.get_addresses("alled.cpp", 7).empty());
+    REQUIRE(lines.get_addresses("called.cpp", 1000).empty());
+
+    auto body = lines.get_addresses("called.cpp", 9);
+    REQUIRE(body.size() == 1);
+    auto location = lines.get_location(body.front());
+    REQUIRE(location);
+    REQUIRE(location->file.ends_with("/called.cpp"));
+    REQUIRE(location->line == 9);
+    REQUIRE(!lines.get_location(virtual_address{0}));
+
+    auto& site = proc->create_breakpoint_site(file->load_bias() + body.front().addr());
+    site.enable();
+    proc->resume();
+    proc->wait_on_signal();
+    REQUIRE(proc->get_program_counter() == site.address());
+}
+
+TEST_CASE("Compressed debug sections are decompressed when first read", "elf")
+{
+    elf file("targets/compressed_debug");
+    auto section = file.get_section(".debug_line");
+    REQUIRE(section != nullptr);
+    REQUIRE((section->sh_flags & SHF_COMPRESSED) != 0);
+
+    auto contents = file.get_section_contents(".debug_line");
+    REQUIRE(contents.size() > section->sh_size);
+    REQUIRE(file.get_section_contents(".debug_line").begin() == contents.begin());
+
+    // The return in main
+    auto addresses = file.get_line_table().get_addresses("compressed_debug.cpp", 24);
+    REQUIRE(addresses.size() == 1);
+
+    // Decompressed into the cache, then mapped from it
+    auto cache = std::filesystem::temp_directory_path() / std::format("sdb_sections_{}", getpid());
+    {
+        elf cold("targets/compressed_debug", cache);
+        REQUIRE(cold.get_line_table().get_addresses("compressed_debug.cpp", 24) == addresses);
+        REQUIRE(std::filesystem::file_size(cache / "sections" / (cold.build_id() + ".debug_line")) == contents.size());
+    }
+
+    elf warm("targets/compressed_debug", cache);
+    auto cached = warm.get_section_contents(".debug_line");
+    REQUIRE(cached.size() == contents.size());
+    REQUIRE(std::equal(cached.begin(), cached.end(), contents.begin()));
+    REQUIRE(warm.get_line_table().get_addresses("compressed_debug.cpp", 24) == addresses);
+
+    std::filesystem::remove_all(cache);
+}
+
+TEST_CASE("Sections compressed with zstd are decompressed", "elf")
+{
+    // Not every toolchain can write them, so compress one ourselves
+    std::string contents;
+    for (auto i = 0; i < 1000; ++i)
+    {
+        contents += std::format("string{}", i) + '\0';
+    }
+    std::string compressed(ZSTD_compressBound(contents.size()), '\0');
+    auto compressed_size = ZSTD_compress(compressed.data(), compressed.size(), contents.data(), contents.size(), 3);
+    REQUIRE(!ZSTD_isError(compressed_size));
+    compressed.resize(compressed_size);
+
+    // Older elf.h only knows zlib
+    constexpr Elf64_Word cCompressZstd{2};
+    Elf64_Chdr compression{cCompressZstd, 0, contents.size(), 1};
+    std::string section(reinterpret_cast<const char*>(&compression), sizeof(compression));
+    section += compressed;
+    std::string section_names("\0.debug_str\0.shstrtab\0", 22);
+
+    auto section_offset = sizeof(Elf64_Ehdr);
+    auto names_offset = section_offset + section.size();
+    auto headers_offset = (names_offset + section_names.size() + 7) & ~std::size_t{7};
+
+    Elf64_Shdr sections[3]{};
+    sections[1] = {1, SHT_PROGBITS, SHF_COMPRESSED, 0, section_offset, section.size(), 0, 0, 8, 1};
+    sections[2] = {12, SHT_STRTAB, 0, 0, names_offset, section_names.size(), 0, 0, 1, 0};
+
+    Elf64_Ehdr header{};
+    std::memcpy(header.e_ident, ELFMAG, SELFMAG);
+    header.e_ident[EI_CLASS] = ELFCLASS64;
+    header.e_ident[EI_DATA] = ELFDATA2LSB;
+    header.e_ident[EI_VERSION] = EV_CURRENT;
+    header.e_type = ET_EXEC;
+    header.e_machine = EM_X86_64;
+    header.e_version = EV_CURRENT;
+    header.e_ehsize = sizeof(Elf64_Ehdr);
+    header.e_shoff = headers_offset;
+    header.e_shentsize = sizeof(Elf64_Shdr);
+    header.e_shnum = 3;
+    header.e_shstrndx = 2;
+
+    auto path = std::filesystem::temp_directory_path() / std::format("sdb_zstd_{}", getpid());
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(section.data(), section.size());
+        out.write(section_names.data(), section_names.size());
+        out.write(std::string(headers_offset - names_offset - section_names.size(), '\0').data(),
+            headers_offset - names_offset - section_names.size());
+        out.write(reinterpret_cast<const char*>(sections), sizeof(sections));
+    }
+
+    elf file(path);
+    auto decompressed = file.get_section_contents(".debug_str");
+    REQUIRE(decompressed.size() == contents.size());
+    REQUIRE(std::memcmp(decompressed.begin(), contents.data(), contents.size()) == 0);
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Recording instructions until a breakpoint", "trace")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto& site = proc->create_breakpoint_site(address);
+    site.enable();
+    proc->resume();
+    proc->wait_on_signal();
+    auto rsp = proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rsp);
+    auto return_address = proc->read_memory_as<std::uint64_t>(virtual_address{rsp});
+
+    // Through called, back to the loop, and into the next call
+    auto path = std::filesystem::temp_directory_path() / std::format("sdb_instructions_{}", proc->pid());
+    std::uint64_t recorded;
+    {
+        instruction_trace_writer writer(path, true);
+        auto reason = proc->record_instructions(writer);
+        REQUIRE(reason.reason == process_state::Stopped);
+        REQUIRE(reason.breakpoint_id == site.id());
+        REQUIRE(proc->get_program_counter() == address);
+        REQUIRE(proc->get_registers().read_by_id_as<std::uint64_t>(register_id::rdi) == 1);
+        REQUIRE(site.hit_count() == 2);
+        recorded = writer.size();
+    }
+    REQUIRE(recorded > 10);
+
+    instruction_trace_reader reader(path);
+    REQUIRE(reader.records_registers());
+    auto first = reader.next();
+    REQUIRE(first->pc == address.addr());
+    REQUIRE(first->gprs.rdi == 0);
+    REQUIRE(first->gprs.rsp == rsp);
+
+    std::uint64_t count = 1;
+    auto returned = false;
+    while (auto entry = reader.next())
+    {
+        returned = returned || entry->pc == return_address;
+        ++count;
+    }
+    REQUIRE(returned);
+    REQUIRE(count == recorded);
+    std::filesystem::remove(path);
+
+    // Stepping a limited number of times, without registers
+    instruction_trace_writer writer(path, false);
+    auto reason = proc->record_instructions(writer, 3);
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(!reason.breakpoint_id);
+    REQUIRE(writer.size() == 3);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Tracepoints record into a ring buffer", "trace")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    // Room for exactly the last hundred of the ten thousand calls
+    trace_spec spec;
+    spec.registers.push_back(register_id::rdi);
+    spec.memory.push_back({expression::compile("rsp"), 8});
+    REQUIRE(spec.record_size() == 64);
+    auto path = std::filesystem::temp_directory_path() / std::format("sdb_trace_{}", proc->pid());
+    auto buffer = std::make_shared<trace_buffer>(path, 100 * spec.record_size());
+    proc->set_trace_buffer(buffer);
+
+    auto& site = proc->create_breakpoint_site(address);
+    site.set_trace(std::move(spec));
+    site.enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(!reason.breakpoint_id);
+    REQUIRE(site.hit_count() == 10000);
+    REQUIRE(buffer->size() == 100);
+    REQUIRE(buffer->overwritten() == 9900);
+
+    std::uint64_t expected = 9900;
+    buffer->for_each([&](span<const std::byte> record) {
+        REQUIRE(record.size() == 64);
+        REQUIRE(from_bytes<std::int32_t>(record.begin() + 4) == site.id());
+        REQUIRE(from_bytes<std::uint64_t>(record.begin() + 8) == expected);
+        REQUIRE(from_bytes<std::int32_t>(record.begin() + 16) == proc->pid());
+        REQUIRE(from_bytes<std::uint32_t>(record.begin() + 24) == 5); // DWARF number of rdi
+        REQUIRE(from_bytes<std::uint64_t>(record.begin() + 32) == expected);
+        REQUIRE(from_bytes<std::uint32_t>(record.begin() + 48) == 8);
+        REQUIRE(from_bytes<std::uint32_t>(record.begin() + 52) == 8); // Bytes read
+        ++expected;
+    });
+
+    // The mapped file is the trace, without dumping it
+    std::ifstream file(path, std::ios::binary);
+    std::string magic(8, ' ');
+    file.read(magic.data(), magic.size());
+    REQUIRE(magic == "SDBTRACE");
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Tracepoint stops if its record can't fit", "trace")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+    proc->set_trace_buffer(std::make_shared<trace_buffer>(16));
+
+    trace_spec spec;
+    spec.registers.push_back(register_id::rdi);
+    auto& site = proc->create_breakpoint_site(address);
+    site.set_trace(std::move(spec));
+    site.enable();
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.breakpoint_id == site.id());
+
+    trace_spec untraceable;
+    untraceable.registers.push_back(register_id::edi);
+    REQUIRE_THROWS_AS(site.set_trace(untraceable), error);
+}
+
+TEST_CASE("Fast tracepoints record without stopping", "trace")
+{
+    std::unique_ptr<process> proc;
+    auto address = launch_called(proc);
+
+    auto original = proc->read_memory(address, 8);
+    auto& point = proc->create_fast_tracepoint(address);
+    point.enable();
+
+    // We see the instructions as they were, though the inferior runs a jump
+    REQUIRE(proc->read_memory_without_traps(address, 8) == original);
+    REQUIRE(proc->read_memory(address, 1)[0] == std::byte{0xe9});
+
+    proc->resume();
+    auto reason = proc->wait_on_signal();
+    REQUIRE(reason.reason == process_state::Stopped);
+    REQUIRE(reason.info == SIGTRAP);
+
+    // Only the last lap of the ring is left of the ten thousand calls
+    std::vector<fast_trace_record> records;
+    auto lost = proc->drain_fast_trace(records);
+    REQUIRE(records.size() == process::cFastTraceSlots);
+    REQUIRE(lost == 10000 - process::cFastTraceSlots);
+
+    auto expected = 10000 - process::cFastTraceSlots;
+    for (auto& record : records)
+    {
+        REQUIRE(record.sequence == expected + 1);
+        REQUIRE(record.address == address.addr());
+        REQUIRE(record.rdi == expected);
+        ++expected;
+    }
+
+    records.clear();
+    REQUIRE(proc->drain_fast_trace(records) == 0);
+    REQUIRE(records.empty());
+
+    point.disable();
+    REQUIRE(proc->read_memory(address, 8) == original);
+    REQUIRE_THROWS_AS(proc->create_fast_tracepoint(address), error);
+}
+
+TEST_CASE("Reading and writing memory", "memory")
+{
+    bool close_on_exec = false;
+    sdb::pipe channel(close_on_exec);
+
+    auto proc = process::launch("targets/memory", true, channel.get_write());
+    channel.close_write();
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto data_pointer = from_bytes<std::uint64_t>(channel.read().data());
+    auto data_vec = proc->read_memory(virtual_address{data_pointer}, 8);
+    auto data = from_bytes<std::uint64_t>(data_vec.data());
+    REQUIRE(data == 0xcafecafe);
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto str_pointer = from_bytes<std::uint64_t>(channel.read().data());
+    proc->write_memory(virtual_address{str_pointer}, {as_bytes("Hello, sdb!"), 12});
+
+    proc->resume();
+    proc->wait_on_signal();
+
+    auto read = channel.read();
+    REQUIRE(to_string_view(read) == "Hello, sdb!");
+}
+
+TEST_CASE("Writing read only memory", "memory")
+{
+    auto proc = process::launch("targets/hello_sdb");
+
+    auto offset = get_entry_point("targets/hello_sdb");
+    auto load_address = get_load_address(proc->pid(), offset);
+
+    auto original = proc->read_memory(load_address, 16);
+    std::vector<std::byte> nops(16, std::byte{0x90});
+
+    REQUIRE_THROWS_AS(proc->write_memory(load_address, {nops.data(), nops.size()}, memory_write_method::VmWritev), error);
+
+    proc->write_memory(load_address, {nops.data(), nops.size()}, memory_write_method::ProcMem);
+    REQUIRE(proc->read_memory(load_address, 16) == nops);
+
+    // Odd size to exercise the read-modify-write of the final word
+    proc->write_memory(load_address, {original.data(), 13}, memory_write_method::Ptrace);
+    auto partially_restored = proc->read_memory(load_address, 16);
+    REQUIRE(std::equal(original.begin(), original.begin() + 13, partially_restored.begin()));
+    REQUIRE(partially_restored[13] == std::byte{0x90});
+
+    proc->write_memory(load_address, {original.data(), original.size()});
+    REQUIRE(proc->read_memory(load_address, 16) == original);
 }
@@ -0,0 +1,205 @@
+#include <libsdb/error.hpp>
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/register_info.hpp>
+
+#include <sys/user.h>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <optional>
+#include <print>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t cFieldCount{sizeof(user_regs_struct) / 8};
+
+struct options
+{
+    const char* path = nullptr;
+    std::uint64_t from = 0;
+    std::uint64_t to = std::numeric_limits<std::uint64_t>::max();
+    std::optional<std::size_t> histogram; // How many of the hottest addresses to show
+    bool registers = false;
+};
+
+void print_usage()
+{
+    std::println(R"(Usage: sdb-trace <trace> [options]
+    --from <address>     Only instructions at or above address, in 0x89ab format
+    --to <address>       Only instructions below address
+    --histogram [count]  The count most executed addresses, 20 by default, rather than every instruction
+    --registers          Also print the registers each instruction was given)");
+}
+
+std::optional<std::uint64_t> to_address(std::string_view text)
+{
+    if (text.starts_with("0x"))
+    {
+        text.remove_prefix(2);
+    }
+
+    std::uint64_t value;
+    auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(), value, 16);
+    if (ec != std::errc{} || end != text.data() + text.size())
+    {
+        return std::nullopt;
+    }
+
+    return value;
+}
+
+std::optional<options> parse_options(int argc, const char** argv)
+{
+    if (argc < 2)
+    {
+        return std::nullopt;
+    }
+
+    options result;
+    result.path = argv[1];
+    for (auto i = 2; i < argc; ++i)
+    {
+        std::string_view arg = argv[i];
+        if ((arg == "--from" || arg == "--to") && i + 1 < argc)
+        {
+            auto address = to_address(argv[++i]);
+            if (!address)
+            {
+                return std::nullopt;
+            }
+            (arg == "--from" ? result.from : result.to) = *address;
+        }
+        else if (arg == "--histogram")
+        {
+            result.histogram = 20;
+            std::size_t count;
+            std::string_view next = i + 1 < argc ? argv[i + 1] : "";
+            if (auto [end, ec] = std::from_chars(next.data(), next.data() + next.size(), count); ec == std::errc{} && !next.empty())
+            {
+                result.histogram = count;
+                ++i;
+            }
+        }
+        else if (arg == "--registers")
+        {
+            result.registers = true;
+        }
+        else
+        {
+            return std::nullopt;
+        }
+    }
+
+    return result;
+}
+
+// The name of each 8 byte field of user_regs_struct
+std::array<std::string_view, cFieldCount> field_names()
+{
+    std::array<std::string_view, cFieldCount> names{};
+    for (auto& info : sdb::g_register_infos)
+    {
+        if (info.type == sdb::register_type::Gpr && info.size == 8)
+        {
+            names[(info.offset - offsetof(user, regs)) / 8] = info.name;
+        }
+    }
+
+    return names;
+}
+
+void print_histogram(sdb::instruction_trace_reader& reader, const options& opts)
+{
+    std::unordered_map<std::uint64_t, std::uint64_t> counts;
+    std::uint64_t total = 0;
+    while (auto entry = reader.next())
+    {
+        if (entry->pc >= opts.from && entry->pc < opts.to)
+        {
+            ++counts[entry->pc];
+            ++total;
+        }
+    }
+
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> hottest(counts.begin(), counts.end());
+    auto shown = std::min(*opts.histogram, hottest.size());
+    std::partial_sort(hottest.begin(), hottest.begin() + shown, hottest.end(), [](auto& lhs, auto& rhs) {
+        return lhs.second != rhs.second ? lhs.second > rhs.second : lhs.first < rhs.first;
+    });
+
+    std::println("{} instructions at {} addresses", total, counts.size());
+    for (std::size_t i = 0; i < shown; ++i)
+    {
+        auto [pc, count] = hottest[i];
+        std::println("{:#018x} {:>12} {:>6.2f}%", pc, count, 100.0 * count / total);
+    }
+}
+
+void print_instructions(sdb::instruction_trace_reader& reader, const options& opts)
+{
+    auto names = field_names();
+    user_regs_struct previous{};
+    while (auto entry = reader.next())
+    {
+        if (entry->pc < opts.from || entry->pc >= opts.to)
+        {
+            previous = entry->gprs;
+            continue;
+        }
+
+        std::print("{:#018x}", entry->pc);
+        if (opts.registers && reader.records_registers())
+        {
+            auto now = reinterpret_cast<const std::uint64_t*>(&entry->gprs);
+            auto before = reinterpret_cast<const std::uint64_t*>(&previous);
+            for (std::size_t i = 0; i < cFieldCount; ++i)
+            {
+                if (now[i] != before[i] && names[i] != "rip")
+                {
+                    std::print(" {}={:#x}", names[i], now[i]);
+                }
+            }
+        }
+        std::println("");
+        previous = entry->gprs;
+    }
+}
+}
+
+int main(int argc, const char** argv)
+{
+    auto opts = parse_options(argc, argv);
+    if (!opts)
+    {
+        print_usage();
+        return -1;
+    }
+
+    try
+    {
+        sdb::instruction_trace_reader reader(opts->path);
+        if (opts->histogram)
+        {
+            print_histogram(reader, *opts);
+        }
+        else
+        {
+            print_instructions(reader, *opts);
+        }
+    }
+    catch (const sdb::error& err)
+    {
+        std::println("sdb-trace error: {}", err.what());
+        std::cout << std::flush;
+        return -1;
+    }
+}
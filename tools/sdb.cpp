@@ -3,6 +3,10 @@
 
 #include <libsdb/disassembler.hpp>
 #include <libsdb/error.hpp>
+#include <libsdb/event_loop.hpp>
+#include <libsdb/expression.hpp>
+#include <libsdb/instruction_trace.hpp>
+#include <libsdb/line_table.hpp>
 #include <libsdb/process.hpp>
 
 #include <cstdio> // This include seems to be missing from readline
@@ -12,10 +16,14 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/ptrace.h>
+#include <sys/signalfd.h>
 
 #include <algorithm>
 #include <charconv>
+#include <fstream>
 #include <iostream>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <string_view>
 #include <sstream>
@@ -28,6 +36,18 @@
 
 namespace
 {
+// Processes forked while following both parent and child, other than the current one
+std::vector<std::unique_ptr<sdb::process>> g_other_inferiors;
+
+// readline calls us back through a plain function pointer, so the state
+// our line handler needs lives here
+std::unique_ptr<sdb::process>* g_process = nullptr;
+sdb::event_loop* g_event_loop = nullptr;
+std::vector<sdb::task> g_stop_reports; // Coroutines which report a running process stopping
+bool g_finished = false;
+// Set between record start and record stop, when continue and step single step every instruction into it
+std::unique_ptr<sdb::instruction_trace_writer> g_recording;
+
 std::vector<std::string> split(std::string_view str, char delimiter)
 {
     std::vector<std::string> out{};
@@ -163,9 +183,17 @@ void print_help(const std::vector<std::string>& args)
             breakpoint  - Commands for operating on breakpoints
             continue    - Resume the process
             disassemble - Disassemble machine code to assembly
+            finish      - Run until the current function returns
+            follow      - Choose which process to trace after a fork
+            inferior    - Commands for switching between traced processes
             memory      - Commands for operating on memory
+            next        - Step over a call, or a single instruction
+            record      - Commands for recording every instruction executed
             register    - Commands for operating on registers
-            step        - Step over and execute a single instruction
+            step        - Step over and execute instructions
+            thread      - Commands for operating on threads
+            trace       - Commands for recording tracepoints
+            watchpoint  - Commands for operating on watchpoints
         )");
     }
     else if (is_prefix(args[1], "breakpoint"))
@@ -175,22 +203,86 @@ void print_help(const std::vector<std::string>& args)
             delete <id>
             disable <id>
             enable <id>
-            set <address>
+            ignore <id> <count>
+            set <address, symbol or file:line>
+            set <address, symbol or file:line> -h
+            set <address, symbol or file:line> if <condition>
+        )");
+    }
+    else if (is_prefix(args[1], "follow"))
+    {
+        std::println(R"(Available options:
+            parent
+            child
+            both
+        )");
+    }
+    else if (is_prefix(args[1], "inferior"))
+    {
+        std::println(R"(Available commands:
+            list
+            select <pid>
+        )");
+    }
+    else if (is_prefix(args[1], "watchpoint"))
+    {
+        std::println(R"(Available commands:
+            list
+            delete <id>
+            disable <id>
+            enable <id>
+            set <address or symbol> <write|rw> <size>
+        )");
+    }
+    else if (is_prefix(args[1], "trace"))
+    {
+        std::println(R"(Available commands:
+            buffer <bytes>
+            buffer <bytes> <file>
+            dump <file>
+            set <address or symbol> <register or address expression:size>...
+            set <address or symbol> -h <register or address expression:size>...
+            fast <address or symbol>
+            drain
+        )");
+    }
+    else if (is_prefix(args[1], "record"))
+    {
+        std::println(R"(Available commands:
+            start <file>
+            start <file> -r
+            stop
+        )");
+    }
+    else if (is_prefix(args[1], "step"))
+    {
+        std::println(R"(Available commands:
+            step
+            step <count>
+            step until <condition>
+            step <count> until <condition>
+        )");
+    }
+    else if (is_prefix(args[1], "thread"))
+    {
+        std::println(R"(Available commands:
+            list
+            select <tid>
         )");
     }
     else if (is_prefix(args[1], "disassemble"))
     {
         std::println(R"(Available options:
             -c <number of instructions>
-            -a <start address>
+            -a <start address or symbol>
         )");
     }
     else if (is_prefix(args[1], "memory"))
     {
         std::println(R"(Available commands:
-            read <address>
-            read <address> <number of bytes to read>
-            write <address> <bytes>
+            read <address or symbol>
+            read <address or symbol> <number of bytes to read>
+            write <address or symbol> <bytes>
         )");
     }
     else if (is_prefix(args[1], "register"))
@@ -208,13 +300,134 @@ void print_help(const std::vector<std::string>& args)
     }
 }
 
+// Every address of the first line with code at or after file:line, which
+// may be more than one when the file is a header compiled into many units.
+// Nothing if text isn't file:line.
+std::optional<std::vector<sdb::virtual_address>> parse_source_line(const sdb::process& process, std::string_view text)
+{
+    auto file = process.get_elf();
+    auto separator = text.rfind(':');
+    if (!file || separator == std::string_view::npos)
+    {
+        return std::nullopt;
+    }
+
+    auto line = to_integral<std::uint32_t>(text.substr(separator + 1));
+    if (!line)
+    {
+        return std::nullopt;
+    }
+
+    auto addresses = file->get_line_table().get_addresses(text.substr(0, separator), *line);
+    if (addresses.empty())
+    {
+        sdb::error::send(std::format("No code for {}", text));
+    }
+    for (auto& address : addresses)
+    {
+        address = file->load_bias() + address.addr();
+    }
+    return addresses;
+}
+
+// Hex, file:line, or failing that the name of a symbol in the executable, which must name only one address.
+// A leading 0x means it is always hex, for symbols such as add which are also hex.
+std::optional<sdb::virtual_address> parse_address(const sdb::process& process, std::string_view text)
+{
+    if (auto addresses = parse_source_line(process, text))
+    {
+        if (addresses->size() > 1)
+        {
+            sdb::error::send(std::format("{} is compiled into more than one place, so use an address", text));
+        }
+        return addresses->front();
+    }
+
+    auto file = process.get_elf();
+    if (!text.starts_with("0x") && file)
+    {
+        auto symbols = file->get_symbols_by_name(text);
+        if (!symbols.empty())
+        {
+            auto address = symbols.front()->st_value;
+            if (std::any_of(symbols.begin(), symbols.end(), [address](auto symbol) { return symbol->st_value != address; }))
+            {
+                sdb::error::send(std::format("{} names more than one symbol, so use its mangled name", text));
+            }
+            return file->load_bias() + address;
+        }
+    }
+
+    auto address = to_integral<std::uint64_t>(text, 16);
+    if (!address)
+    {
+        return std::nullopt;
+    }
+    return sdb::virtual_address{*address};
+}
+
+// The symbol holding address, with the offset into it, as in main+0x1c
+std::optional<std::string> describe_address(const sdb::process& process, sdb::virtual_address address)
+{
+    auto file = process.get_elf();
+    if (!file)
+    {
+        return std::nullopt;
+    }
+
+    auto linked = address - file->load_bias().addr();
+    auto symbol = file->get_symbol_containing_address(linked);
+    if (!symbol)
+    {
+        return std::nullopt;
+    }
+
+    auto name = file->get_demangled_name(*symbol);
+    auto offset = linked.addr() - symbol->st_value;
+    return offset == 0 ? name : std::format("{}+{:#x}", name, offset);
+}
+
+// The file and line address was compiled from, if the executable has line information for it
+std::optional<sdb::source_location> find_source_location(const sdb::process& process, sdb::virtual_address address)
+{
+    auto file = process.get_elf();
+    if (!file)
+    {
+        return std::nullopt;
+    }
+
+    return file->get_line_table().get_location(address - file->load_bias().addr());
+}
+
+// The line itself, if the source is where the compiler found it
+void print_source_line(const sdb::source_location& location)
+{
+    std::ifstream source{std::string{location.file}};
+    std::string text;
+    for (std::uint32_t line = 0; line < location.line; ++line)
+    {
+        if (!std::getline(source, text))
+        {
+            return;
+        }
+    }
+    std::println("{:>6} {}", location.line, text);
+}
+
 void print_disassembly(sdb::process& process, sdb::virtual_address address, std::size_t instuction_count)
 {
     sdb::disassembler dis(process);
     auto instructions = dis.disassemble(instuction_count, address); 
-    for (auto& instruction : instructions)
+    for (auto instruction : instructions)
     {
-        std::println("{:#018x}: {}", instruction.address.addr(), instruction.text);
+        if (auto location = describe_address(process, instruction->address))
+        {
+            std::println("{:#018x} <{}>: {}", instruction->address.addr(), *location, instruction->text());
+        }
+        else
+        {
+            std::println("{:#018x}: {}", instruction->address.addr(), instruction->text());
+        }
     }
 }
 
@@ -229,13 +442,13 @@ void handle_disassemble_command(sdb::process& process, const std::vector<std::st
         if (*it == "-a" && it + 1 != args.end())
         {
             ++it;
-            auto opt_addr = to_integral<std::uint64_t>(*it++, 16);
+            auto opt_addr = parse_address(process, *it++);
             if (!opt_addr)
             {
                 sdb::error::send("Invalid address format");
             }
 
-            address = sdb::virtual_address{ *opt_addr };
+            address = *opt_addr;
         }
         else if (*it == "-c" && it + 1 != args.end())
         {
@@ -260,7 +473,7 @@ void handle_disassemble_command(sdb::process& process, const std::vector<std::st
 
 void handle_memory_read_command(sdb::process& process, const std::vector<std::string>& args)
 {
-    auto address = to_integral<std::uint64_t>(args[2], 16);
+    auto address = parse_address(process, args[2]);
     if (!address)
     {
         sdb::error::send("Invalid address format");
@@ -277,13 +490,13 @@ void handle_memory_read_command(sdb::process& process, const std::vector<std::st
         read_byte_count = *bytes_arg;
     }
 
-    auto data = process.read_memory(sdb::virtual_address{address.value()}, read_byte_count);
+    auto data = process.read_memory(address.value(), read_byte_count);
 
     for (std::size_t i = 0; i < data.size(); i += 16)
     {
         auto start = data.begin() + i;
         auto end = data.begin() + std::min(i + 16, data.size());
-        std::print("{:#016x}: ", address.value() + i);
+        std::print("{:#016x}: ", address->addr() + i);
         for (auto it = start; it != end; it++)
         {
             std::print(" {:02x}", static_cast<std::uint8_t>(*it));
@@ -299,14 +512,14 @@ void handle_memory_write_command(sdb::process& process, const std::vector<std::s
         return;
     }
 
-    auto address = to_integral<std::uint64_t>(args[2], 16);
+    auto address = parse_address(process, args[2]);
     if (!address.has_value())
     {
         sdb::error::send("Invalid address format");
     }
 
     auto data = parse_vector(args[3]);
-    process.write_memory(sdb::virtual_address{address.value()}, {data.data(), data.size()});
+    process.write_memory(address.value(), {data.data(), data.size()});
 }
 
 void handle_memory_command(sdb::process& process, const std::vector<std::string>& args)
@@ -490,15 +703,17 @@ void handle_register_command(sdb::process& process, const std::vector<std::strin
 
 std::unique_ptr<sdb::process> attach(int argc, const char** argv)
 {
+    // Seizing avoids sending the inferior SIGSTOP and SIGCONT
+    bool seize = true;
     if (argc == 3 && argv[1] == std::string_view("-p"))
     {
         pid_t pid = std::atoi(argv[2]);
-        return sdb::process::attach(pid);
+        return sdb::process::attach(pid, seize);
     }
     else
     {
         auto program_path = argv[1];
-        auto proc = sdb::process::launch(program_path);
+        auto proc = sdb::process::launch(program_path, true, std::nullopt, seize);
         std::println("Launched process with pid {}", proc->pid());
         return proc;
     }
@@ -507,6 +722,10 @@ std::unique_ptr<sdb::process> attach(int argc, const char** argv)
 void print_stop_reason(const sdb::process& process, sdb::stop_reason reason)
 {
     std::print("Process {} ", process.pid());
+    if (process.threads().size() > 1)
+    {
+        std::print("thread {} ", process.current_thread().tid());
+    }
     switch (reason.reason)
     {
         case sdb::process_state::Exited:
@@ -517,9 +736,24 @@ void print_stop_reason(const sdb::process& process, sdb::stop_reason reason)
             break;
         case sdb::process_state::Stopped:
             std::print("stopped with signal {} at {:#x}", sigabbrev_np(reason.info), process.get_program_counter().addr());
+            if (auto location = describe_address(process, process.get_program_counter()))
+            {
+                std::print(" <{}>", *location);
+            }
+            if (auto location = find_source_location(process, process.get_program_counter()))
+            {
+                std::print(" at {}:{}", location->file, location->line);
+            }
             break;
     }
     std::println("");
+
+    if (reason.watchpoint_id && process.watchpoints().contains_id(*reason.watchpoint_id))
+    {
+        auto& point = process.watchpoints().get_by_id(*reason.watchpoint_id);
+        std::println("Watchpoint {} at {:#x}: old value {:#x}, new value {:#x}",
+            point.id(), point.address().addr(), point.previous_data(), point.data());
+    }
 }
 
 void handle_stop(sdb::process& process, sdb::stop_reason reason)
@@ -527,6 +761,10 @@ void handle_stop(sdb::process& process, sdb::stop_reason reason)
     print_stop_reason(process, reason);
     if (reason.reason == sdb::process_state::Stopped)
     {
+        if (auto location = find_source_location(process, process.get_program_counter()))
+        {
+            print_source_line(*location);
+        }
         print_disassembly(process, process.get_program_counter(), 5);
     }
 }
@@ -551,7 +789,21 @@ void handle_breakpoint_command(sdb::process& process, const std::vector<std::str
         {
             std::println("Current breakpoints:");
             process.breakpoint_sites().for_each([] (auto& site) {
-                std::println("{}: address = {:#x}, {}", site.id(), site.address().addr(), site.is_enabled() ? "enabled" : "disabled");
+                std::print("{}: address = {:#x}, {}{}, hits = {}", site.id(), site.address().addr(),
+                    site.is_enabled() ? "enabled" : "disabled", site.is_hardware() ? ", hardware" : "", site.hit_count());
+                if (site.ignore_count() > 0)
+                {
+                    std::print(", ignoring {}", site.ignore_count());
+                }
+                if (site.condition())
+                {
+                    std::print(", if {}", site.condition()->source());
+                }
+                if (site.trace())
+                {
+                    std::print(", tracepoint");
+                }
+                std::println("");
             });
         }
         return;
@@ -566,14 +818,39 @@ void handle_breakpoint_command(sdb::process& process, const std::vector<std::str
 
     if (is_prefix(command, "set"))
     {
-        auto address = to_integral<std::uint64_t>(args[2], 16);
-        if (!address)
+        // A line may be compiled into several places, so gets a site at each
+        auto addresses = parse_source_line(process, args[2]);
+        if (!addresses)
         {
-            std::println("Breakpoint command expects address in 0x89ab format");
-            return;
+            auto address = parse_address(process, args[2]);
+            if (!address)
+            {
+                std::println("Breakpoint command expects address in 0x89ab format, a symbol, or file:line");
+                return;
+            }
+            addresses = std::vector{*address};
         }
 
-        process.create_breakpoint_site(sdb::virtual_address{*address}).enable();
+        auto hardware = args.size() > 3 && args[3] == "-h";
+        auto condition_start = std::find(args.begin() + 3, args.end(), "if");
+        std::optional<sdb::expression> condition;
+        if (condition_start != args.end())
+        {
+            // The condition was split on spaces along with everything else
+            std::string source;
+            for (auto it = std::next(condition_start); it != args.end(); ++it)
+            {
+                source += *it + " ";
+            }
+            condition = sdb::expression::compile(source);
+        }
+
+        for (auto address : *addresses)
+        {
+            auto& site = process.create_breakpoint_site(address, hardware);
+            site.set_condition(condition);
+            site.enable();
+        }
         return;
     }
 
@@ -595,7 +872,447 @@ void handle_breakpoint_command(sdb::process& process, const std::vector<std::str
     {
         process.breakpoint_sites().remove_by_id(id.value());
     }
+    else if (is_prefix(command, "ignore"))
+    {
+        auto count = args.size() > 3 ? to_integral<std::uint64_t>(args[3]) : std::nullopt;
+        if (!count)
+        {
+            std::println("Command expects an ignore count");
+            return;
+        }
+        process.breakpoint_sites().get_by_id(id.value()).set_ignore_count(*count);
+    }
+
+}
+
+void handle_watchpoint_command(sdb::process& process, const std::vector<std::string>& args)
+{
+    if (args.size() < 2)
+    {
+        print_help({"help", "watchpoint"});
+        return;
+    }
+
+    auto command = args[1];
+
+    if (is_prefix(command, "list"))
+    {
+        if (process.watchpoints().empty())
+        {
+            std::println("No watchpoints set");
+        }
+        else
+        {
+            std::println("Current watchpoints:");
+            process.watchpoints().for_each([] (auto& point) {
+                std::println("{}: address = {:#x}, mode = {}, size = {}, {}", point.id(), point.address().addr(),
+                    point.mode() == sdb::stoppoint_mode::Write ? "write" : "rw", point.size(),
+                    point.is_enabled() ? "enabled" : "disabled");
+            });
+        }
+        return;
+    }
+
+    if (is_prefix(command, "set"))
+    {
+        if (args.size() != 5)
+        {
+            print_help({"help", "watchpoint"});
+            return;
+        }
+
+        auto address = parse_address(process, args[2]);
+        auto size = to_integral<std::size_t>(args[4]);
+        if (!address || !size || (args[3] != "write" && args[3] != "rw"))
+        {
+            print_help({"help", "watchpoint"});
+            return;
+        }
+
+        auto mode = args[3] == "write" ? sdb::stoppoint_mode::Write : sdb::stoppoint_mode::ReadWrite;
+        process.create_watchpoint(*address, mode, *size).enable();
+        return;
+    }
+
+    if (args.size() < 3)
+    {
+        print_help({"help", "watchpoint"});
+        return;
+    }
+
+    auto id = to_integral<sdb::watchpoint::id_type>(args[2]);
+    if (!id.has_value())
+    {
+        std::println("Command expects watchpoint id");
+        return;
+    }
+
+    if (is_prefix(command, "enable"))
+    {
+        process.watchpoints().get_by_id(id.value()).enable();
+    }
+    else if (is_prefix(command, "disable"))
+    {
+        process.watchpoints().get_by_id(id.value()).disable();
+    }
+    else if (is_prefix(command, "delete"))
+    {
+        process.watchpoints().remove_by_id(id.value());
+    }
+}
+
+std::string_view thread_state_name(sdb::process_state state)
+{
+    switch (state)
+    {
+        case sdb::process_state::Stopped: return "stopped";
+        case sdb::process_state::Running: return "running";
+        case sdb::process_state::Exited: return "exited";
+        case sdb::process_state::Terminated: return "terminated";
+    }
+
+    return "unknown";
+}
+
+void handle_thread_command(sdb::process& process, const std::vector<std::string>& args)
+{
+    if (args.size() < 2)
+    {
+        print_help({"help", "thread"});
+        return;
+    }
+
+    auto command = args[1];
+
+    if (is_prefix(command, "list"))
+    {
+        for (auto& [tid, thread] : process.threads())
+        {
+            auto is_current = tid == process.current_thread().tid();
+            auto pc = thread->get_registers().read_by_id_as<std::uint64_t>(sdb::register_id::rip);
+            std::println("{} {}: {}, pc = {:#x}", is_current ? '*' : ' ', tid, thread_state_name(thread->state()), pc);
+        }
+    }
+    else if (is_prefix(command, "select") && args.size() == 3)
+    {
+        auto tid = to_integral<pid_t>(args[2]);
+        if (!tid)
+        {
+            std::println("Command expects thread id");
+            return;
+        }
+
+        process.set_current_thread(*tid);
+        print_disassembly(process, process.get_program_counter(), 5);
+    }
+    else
+    {
+        print_help({"help", "thread"});
+    }
+}
+
+void handle_trace_command(sdb::process& process, const std::vector<std::string>& args)
+{
+    if (args.size() == 2 && is_prefix(args[1], "drain"))
+    {
+        std::vector<sdb::fast_trace_record> records;
+        auto lost = process.drain_fast_trace(records);
+        for (auto& record : records)
+        {
+            std::println("{} {:#x}: rdi={:#x} rsi={:#x} rsp={:#x}", record.sequence, record.address, record.rdi, record.rsi, record.rsp);
+        }
+        if (lost != 0)
+        {
+            std::println("{} records were overwritten", lost);
+        }
+        return;
+    }
+
+    if (args.size() < 3)
+    {
+        print_help({"help", "trace"});
+        return;
+    }
+
+    auto command = args[1];
+
+    if (is_prefix(command, "buffer"))
+    {
+        auto capacity = to_integral<std::size_t>(args[2]);
+        if (!capacity)
+        {
+            std::println("Command expects a size in bytes");
+            return;
+        }
+
+        if (args.size() > 3)
+        {
+            process.set_trace_buffer(std::make_shared<sdb::trace_buffer>(args[3], *capacity));
+        }
+        else
+        {
+            process.set_trace_buffer(std::make_shared<sdb::trace_buffer>(*capacity));
+        }
+    }
+    else if (is_prefix(command, "dump"))
+    {
+        auto& buffer = process.get_trace_buffer();
+        if (!buffer)
+        {
+            std::println("No trace buffer");
+            return;
+        }
+
+        buffer->dump(args[2]);
+        std::println("Wrote {} records, {} were overwritten", buffer->size(), buffer->overwritten());
+    }
+    else if (is_prefix(command, "set"))
+    {
+        auto address = parse_address(process, args[2]);
+        if (!address)
+        {
+            std::println("Trace command expects address in 0x89ab format, or a symbol");
+            return;
+        }
+
+        auto hardware = args.size() > 3 && args[3] == "-h";
+        sdb::trace_spec spec;
+        for (auto it = args.begin() + (hardware ? 4 : 3); it != args.end(); ++it)
+        {
+            // Memory ranges are written rsp+8:16, registers just by name
+            auto separator = it->rfind(':');
+            if (separator == std::string::npos)
+            {
+                spec.registers.push_back(sdb::register_info_by_name(*it).id);
+                continue;
+            }
+
+            auto size = to_integral<std::uint32_t>(std::string_view{*it}.substr(separator + 1));
+            if (!size)
+            {
+                std::println("Memory ranges are written <address expression>:<size>");
+                return;
+            }
+            spec.memory.push_back({sdb::expression::compile(std::string_view{*it}.substr(0, separator)), *size});
+        }
+
+        // So tracing works without setting up a buffer first
+        if (!process.get_trace_buffer())
+        {
+            static constexpr std::size_t cDefaultCapacity{1 << 20};
+            process.set_trace_buffer(std::make_shared<sdb::trace_buffer>(cDefaultCapacity));
+        }
+
+        auto& site = process.create_breakpoint_site(*address, hardware);
+        site.set_trace(std::move(spec));
+        site.enable();
+    }
+    else if (is_prefix(command, "fast"))
+    {
+        auto address = parse_address(process, args[2]);
+        if (!address)
+        {
+            std::println("Trace command expects address in 0x89ab format, or a symbol");
+            return;
+        }
+
+        auto& point = process.create_fast_tracepoint(*address);
+        point.enable();
+        std::println("Fast tracepoint {} jumps to {:#x}", point.id(), point.trampoline().addr());
+    }
+    else
+    {
+        print_help({"help", "trace"});
+    }
+}
+
+void handle_record_command(const std::vector<std::string>& args)
+{
+    if (args.size() >= 3 && is_prefix(args[1], "start"))
+    {
+        // With -r, the registers each instruction changed too
+        auto record_registers = args.size() > 3 && args[3] == "-r";
+        g_recording = std::make_unique<sdb::instruction_trace_writer>(args[2], record_registers);
+        std::println("Recording, continue and step now trace every instruction");
+    }
+    else if (args.size() == 2 && is_prefix(args[1], "stop"))
+    {
+        if (!g_recording)
+        {
+            std::println("Not recording");
+            return;
+        }
+
+        std::println("Recorded {} instructions", g_recording->size());
+        g_recording.reset();
+    }
+    else
+    {
+        print_help({"help", "record"});
+    }
+}
+
+void handle_follow_command(sdb::process& process, const std::vector<std::string>& args)
+{
+    if (args.size() != 2)
+    {
+        print_help({"help", "follow"});
+        return;
+    }
 
+    if (is_prefix(args[1], "parent"))
+    {
+        process.set_follow_fork_mode(sdb::follow_fork_mode::Parent);
+    }
+    else if (is_prefix(args[1], "child"))
+    {
+        process.set_follow_fork_mode(sdb::follow_fork_mode::Child);
+    }
+    else if (is_prefix(args[1], "both"))
+    {
+        process.set_follow_fork_mode(sdb::follow_fork_mode::Both);
+    }
+    else
+    {
+        print_help({"help", "follow"});
+    }
+}
+
+void handle_inferior_command(std::unique_ptr<sdb::process>& process, const std::vector<std::string>& args)
+{
+    if (args.size() < 2)
+    {
+        print_help({"help", "inferior"});
+        return;
+    }
+
+    if (is_prefix(args[1], "list"))
+    {
+        std::println("* {}", process->pid());
+        for (auto& inferior : g_other_inferiors)
+        {
+            std::println("  {}", inferior->pid());
+        }
+    }
+    else if (is_prefix(args[1], "select") && args.size() == 3)
+    {
+        auto pid = to_integral<pid_t>(args[2]);
+        auto it = std::find_if(g_other_inferiors.begin(), g_other_inferiors.end(),
+            [&](auto& inferior) { return pid && inferior->pid() == *pid; });
+        if (it == g_other_inferiors.end())
+        {
+            std::println("No such inferior");
+            return;
+        }
+
+        std::swap(process, *it);
+    }
+    else
+    {
+        print_help({"help", "inferior"});
+    }
+}
+
+void adopt_forked_processes(sdb::process& process)
+{
+    for (auto& child : process.take_forked_processes())
+    {
+        child->set_follow_fork_mode(process.get_follow_fork_mode());
+        std::println("Tracing forked process {}", child->pid());
+        g_event_loop->add_process(*child);
+        g_other_inferiors.push_back(std::move(child));
+    }
+}
+
+// Print without mangling a line the user is part way through typing
+template <typename F>
+void print_above_prompt(F print)
+{
+    auto saved_point = rl_point;
+    auto saved_line = rl_copy_text(0, rl_end);
+    rl_set_prompt("");
+    rl_replace_line("", 0);
+    rl_redisplay();
+
+    print();
+    std::cout << std::flush;
+
+    rl_set_prompt("sdb> ");
+    rl_replace_line(saved_line, 0);
+    rl_point = saved_point;
+    rl_redisplay();
+    free(saved_line);
+}
+
+sdb::task report_stop(sdb::process& process)
+{
+    auto reason = co_await process.stopped();
+    print_above_prompt([&] {
+        handle_stop(process, reason);
+        adopt_forked_processes(process);
+    });
+}
+
+void handle_interrupt(sdb::process& process)
+{
+    if (process.state() != sdb::process_state::Running)
+    {
+        // Just abandon the current line, like a shell
+        std::println("");
+        rl_replace_line("", 0);
+        rl_on_new_line();
+        rl_redisplay();
+        return;
+    }
+
+    // A process we launched shares our terminal, which has already sent it SIGINT
+    if (getpgid(process.pid()) != getpgrp())
+    {
+        process.interrupt();
+    }
+}
+
+void handle_step_command(sdb::process& process, const std::vector<std::string>& args)
+{
+    auto until_start = std::find(args.begin() + 1, args.end(), "until");
+    // Until a condition holds, as many steps as it takes, otherwise just one
+    auto count = until_start == args.end() ? std::uint64_t{1} : std::numeric_limits<std::uint64_t>::max();
+    if (until_start != args.begin() + 1 && args.size() > 1)
+    {
+        auto parsed = to_integral<std::uint64_t>(args[1]);
+        if (!parsed || *parsed == 0 || until_start != args.begin() + 2)
+        {
+            print_help({"help", "step"});
+            return;
+        }
+        count = *parsed;
+    }
+
+    sdb::process::step_predicate until;
+    if (until_start != args.end())
+    {
+        // The condition was split on spaces along with everything else
+        std::string source;
+        for (auto it = std::next(until_start); it != args.end(); ++it)
+        {
+            source += *it + " ";
+        }
+
+        auto condition = std::make_shared<sdb::expression>(sdb::expression::compile(source));
+        until = [condition, &process](const sdb::registers& regs) {
+            return condition->evaluate(regs, process) != 0;
+        };
+    }
+
+    // Only the final stop is reported, however many steps it took
+    auto reason = g_recording ? process.record_instructions(*g_recording, count, until) : process.step_instructions(count, until);
+    handle_stop(process, reason);
+    adopt_forked_processes(process);
+}
+
+bool allowed_while_running(std::string_view command)
+{
+    return is_prefix(command, "help") || is_prefix(command, "follow") || is_prefix(command, "inferior");
 }
 
 void handle_command(std::unique_ptr<sdb::process>& process, std::string_view line)
@@ -603,6 +1320,12 @@ void handle_command(std::unique_ptr<sdb::process>& process, std::string_view lin
     auto args = split(line, ' ');
     auto command = args[0];
 
+    if (process->state() == sdb::process_state::Running && !allowed_while_running(command))
+    {
+        std::println("Process is running, press Ctrl-C to interrupt it");
+        return;
+    }
+
     if (is_prefix(command, "help"))
     {
         print_help(args);
@@ -613,26 +1336,70 @@ void handle_command(std::unique_ptr<sdb::process>& process, std::string_view lin
     }
     else if (is_prefix(command, "continue"))
     {
+        if (g_recording)
+        {
+            // Until something other than a step stops it, or the inferior gets our Ctrl-C
+            auto reason = process->record_instructions(*g_recording);
+            handle_stop(*process, reason);
+            adopt_forked_processes(*process);
+            return;
+        }
+
+        // We report the stop whenever it comes, and meanwhile keep taking commands
         process->resume();
-        auto reason = process->wait_on_signal();
-        handle_stop(*process, reason);
+        g_stop_reports.push_back(report_stop(*process));
     }
     else if (is_prefix(command, "disassemble"))
     {
         handle_disassemble_command(*process, args);
     }
+    else if (is_prefix(command, "follow"))
+    {
+        handle_follow_command(*process, args);
+    }
+    else if (is_prefix(command, "finish"))
+    {
+        auto reason = process->step_out();
+        handle_stop(*process, reason);
+        adopt_forked_processes(*process);
+    }
+    else if (is_prefix(command, "inferior"))
+    {
+        handle_inferior_command(process, args);
+    }
     else if (is_prefix(command, "memory"))
     {
         handle_memory_command(*process, args);
     }
+    else if (is_prefix(command, "next"))
+    {
+        auto reason = process->step_over();
+        handle_stop(*process, reason);
+        adopt_forked_processes(*process);
+    }
     else if (is_prefix(command, "register"))
     {
         handle_register_command(*process, args);
     }
+    else if (is_prefix(command, "record"))
+    {
+        handle_record_command(args);
+    }
     else if (is_prefix(command, "step"))
     {
-        auto reason = process->step_instruction();
-        handle_stop(*process, reason);
+        handle_step_command(*process, args);
+    }
+    else if (is_prefix(command, "thread"))
+    {
+        handle_thread_command(*process, args);
+    }
+    else if (is_prefix(command, "trace"))
+    {
+        handle_trace_command(*process, args);
+    }
+    else if (is_prefix(command, "watchpoint"))
+    {
+        handle_watchpoint_command(*process, args);
     }
     else
     {
@@ -640,41 +1407,105 @@ void handle_command(std::unique_ptr<sdb::process>& process, std::string_view lin
     }
 }
 
-void main_loop(std::unique_ptr<sdb::process>& process)
+void handle_line(char* line_ptr)
 {
-    char* line_ptr = nullptr;
-    while ((line_ptr = readline("sdb> ")) !=  nullptr)
+    if (line_ptr == nullptr)
     {
-        std::string line;
+        // End of input
+        g_finished = true;
+        rl_callback_handler_remove();
+        return;
+    }
 
-        if (line_ptr == std::string_view{""})
+    std::string line;
+
+    if (line_ptr == std::string_view{""})
+    {
+        free(line_ptr);
+        if (history_length > 0)
         {
-            free(line_ptr);
-            if (history_length > 0)
-            {
-                line = history_list()[history_length - 1]->line;
-            }
+            line = history_list()[history_length - 1]->line;
         }
-        else
+    }
+    else
+    {
+        line = line_ptr;
+        add_history(line_ptr);
+        free(line_ptr);
+    }
+
+    if (!line.empty())
+    {
+        try
         {
-            line = line_ptr;
-            add_history(line_ptr);
-            free(line_ptr);
+            handle_command(*g_process, line);
         }
+        catch (const sdb::error& err)
+        {
+            std::println("sdb error: {}", err.what());
+            std::cout << std::flush;
+        }
+    }
+}
 
-        if (!line.empty())
+void report_finished_stops()
+{
+    std::erase_if(g_stop_reports, [](auto& report) {
+        if (!report.done())
         {
-            try
-            {
-                handle_command(process, line);
-            }
-            catch (const sdb::error& err)
-            {
-                std::println("sdb error: {}", err.what());
-                std::cout << std::flush;
-            }
+            return false;
+        }
+
+        try
+        {
+            report.get();
         }
+        catch (const sdb::error& err)
+        {
+            print_above_prompt([&] { std::println("sdb error: {}", err.what()); });
+        }
+        return true;
+    });
+}
+
+void main_loop(std::unique_ptr<sdb::process>& process)
+{
+    sdb::event_loop loop;
+    g_event_loop = &loop;
+    g_process = &process;
+    loop.add_process(*process);
+
+    // Ctrl-C should interrupt the inferior rather than end sdb
+    sigset_t interrupt_mask;
+    sigemptyset(&interrupt_mask);
+    sigaddset(&interrupt_mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &interrupt_mask, nullptr);
+    auto interrupt_fd = signalfd(-1, &interrupt_mask, SFD_CLOEXEC);
+    loop.add_fd(interrupt_fd, [&] {
+        signalfd_siginfo info;
+        read(interrupt_fd, &info, sizeof(info));
+        handle_interrupt(*process);
+    });
+
+    loop.add_fd(STDIN_FILENO, [] { rl_callback_read_char(); });
+    rl_callback_handler_install("sdb> ", handle_line);
+
+    while (!g_finished)
+    {
+        loop.run_once();
+        report_finished_stops();
+    }
+
+    g_stop_reports.clear();
+    for (auto& inferior : g_other_inferiors)
+    {
+        loop.remove_process(*inferior);
     }
+    loop.remove_process(*process);
+    loop.remove_fd(STDIN_FILENO);
+    loop.remove_fd(interrupt_fd);
+    close(interrupt_fd);
+    g_event_loop = nullptr;
 }
 }
 